@@ -18,27 +18,85 @@
 #define __QLOG_H
 
 typedef unsigned char qlog_buffer_id_t;
+typedef unsigned short qlog_thread_id_t;
 
 #define QLOG_RET_OK             0
 #define QLOG_RET_ERR            -1
 #define QLOG_RET_EVNT_LOCKED    -2
 #define QLOG_RET_ALREADY_INITED -3
+#define QLOG_RET_FROZEN         -4
+
+#define QLOG_BUFFER_PER_CPU     0x01    /*!< The buffer is sharded per CPU */
+#define QLOG_BUFFER_HUGEPAGES   0x02    /*!< The events are backed by huge pages if available */
+#define QLOG_BUFFER_MLOCK       0x04    /*!< The events are locked into the memory */
+#define QLOG_BUFFER_NUMA        0x08    /*!< The events are bound to a NUMA node */
+
+/**
+ * \struct qlog_buffer_attr_t
+ * \brief Attributes of a new log buffer (see qlog_create_buffer_attr)
+ */
+typedef struct qlog_buffer_attr_t {
+    size_t size;                    /*!< Number of events (per shard if sharded) */
+    unsigned int flags;             /*!< QLOG_BUFFER_* flags */
+    unsigned int shard_num;         /*!< Number of per-CPU shards, 0 for the number of CPUs */
+    int numa_node;                  /*!< NUMA node of the events (QLOG_BUFFER_NUMA), -1 for the local node */
+} qlog_buffer_attr_t;
+
+/**
+ * \struct qlog_stats_t
+ * \brief Runtime statistics of a log buffer
+ *
+ * The counters are collected since the buffer has been created or
+ * last reset (elapsed seconds).
+ */
+typedef struct qlog_stats_t {
+    unsigned long events;           /*!< Number of events stored */
+    unsigned long bytes;            /*!< Number of message and payload bytes stored */
+    unsigned long ext_bytes;        /*!< Number of external payload bytes stored */
+    unsigned long drops;            /*!< Number of events dropped (event was locked) */
+    unsigned long wraps;            /*!< Number of buffer wraps */
+    unsigned long lock_contended;   /*!< Number of times the buffer lock was found busy */
+    unsigned long repeats;          /*!< Number of repeated events folded into the previous one */
+    unsigned long frozen;           /*!< Number of events dropped while the buffer was frozen */
+    double elapsed;                 /*!< Length of the statistics period in seconds */
+    double events_per_sec;          /*!< Average event rate */
+    double bytes_per_sec;           /*!< Average byte rate */
+} qlog_stats_t;
+
+/**
+ * \struct qlog_reservation_t
+ * \brief Handle of a reserved event (see qlog_reserve)
+ */
+typedef struct qlog_reservation_t {
+    char* data;                     /*!< Writable message region inside the event */
+    size_t size;                    /*!< Size of the region including the terminating zero */
+    struct qlog_buffer_t* buffer;   /*!< The buffer of the event (internal) */
+    struct qlog_event_t* event;     /*!< The reserved event (internal) */
+    struct qlog_site_t* site;       /*!< The call site of the event (internal) */
+} qlog_reservation_t;
 
 int qlog_init(size_t size);
-void qlog_thread_init(const char* thread_name);
+qlog_thread_id_t qlog_thread_init(const char* thread_name);
 int qlog_reset(void);
 int qlog_reset_buffer_id(qlog_buffer_id_t buffer_id);
 void qlog_cleanup(void);
 qlog_buffer_id_t qlog_create_buffer(size_t size);
+qlog_buffer_id_t qlog_create_buffer_attr(const qlog_buffer_attr_t* attr);
 int qlog_delete_buffer(qlog_buffer_id_t buffer_id);
+int qlog_resize_buffer(qlog_buffer_id_t buffer_id, size_t new_size);
+int qlog_set_dedup(qlog_buffer_id_t buffer_id, int enabled);
+int qlog_get_dedup(qlog_buffer_id_t buffer_id);
 int qlog_log(const char* message);
 int qlog_log_id(qlog_buffer_id_t buffer_id, const char* message);
 int qlog_log_long(const char* thread, const char* function, unsigned int line_num, const char* message);
 int qlog_log_long_id(qlog_buffer_id_t buffer_id, const char* thread, const char* function, unsigned int line_num, const char* message);
+int qlog_reserve(qlog_buffer_id_t buffer_id, size_t max_len, qlog_reservation_t* handle);
+int qlog_commit(qlog_reservation_t* handle, size_t len);
 void qlog_toggle_status(void);
 int qlog_get_status(void);
 void qlog_inc_indent(void);
 void qlog_dec_indent(void);
+int qlog_get_stats(qlog_buffer_id_t buffer_id, qlog_stats_t* stats);
 
 int qlog_start_server(void);
 void qlog_wait_for_server(void);
@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_crash.h
+ * \brief Crash dump of the log buffers on fatal signals.
+ */
+#ifndef __QLOG_CRASH_H
+#define __QLOG_CRASH_H
+
+#define QLOG_CRASH_FATAL        0x01    /*!< Dump on SIGSEGV, SIGABRT and SIGBUS */
+#define QLOG_CRASH_ON_DEMAND    0x02    /*!< Dump on SIGUSR1 and continue */
+
+int qlog_crash_handler_install(int fd, int flags);
+int qlog_crash_handler_install_file(const char* path, int flags);
+void qlog_crash_handler_uninstall(void);
+void qlog_crash_dump(int fd);
+
+#endif
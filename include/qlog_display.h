@@ -10,11 +10,19 @@ void qlog_display_event(FILE* stream, const qlog_event_t* event);
 void qlog_display_format_timestamp(char* buffer, size_t size, const struct timeval* t);
 void qlog_display_format_event_str(const qlog_event_t* event, char* buffer, size_t buffer_size);
 void qlog_display_print_buffer_id(FILE* stream, qlog_buffer_id_t buffer_id);
+int qlog_display_print_buffer_filter(FILE* stream, qlog_buffer_id_t buffer_id, const char* expr);
 void qlog_display_print_buffer(FILE* stream);
 void qlog_display_print_buffer_list(FILE* stream);
+void qlog_display_print_buffer_stats(FILE* stream);
+void qlog_display_print_sites(FILE* stream, const char* pattern);
+void qlog_display_print_threads(FILE* stream);
+void qlog_display_print_latencies(FILE* stream);
+void qlog_display_print_metrics(FILE* stream);
+void qlog_display_print_snapshots(FILE* stream);
 
 void qlog_display_enable_indention(void);
 void qlog_display_disable_indention(void);
+void qlog_display_set_fields_json(int enabled);
 
 
 #endif
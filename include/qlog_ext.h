@@ -6,6 +6,9 @@
 #ifndef __QLOG_EXT_H
 #define __QLOG_EXT_H
 
+#include <sys/uio.h>
+#include "qlog_site.h"
+
 typedef unsigned int qlog_ext_event_type_t;
 typedef void (*qlog_ext_print_cb_t)(FILE* stream, void* data, size_t data_size);
 
@@ -25,7 +28,9 @@ typedef struct qlog_ext_event_info_t {
 #define QLOG_EXT_EVENT_TYPE_NONE            0
 #define QLOG_EXT_EVENT_TYPE_BT              1
 #define QLOG_EXT_EVENT_TYPE_HEXDUMP         2
-#define QLOG_EXT_EVENT_TYPE_LAST QLOG_EXT_EVENT_TYPE_HEXDUMP
+#define QLOG_EXT_EVENT_TYPE_STACK           3   /* qlog_stack_id_t of an interned stack */
+#define QLOG_EXT_EVENT_TYPE_FTRACE          4   /* qlog_ftrace_record_t of a traced function */
+#define QLOG_EXT_EVENT_TYPE_LAST QLOG_EXT_EVENT_TYPE_FTRACE
 #define QLOG_EXT_EVENT_TYPE_DYNAMIC_START   100
 
 qlog_ext_print_cb_t qlog_ext_get_print_cb(qlog_ext_event_type_t ext_event_type);
@@ -58,12 +63,34 @@ int qlog_ext_log_long_id(qlog_buffer_id_t buffer_id,
         int line_number,
         const char* message);
 
+int qlog_ext_log_site(qlog_site_t* site,
+        qlog_ext_event_type_t event_type,
+        void* ext_data,
+        size_t data_size,
+        const char* message);
+
+int qlog_ext_logv(qlog_ext_event_type_t event_type,
+        const struct iovec* iov,
+        int iovcnt,
+        size_t max_size,
+        const char* message);
+
+int qlog_ext_logv_id(qlog_buffer_id_t buffer_id,
+        qlog_ext_event_type_t event_type,
+        const struct iovec* iov,
+        int iovcnt,
+        size_t max_size,
+        const char* message);
 
 int qlog_ext_event_type_is_valid(qlog_ext_event_type_t event_type);
 
 int qlog_ext_register_built_in_events(void);
 void qlog_ext_display_hex_dump(FILE* stream, void* datap, size_t size);
 void qlog_ext_display_bt(FILE* stream, void* datap, size_t size);
+void qlog_ext_display_stack(FILE* stream, void* datap, size_t size);
+void qlog_ext_display_ftrace(FILE* stream, void* datap, size_t size);
+void qlog_ext_enable_compact_hex(void);
+void qlog_ext_disable_compact_hex(void);
 int qlog_ext_init(void);
 qlog_ext_event_type_t qlog_ext_register_event(qlog_ext_print_cb_t print_callback);
 
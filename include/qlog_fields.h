@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_fields.h
+ * \brief Typed key/value fields of the log events.
+ *
+ * The fields are encoded in binary into the tail of the message field of
+ * the event (the text message is truncated to make room for them), no
+ * formatting is done while logging. They are rendered as key=value pairs
+ * or JSON when the buffer is displayed and can be filtered numerically
+ * (see qlog_fields_filter_parse).
+ *
+ * Encoding of a field: type byte, key with terminating zero, value.
+ *  - INT, DURATION: zigzag varint
+ *  - DOUBLE: 8 bytes, host byte order
+ *  - BOOL: 1 byte
+ *  - STR: the string with terminating zero
+ */
+#ifndef __QLOG_FIELDS_H
+#define __QLOG_FIELDS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "qlog_site.h"
+
+#define QLOG_FIELD_INT          1   /*!< int64_t */
+#define QLOG_FIELD_DOUBLE       2   /*!< double */
+#define QLOG_FIELD_STR          3   /*!< string */
+#define QLOG_FIELD_BOOL         4   /*!< 0 or 1 (stored in value.i) */
+#define QLOG_FIELD_DURATION     5   /*!< int64_t nanoseconds */
+
+#define QLOG_FIELD_KEY_MAX_LEN  31  /*!< Longer keys are truncated */
+#define QLOG_FIELD_STR_MAX_LEN  63  /*!< Longer string values are truncated */
+
+/**
+ * \struct qlog_field_t
+ * \brief A typed key/value field
+ */
+typedef struct qlog_field_t {
+    const char* key;            /*!< Name of the field */
+    uint8_t type;               /*!< QLOG_FIELD_* */
+    union {
+        int64_t i;              /*!< INT, BOOL and DURATION (ns) */
+        double d;               /*!< DOUBLE */
+        const char* s;          /*!< STR */
+    } value;
+} qlog_field_t;
+
+/* field initializers of the QLOG_FIELDS macros and the field arrays */
+#define QLOG_F_INT(key, v)      {(key), QLOG_FIELD_INT, {.i = (int64_t) (v)}}
+#define QLOG_F_DOUBLE(key, v)   {(key), QLOG_FIELD_DOUBLE, {.d = (double) (v)}}
+#define QLOG_F_STR(key, v)      {(key), QLOG_FIELD_STR, {.s = (v)}}
+#define QLOG_F_BOOL(key, v)     {(key), QLOG_FIELD_BOOL, {.i = (v) ? 1 : 0}}
+#define QLOG_F_DURATION(key, ns) {(key), QLOG_FIELD_DURATION, {.i = (int64_t) (ns)}}
+
+#define QLOG_FIELDS_OP_EQ       0
+#define QLOG_FIELDS_OP_NE       1
+#define QLOG_FIELDS_OP_LT       2
+#define QLOG_FIELDS_OP_LE       3
+#define QLOG_FIELDS_OP_GT       4
+#define QLOG_FIELDS_OP_GE       5
+
+/**
+ * \struct qlog_fields_filter_t
+ * \brief A parsed field condition, e.g. "latency_us > 500"
+ */
+typedef struct qlog_fields_filter_t {
+    char key[QLOG_FIELD_KEY_MAX_LEN + 1];   /*!< Name of the field */
+    int op;                                 /*!< QLOG_FIELDS_OP_* */
+    int numeric;                            /*!< The value is a number (compared to INT, DOUBLE, BOOL, DURATION) */
+    double number;                          /*!< Numeric value (durations in ns) */
+    char str[QLOG_FIELD_STR_MAX_LEN + 1];   /*!< String value (compared to STR) */
+} qlog_fields_filter_t;
+
+int qlog_log_fields(const char* message, const qlog_field_t* fields, size_t field_num);
+int qlog_log_fields_id(qlog_buffer_id_t buffer_id, const char* message,
+        const qlog_field_t* fields, size_t field_num);
+int qlog_log_fields_site(qlog_site_t* site, const char* message,
+        const qlog_field_t* fields, size_t field_num);
+
+size_t qlog_fields_encode(void* out, size_t size, const qlog_field_t* fields, size_t field_num);
+int qlog_fields_decode(const void* data, size_t size, size_t* offset, qlog_field_t* field);
+size_t qlog_fields_format(const void* data, size_t size, char* out, size_t out_size, int json);
+
+int qlog_fields_filter_parse(const char* expr, qlog_fields_filter_t* filter);
+int qlog_fields_filter_match(const qlog_fields_filter_t* filter, const void* data, size_t size);
+
+#endif
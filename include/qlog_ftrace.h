@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_ftrace.h
+ * \brief Automatic function tracing by the -finstrument-functions hooks.
+ *
+ * Build the module with the QLOG_FTRACE cmake option and compile the code
+ * to be traced with -finstrument-functions. After qlog_ftrace_start() the
+ * function enter/exit hooks log a 16 byte record (function and call site
+ * address) into a dedicated log buffer, the thread id and the timestamp are
+ * the ones of the event. The addresses are resolved when displayed.
+ */
+#ifndef __QLOG_FTRACE_H
+#define __QLOG_FTRACE_H
+
+#define QLOG_FTRACE_MAX_RANGE_NUM   64
+
+/**
+ * \struct qlog_ftrace_record_t
+ * \brief External data of the function trace events (QLOG_EXT_EVENT_TYPE_FTRACE)
+ */
+typedef struct qlog_ftrace_record_t {
+    void* function;     /*!< Address of the entered/exited function */
+    void* call_site;    /*!< Return address in the caller */
+} qlog_ftrace_record_t;
+
+int qlog_ftrace_start(size_t size);
+void qlog_ftrace_stop(void);
+int qlog_ftrace_get_buffer_id(void);
+int qlog_ftrace_allow_range(void* start, void* end);
+int qlog_ftrace_deny_range(void* start, void* end);
+int qlog_ftrace_allow_symbol(const char* name);
+int qlog_ftrace_deny_symbol(const char* name);
+void qlog_ftrace_clear_filters(void);
+
+void __cyg_profile_func_enter(void* function, void* call_site) __attribute__ ((no_instrument_function));
+void __cyg_profile_func_exit(void* function, void* call_site) __attribute__ ((no_instrument_function));
+
+#endif
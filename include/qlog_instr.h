@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_instr.h
+ * \brief Self instrumentation: the cost of the logging hot path per thread.
+ *
+ * Build the library with the QLOG_SELF_INSTR cmake option to count, in
+ * every thread, the log calls and the time spent in them, the buffer and
+ * global lock acquisitions with the contention, the spin iterations and
+ * the time spent waiting, and the time spent in gettimeofday, in copying
+ * the strings and in allocating the external data.
+ * Without the option the hooks below compile to nothing (the buffer lock
+ * falls back to pthread_spin_lock) and the module is not built.
+ */
+#ifndef __QLOG_INSTR_H
+#define __QLOG_INSTR_H
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+/* the instrumented operations */
+#define QLOG_INSTR_LOG          0   /*!< Log call: from taking the event (or the event to fold into) to releasing it */
+#define QLOG_INSTR_LOCK         1   /*!< Buffer lock acquisition */
+#define QLOG_INSTR_GLOBAL_LOCK  2   /*!< Global lock acquisition */
+#define QLOG_INSTR_TIME         3   /*!< gettimeofday of the event timestamp */
+#define QLOG_INSTR_COPY         4   /*!< Copy of the function name and the message */
+#define QLOG_INSTR_MALLOC       5   /*!< Allocation of the external data */
+#define QLOG_INSTR_NUM          6
+
+#define QLOG_INSTR_MAX_THREAD_NUM   64  /*!< Rows returned by qlog_instr_get at most */
+
+/**
+ * \struct qlog_instr_counter_t
+ * \brief Counters of an instrumented operation
+ *
+ * For the locks ns is the time spent waiting for a contended lock.
+ */
+typedef struct qlog_instr_counter_t {
+    uint64_t calls;         /*!< Number of the operations */
+    uint64_t ns;            /*!< Time spent in the operations */
+    uint64_t contended;     /*!< Locks: acquisitions that had to wait */
+    uint64_t spins;         /*!< Locks: failed attempts while waiting */
+} qlog_instr_counter_t;
+
+/**
+ * \struct qlog_instr_thread_stats_t
+ * \brief Counters of a thread (see qlog_instr_get)
+ */
+typedef struct qlog_instr_thread_stats_t {
+    qlog_thread_id_t thread_id;     /*!< Registry id of the thread, QLOG_THREAD_ID_NONE if not registered */
+    int exited;                     /*!< The row sums the exited threads */
+    qlog_instr_counter_t counters[QLOG_INSTR_NUM];
+} qlog_instr_thread_stats_t;
+
+#ifdef QLOG_SELF_INSTR
+
+extern __thread qlog_instr_counter_t* qlog_instr_thread_counters;
+extern __thread uint64_t qlog_instr_thread_start[QLOG_INSTR_NUM];
+
+qlog_instr_counter_t* qlog_instr_thread_init(void);
+int qlog_instr_spin_lock(int op, pthread_spinlock_t* lock);
+
+/* monotonic time in ns */
+static inline uint64_t qlog_instr_now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* the counters of an operation in the calling thread */
+static inline qlog_instr_counter_t* qlog_instr_counter(int op){
+    qlog_instr_counter_t* counters = qlog_instr_thread_counters;
+
+    if (counters == NULL){
+        counters = qlog_instr_thread_init();
+    }
+    return counters ? &counters[op] : NULL;
+}
+
+/* counts an operation taking ns */
+static inline void qlog_instr_add(int op, uint64_t ns){
+    qlog_instr_counter_t* counter = qlog_instr_counter(op);
+
+    if (counter){
+        counter->calls++;
+        counter->ns += ns;
+    }
+}
+
+/* runs the statement and counts it as the operation */
+#define QLOG_INSTR_TIMED(op, stmt) do { \
+        uint64_t qlog_instr_start = qlog_instr_now(); \
+        stmt; \
+        qlog_instr_add(op, qlog_instr_now() - qlog_instr_start); \
+    } while (0)
+/* starts timing an operation ended in another function (QLOG_INSTR_END) */
+#define QLOG_INSTR_BEGIN(op) (qlog_instr_thread_start[op] = qlog_instr_now())
+/* counts the operation started by the last QLOG_INSTR_BEGIN of the thread */
+#define QLOG_INSTR_END(op) qlog_instr_add(op, qlog_instr_now() - qlog_instr_thread_start[op])
+/* counts an operation without timing it */
+#define QLOG_INSTR_COUNT(op) qlog_instr_add(op, 0)
+/* waits for a spinlock counting the spins and the waiting time */
+#define QLOG_INSTR_SPIN_LOCK(op, lock) qlog_instr_spin_lock(op, lock)
+
+#else
+
+#define QLOG_INSTR_TIMED(op, stmt) do { stmt; } while (0)
+#define QLOG_INSTR_BEGIN(op) do { } while (0)
+#define QLOG_INSTR_END(op) do { } while (0)
+#define QLOG_INSTR_COUNT(op) do { } while (0)
+#define QLOG_INSTR_SPIN_LOCK(op, lock) pthread_spin_lock(lock)
+
+#endif
+
+const char* qlog_instr_get_name(int op);
+size_t qlog_instr_get(qlog_instr_thread_stats_t* stats, size_t max_num);
+void qlog_instr_reset(void);
+
+#endif
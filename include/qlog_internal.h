@@ -11,37 +11,68 @@
 #define __QLOG_INTERNAL_H
 
 #include "qlog_ext.h"
+#include "qlog_site.h"
+#include "qlog_thread.h"
 #define UNUSED __attribute__ ((unused))
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 #define QLOG_MAX_EVENT_NUM  128
 #define QLOG_MAX_BUF_NUM    5
 #define QLOG_FNAME_BUF_SIZE 32
-#define QLOG_TNAME_BUF_SIZE 32
 #define QLOG_MSG_BUF_SIZE   256
+#define QLOG_STATS_SHARD_NUM 16
+#define QLOG_CACHE_LINE_SIZE 64
+#define QLOG_EXT_INLINE_SIZE 16
+#define QLOG_MAX_SHARD_NUM  64  /* maximum number of the per-CPU shards of a buffer */
+#define QLOG_DEDUP_SLOTS    8   /* buffers tracked per thread for the deduplication (power of 2) */
 
 /**
  * \struct qlog_event_t
  * \brief Structure to hold all log event specific data.
  */
 typedef struct qlog_event_t {
+    const qlog_site_t* site;                 /*!< Call site descriptor of the log (QLOG macros). Optional. */
+    const char* message_ref;                 /*!< Literal message of the call site if not copied into message */
     char function_name[QLOG_FNAME_BUF_SIZE]; /*!< Name of the function the log comes from. Optional. */
-    char thread_name[QLOG_TNAME_BUF_SIZE];   /*!< Thread name from the log comes from. Optional. */
     char message[QLOG_MSG_BUF_SIZE];         /*!< The log message itself */
     unsigned int line_number ;               /*!< The line number of the log message in the code */
     struct timeval timestamp;                /*!< Timestamp of the log message */
     struct qlog_event_t* next;               /*!< The next log event. Events are stored in linked list */
     unsigned char used;                      /*!< Event slot is free/used */
     unsigned char lock;                      /*!< The event structure is locked (getting populated with data */
-    void* ext_data;                          /*!< Extended log data if log is special */
+    void* ext_data;                          /*!< Extended log data if log is special (ext_inline or allocated) */
     size_t ext_data_size;                    /*!< The size of the extended log data */
+    size_t ext_orig_size;                    /*!< The size of the extended log data before truncation */
     qlog_ext_event_type_t ext_event_type;    /*!< The external event type if any */
     qlog_ext_print_cb_t ext_print_cb;        /*!< Function to print/format external data to stream */
+    uint64_t ext_inline[QLOG_EXT_INLINE_SIZE / sizeof(uint64_t)]; /*!< Storage of the small extended data, no allocation needed */
     uint8_t indent_level;                    /*!< Log message ident level */
+    qlog_thread_id_t thread_id;              /*!< Registry id of the thread the log comes from. Optional. */
+    uint32_t suppressed;                     /*!< Calls of the call site suppressed before this event (sampling, rate limit) */
+    uint32_t repeats;                        /*!< Number of repeats folded into the event (dedup mode) */
+    struct timeval last_seen;                /*!< Timestamp of the last repeat */
+    uint16_t fields_size;                    /*!< Size of the encoded fields at the end of message (see qlog_fields.h) */
 } qlog_event_t;
 
 
+/**
+ * \struct qlog_stats_shard_t
+ * \brief Per-thread statistics counters of a log buffer.
+ *
+ * Every thread updates its own shard only (threads are spread over the
+ * shards round robin), the shards are summed up when the statistics are read.
+ */
+typedef struct qlog_stats_shard_t {
+    unsigned long events;           /*!< Number of events stored */
+    unsigned long bytes;            /*!< Number of message and payload bytes stored */
+    unsigned long ext_bytes;        /*!< Number of external payload bytes stored */
+    unsigned long lock_contended;   /*!< Number of times the buffer lock was found busy */
+    unsigned long repeats;          /*!< Number of repeated events folded into the previous one */
+    unsigned long frozen;           /*!< Number of events dropped while the buffer was frozen */
+} __attribute__ ((aligned (QLOG_CACHE_LINE_SIZE))) qlog_stats_shard_t;
+
 /**
  * \struct qlog_buffer_t
  * \brief Structure to hold all log buffer related information
@@ -53,8 +84,32 @@ typedef struct qlog_buffer_t {
     int wrapped;                /*!< Number of buffer wraps*/
     pthread_spinlock_t lock;    /*!< Buffer lock for pointer operations */
     unsigned int event_locked;  /*!< Counter of msg drops because of event is locked */
+    unsigned char dedup;        /*!< Repeated events are folded into the previous one (qlog_set_dedup) */
+    int frozen;                 /*!< No new events are stored (see qlog_trigger.h) */
+    int freeze_left;            /*!< The buffer is frozen after this many events, 0 if not counting */
+    struct qlog_buffer_t** shards; /*!< Per-CPU shards holding the events, NULL if not sharded */
+    unsigned int shard_num;     /*!< Number of the shards */
+    unsigned int mem_flags;     /*!< QLOG_BUFFER_* memory flags of the ring (applied on resize too) */
+    int numa_node;              /*!< NUMA node the ring is bound to (QLOG_BUFFER_NUMA) */
+    struct timeval stats_start; /*!< Start of the statistics period (creation or last reset) */
+    qlog_stats_shard_t stats[QLOG_STATS_SHARD_NUM]; /*!< Per-thread statistics counters */
 } qlog_buffer_t;
 
+/**
+ * \struct qlog_ring_region_t
+ * \brief Header of the memory region holding the events of a ring
+ *
+ * The events of a ring are allocated as one contiguous mapping, the header
+ * is stored in the cache line in front of the first event.
+ */
+typedef struct qlog_ring_region_t {
+    size_t length;              /*!< Length of the mapping in bytes */
+    unsigned int flags;         /*!< QLOG_BUFFER_* memory flags actually applied */
+    int numa_node;              /*!< NUMA node the region is bound to, -1 if not bound */
+} qlog_ring_region_t;
+
+#define QLOG_RING_REGION(head) ((qlog_ring_region_t*) ((char*) (head) - QLOG_CACHE_LINE_SIZE))
+
 typedef enum {
     QLOG_LOCK_UNINITED = 0, 
     QLOG_LOCK_UNLOCKED = 1,
@@ -63,15 +118,44 @@ typedef enum {
 } qlog_lock_state_t;
 
 
-qlog_buffer_t* qlog_init_buffer_internal(size_t size);
+typedef void (*qlog_event_walk_cb_t)(const qlog_event_t* event, void* data);
+
+qlog_buffer_t* qlog_init_buffer_internal(size_t size, unsigned int mem_flags, int numa_node);
+qlog_buffer_t* qlog_init_sharded_buffer_internal(size_t size, unsigned int shard_num,
+        unsigned int mem_flags, int numa_node);
 int qlog_reset_buffer_internal(qlog_buffer_t* log_buffer);
+int qlog_resize_buffer_internal(qlog_buffer_t* buffer, size_t new_size);
 void qlog_cleanup_buffer_internal(qlog_buffer_t* buffer);
 void qlog_reset_event_internal(qlog_event_t* event);
+void qlog_cleanup_event_internal(qlog_event_t* event);
+void qlog_free_ext_data_internal(qlog_event_t* event);
+qlog_event_t* qlog_alloc_ring_internal(size_t size, unsigned int mem_flags, int numa_node);
+void qlog_free_ring_internal(qlog_event_t* head);
+void qlog_walk_buffer_internal(qlog_buffer_t* buffer, qlog_event_walk_cb_t callback, void* data);
 
-int qlog_log_internal(qlog_buffer_t* log_buffer, const char* thread, 
+int qlog_log_internal(qlog_buffer_t* log_buffer, const qlog_site_t* site, qlog_thread_id_t thread_id, 
         const char* function, unsigned int line_num, 
         const char* message, void* ext_data, size_t ext_data_size, 
         qlog_ext_event_type_t event_type);
+int qlog_logv_internal(qlog_buffer_t* log_buffer, const qlog_site_t* site, qlog_thread_id_t thread_id,
+        const char* function, unsigned int line_num,
+        const char* message, const struct iovec* iov, int iovcnt, size_t max_size,
+        qlog_ext_event_type_t event_type);
+int qlog_acquire_event_internal(qlog_buffer_t* log_buffer, const qlog_site_t* site,
+        qlog_thread_id_t thread_id, qlog_event_t** event_out);
+void qlog_release_event_internal(qlog_buffer_t* log_buffer, qlog_event_t* event, size_t bytes, size_t ext_bytes);
+int qlog_reserve_internal(qlog_buffer_t* log_buffer, qlog_site_t* site, qlog_thread_id_t thread_id,
+        size_t max_len, qlog_reservation_t* handle);
+uint32_t qlog_site_take_suppressed(const qlog_site_t* site);
+
+extern int qlog_trigger_rule_num;
+int qlog_trigger_match_internal(const qlog_event_t* event);
+void qlog_trigger_fire_internal(qlog_buffer_t* log_buffer, int rule);
+void qlog_trigger_cleanup_internal(void);
+
+unsigned long qlog_get_wraps_internal(const qlog_buffer_t* buffer);
+void qlog_reset_stats_internal(qlog_buffer_t* buffer);
+int qlog_get_stats_internal(qlog_buffer_t* buffer, qlog_stats_t* stats);
 
 int qlog_lock_buffer_internal(qlog_buffer_t* buffer);
 int qlog_unlock_buffer_internal(qlog_buffer_t* buffer);
@@ -80,6 +164,7 @@ int qlog_unlock_global(void);
 
 void qlog_enable_internal(void);
 void qlog_disable_internal(void);
+void qlog_update_level_mask_internal(void);
 
 int qlog_internal_get_max_buf_num(void);
 int qlog_internal_is_lib_inited(void);
@@ -87,6 +172,10 @@ int qlog_internal_is_logging_enabled(void);
 qlog_buffer_t* qlog_internal_get_default_buf(void);
 qlog_buffer_id_t qlog_internal_get_default_buf_id(void);
 qlog_buffer_t* qlog_internal_get_buffer_by_id(qlog_buffer_id_t buffer_id);
-char* qlog_internal_get_thread_name(void);
+const char* qlog_internal_get_event_function(const qlog_event_t* event);
+unsigned int qlog_internal_get_event_line(const qlog_event_t* event);
+const char* qlog_internal_get_event_thread(const qlog_event_t* event);
+const char* qlog_internal_get_event_message(const qlog_event_t* event);
+const void* qlog_internal_get_event_fields(const qlog_event_t* event, size_t* size);
 
 #endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_latency.h
+ * \brief Function latency histograms measured by QLOG_ENTRY/QLOG_LEAVE.
+ *
+ * QLOG_ENTRY pushes the entry timestamp on a per-thread stack, QLOG_LEAVE
+ * pops it and adds the elapsed time to the histogram of the function (kept
+ * in the ENTRY call site descriptor). The histograms are log-linear (8 sub
+ * buckets per power of 2, max 12.5% error) and sharded per thread so
+ * the threads do not share cache lines while recording.
+ * The measurement is independent of the log level, it can be enabled
+ * while the logging is disabled.
+ */
+#ifndef __QLOG_LATENCY_H
+#define __QLOG_LATENCY_H
+
+#include <stdint.h>
+
+#define QLOG_LATENCY_SUB_BITS       3
+#define QLOG_LATENCY_SUB_NUM        (1 << QLOG_LATENCY_SUB_BITS)
+#define QLOG_LATENCY_BUCKET_NUM     ((64 - QLOG_LATENCY_SUB_BITS + 1) * QLOG_LATENCY_SUB_NUM)
+#define QLOG_LATENCY_SHARD_NUM      8
+#define QLOG_LATENCY_STACK_DEPTH    64
+
+/**
+ * \struct qlog_latency_shard_t
+ * \brief Histogram of a function updated by a subset of the threads
+ */
+typedef struct qlog_latency_shard_t {
+    unsigned long count;                            /*!< Number of measurements */
+    uint64_t sum;                                   /*!< Sum of the durations (ns) */
+    uint64_t max;                                   /*!< Longest duration (ns) */
+    unsigned long buckets[QLOG_LATENCY_BUCKET_NUM]; /*!< Log-linear histogram */
+} __attribute__ ((aligned (64))) qlog_latency_shard_t;
+
+/**
+ * \struct qlog_latency_t
+ * \brief Latency histogram of a function
+ */
+typedef struct qlog_latency_t {
+    qlog_latency_shard_t shards[QLOG_LATENCY_SHARD_NUM];
+} qlog_latency_t;
+
+/**
+ * \struct qlog_latency_summary_t
+ * \brief Summary of a latency histogram, the durations are in nanoseconds
+ */
+typedef struct qlog_latency_summary_t {
+    unsigned long count;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} qlog_latency_summary_t;
+
+extern int qlog_latency_enabled;
+
+void qlog_latency_set_enabled(int enabled);
+void qlog_latency_enter(qlog_site_t* site);
+void qlog_latency_leave(const qlog_site_t* site);
+int qlog_latency_get_summary(const qlog_site_t* site, qlog_latency_summary_t* summary);
+void qlog_latency_reset(void);
+
+#endif
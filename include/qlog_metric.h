@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_metric.h
+ * \brief Counter and gauge metrics aggregated per thread.
+ *
+ * The metrics are registered by name and recorded by id into accumulators
+ * of the calling thread (no locking, no shared cache lines, no event is
+ * written). A flusher thread (or qlog_metric_flush) closes a time bucket
+ * periodically: it sums the accumulators of the threads, keeps the recent
+ * buckets of every metric in memory and logs the metrics updated in the
+ * bucket into a qlog buffer as events with typed fields (see
+ * qlog_fields.h), one field per metric: the increase of the counters and
+ * the last value of the gauges.
+ */
+#ifndef __QLOG_METRIC_H
+#define __QLOG_METRIC_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define QLOG_METRIC_COUNTER     1   /*!< Monotonic counter (qlog_metric_add) */
+#define QLOG_METRIC_GAUGE       2   /*!< Current value (qlog_metric_set) */
+
+#define QLOG_MAX_METRIC_NUM     256 /*!< Capacity of the metric registry */
+#define QLOG_METRIC_HISTORY     60  /*!< Number of the recent buckets kept per metric */
+#define QLOG_METRIC_NAME_SIZE   32
+#define QLOG_METRIC_ID_NONE     0   /*!< Invalid metric id (registry full) */
+
+typedef uint32_t qlog_metric_id_t;
+
+/* the cheap clock is precise enough to find the last gauge value */
+#ifdef CLOCK_MONOTONIC_COARSE
+#define QLOG_METRIC_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define QLOG_METRIC_CLOCK CLOCK_MONOTONIC
+#endif
+
+/* the slots are written by their owner and read by the flusher, relaxed
+ * atomic accesses are plain moves on x86 */
+#define QLOG_METRIC_LOAD(field)         __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define QLOG_METRIC_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+/**
+ * \struct qlog_metric_slot_t
+ * \brief Accumulator of a metric in a thread
+ *
+ * Written by the owner thread only, read by the flusher without locking
+ * (an update in flight is counted in the next bucket). The flusher takes
+ * the gauge value with the newest stamp of the threads as the last value.
+ */
+typedef struct qlog_metric_slot_t {
+    int64_t sum;            /*!< Counter: total added by the thread */
+    int64_t min;            /*!< Gauge: smallest value set in the bucket */
+    int64_t max;            /*!< Gauge: largest value set in the bucket */
+    int64_t last;           /*!< Gauge: last value set by the thread */
+    uint64_t stamp;         /*!< Gauge: time of last in ns (QLOG_METRIC_CLOCK), 0 if never set */
+    uint32_t count;         /*!< Gauge: number of values set in the bucket */
+    uint32_t epoch;         /*!< Bucket of min, max and count */
+} qlog_metric_slot_t;
+
+/**
+ * \struct qlog_metric_info_t
+ * \brief Current state of a metric (see qlog_metric_get)
+ */
+typedef struct qlog_metric_info_t {
+    char name[QLOG_METRIC_NAME_SIZE];       /*!< Name of the metric */
+    int type;                               /*!< QLOG_METRIC_COUNTER or QLOG_METRIC_GAUGE */
+    int64_t value;                          /*!< Counter total or last gauge value */
+    int64_t min;                            /*!< Gauge range in the last bucket */
+    int64_t max;
+    unsigned int history_num;               /*!< Number of the valid buckets in history */
+    int64_t history[QLOG_METRIC_HISTORY];   /*!< Recent buckets, oldest first: counter increase or last gauge value */
+} qlog_metric_info_t;
+
+extern __thread qlog_metric_slot_t* qlog_metric_thread_slots;
+extern uint32_t qlog_metric_epoch;
+
+qlog_metric_slot_t* qlog_metric_thread_init(void);
+
+/* the accumulator of the metric in the calling thread */
+static inline qlog_metric_slot_t* qlog_metric_slot(qlog_metric_id_t id){
+    qlog_metric_slot_t* slots = qlog_metric_thread_slots;
+
+    if (slots == NULL){
+        slots = qlog_metric_thread_init();
+    }
+    return slots && id < QLOG_MAX_METRIC_NUM ? &slots[id] : NULL;
+}
+
+/* adds delta to a counter */
+static inline void qlog_metric_add(qlog_metric_id_t id, int64_t delta){
+    qlog_metric_slot_t* slot = qlog_metric_slot(id);
+
+    if (slot){
+        QLOG_METRIC_STORE(slot->sum, slot->sum + delta);
+    }
+}
+
+static inline void qlog_metric_inc(qlog_metric_id_t id){
+    qlog_metric_add(id, 1);
+}
+
+/* sets the current value of a gauge */
+static inline void qlog_metric_set(qlog_metric_id_t id, int64_t value){
+    qlog_metric_slot_t* slot = qlog_metric_slot(id);
+    uint32_t epoch = QLOG_METRIC_LOAD(qlog_metric_epoch);
+    struct timespec ts;
+
+    if (slot == NULL){
+        return;
+    }
+    if (slot->epoch != epoch || slot->count == 0){
+        QLOG_METRIC_STORE(slot->min, value);
+        QLOG_METRIC_STORE(slot->max, value);
+        QLOG_METRIC_STORE(slot->count, 0);
+        QLOG_METRIC_STORE(slot->epoch, epoch);
+    } else if (value < slot->min){
+        QLOG_METRIC_STORE(slot->min, value);
+    } else if (value > slot->max){
+        QLOG_METRIC_STORE(slot->max, value);
+    }
+    QLOG_METRIC_STORE(slot->count, slot->count + 1);
+    clock_gettime(QLOG_METRIC_CLOCK, &ts);
+    QLOG_METRIC_STORE(slot->last, value);
+    QLOG_METRIC_STORE(slot->stamp, (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec);
+}
+
+qlog_metric_id_t qlog_metric_register(const char* name, int type);
+size_t qlog_metric_count(void);
+int qlog_metric_get(qlog_metric_id_t id, qlog_metric_info_t* info);
+int qlog_metric_flush(qlog_buffer_id_t buffer_id);
+int qlog_metric_start(qlog_buffer_id_t buffer_id, unsigned int interval_ms);
+void qlog_metric_stop(void);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_site.h
+ * \brief Static call site descriptors of the QLOG macros.
+ *
+ * Every QLOG macro defines a static descriptor holding the constant data
+ * of the call site (file, function, line, literal message, level) so the
+ * events only have to store a pointer to it. Pointers to the descriptors
+ * are collected into the qlog_sites linker section which makes all the
+ * call sites of the program enumerable.
+ */
+#ifndef __QLOG_SITE_H
+#define __QLOG_SITE_H
+
+#include <stdint.h>
+
+#define QLOG_LEVEL_ERROR    0
+#define QLOG_LEVEL_WARNING  1
+#define QLOG_LEVEL_INFO     2
+#define QLOG_LEVEL_DEBUG    3
+#define QLOG_LEVEL_TRACE    4
+
+/*
+ * The call sites more verbose than the compile time level are removed
+ * by the compiler. Define it before including qlog_utils.h.
+ */
+#ifndef QLOG_COMPILE_LEVEL
+#define QLOG_COMPILE_LEVEL  QLOG_LEVEL_TRACE
+#endif
+
+extern unsigned int qlog_level_mask;
+
+/* checked by the QLOG macros before any argument is evaluated */
+#define QLOG_LEVEL_ENABLED(level)                                   \
+    ((level) <= QLOG_COMPILE_LEVEL && (qlog_level_mask & (1u << (level))))
+
+#define QLOG_SITE_ENTRY     0x01    /*!< Function entry (QLOG_ENTRY) */
+#define QLOG_SITE_LEAVE     0x02    /*!< Function leave (QLOG_LEAVE, QLOG_RET_*) */
+#define QLOG_SITE_LIMITED   0x04    /*!< Sampled and/or rate limited (see qlog_site_admit) */
+#define QLOG_SITE_TRIGGER   0x08    /*!< Matched by a trigger rule (see qlog_trigger_add) */
+
+/**
+ * \struct qlog_site_t
+ * \brief Descriptor of a log call site
+ */
+typedef struct qlog_site_t {
+    const char* file;       /*!< Source file of the call site */
+    const char* function;   /*!< Function of the call site */
+    const char* message;    /*!< Literal message or format string, NULL if not literal */
+    unsigned int line;      /*!< Source line of the call site */
+    uint8_t level;          /*!< Log level (QLOG_LEVEL_*) */
+    uint8_t flags;          /*!< QLOG_SITE_* flags */
+    uint8_t enabled;        /*!< The call site is enabled, checked by the macro */
+    uint32_t index;         /*!< Position in the call site table + 1, 0 if not in the table */
+    struct qlog_latency_t* latency; /*!< Latency histogram of the function (ENTRY sites) */
+    uint32_t sample_every;  /*!< Only every Nth call is logged (0 and 1: all) */
+    uint32_t rate;          /*!< Token bucket rate limit in events/s (0: no limit) */
+    uint32_t burst;         /*!< Token bucket size in events */
+} qlog_site_t;
+
+/* checked by the QLOG macros: the level and the call site are enabled and
+ * the call passes the sampling/rate limit of the call site (if any) */
+#define QLOG_SITE_ENABLED(level)                                    \
+    (QLOG_LEVEL_ENABLED(level) && qlog_site.enabled &&              \
+     (!(qlog_site.flags & QLOG_SITE_LIMITED) || qlog_site_admit(&qlog_site)))
+
+/* a macro argument is a string literal if its spelling starts with a quote */
+#define QLOG_IS_LITERAL(message) (sizeof(#message) > 1 && (#message)[0] == '"')
+
+/*
+ * Defines the static descriptor of the call site named qlog_site and
+ * registers it in the qlog_sites section.
+ */
+#define QLOG_SITE_DEFINE(site_level, site_flags, site_message)                  \
+    QLOG_SITE_DEFINE_LIMITED(site_level, site_flags, site_message, 0, 0, 0)
+
+/*
+ * Defines a call site with sampling (only every sample_every-th call is
+ * logged) and/or token bucket rate limit (rate events/s, burst events).
+ */
+#define QLOG_SITE_DEFINE_LIMITED(site_level, site_flags, site_message,           \
+                                 site_sample, site_rate, site_burst)             \
+    static qlog_site_t qlog_site = {__FILE__, __func__,                         \
+        QLOG_IS_LITERAL(site_message) ? (const char*) (site_message) : NULL,    \
+        __LINE__, site_level,                                                   \
+        (site_flags) | ((site_sample) > 1 || (site_rate) > 0 ? QLOG_SITE_LIMITED : 0), \
+        1, 0, NULL, site_sample, site_rate, site_burst};                        \
+    static qlog_site_t* const qlog_site_ptr                                     \
+        __attribute__ ((section ("qlog_sites"), used)) = &qlog_site
+
+int qlog_set_level(int level);
+int qlog_get_level(void);
+
+int qlog_log_site(qlog_site_t* site, const char* message);
+int qlog_log_site_id(qlog_buffer_id_t buffer_id, qlog_site_t* site, const char* message);
+int qlog_reserve_site(qlog_site_t* site, size_t max_len, qlog_reservation_t* handle);
+
+size_t qlog_site_count(void);
+qlog_site_t* qlog_site_get(size_t index);
+int qlog_site_match(const qlog_site_t* site, const char* pattern);
+int qlog_site_set_enabled(const char* pattern, int enabled);
+int qlog_site_admit(qlog_site_t* site);
+int qlog_site_set_sampling(const char* pattern, unsigned int sample_every);
+int qlog_site_set_rate_limit(const char* pattern, unsigned int rate, unsigned int burst);
+unsigned long qlog_site_get_hits(const qlog_site_t* site);
+
+/* hit counters of the calling thread, indexed by the call site index */
+extern __thread unsigned long* qlog_site_thread_hits;
+
+unsigned long* qlog_site_hits_init(void);
+
+/* counts a logged event of the call site in the calling thread */
+static inline void qlog_site_hit(const qlog_site_t* site){
+    unsigned long* hits = qlog_site_thread_hits;
+
+    if (hits == NULL){
+        hits = qlog_site_hits_init();
+    }
+    if (hits && site->index > 0){
+        __atomic_store_n(&hits[site->index - 1], hits[site->index - 1] + 1, __ATOMIC_RELAXED);
+    }
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_stack.h
+ * \brief Interned stack traces.
+ *
+ * The stacks captured by QLOG_BT are stored once in a process wide hash
+ * table, the events only hold the id of the stack.
+ */
+#ifndef __QLOG_STACK_H
+#define __QLOG_STACK_H
+
+#include <stdint.h>
+
+#define QLOG_MAX_STACK_NUM          16384   /*!< Capacity of the stack table */
+#define QLOG_STACK_HASH_SIZE        4096    /*!< Number of hash buckets (power of 2) */
+#define QLOG_STACK_MAX_DEPTH        256     /*!< Maximum number of stored frames */
+#define QLOG_STACK_MAX_SKIP         16      /*!< Maximum number of skipped frames */
+#define QLOG_STACK_DEFAULT_DEPTH    64
+#define QLOG_STACK_ID_NONE          0       /*!< The stack has not been stored (table full) */
+
+typedef uint32_t qlog_stack_id_t;
+
+/**
+ * \struct qlog_stack_t
+ * \brief Entry of the stack table
+ */
+typedef struct qlog_stack_t {
+    struct qlog_stack_t* next;  /*!< Next stack in the hash bucket */
+    qlog_stack_id_t id;         /*!< Id of the stack */
+    uint32_t hash;              /*!< Hash of the frames */
+    unsigned int depth;         /*!< Number of frames */
+    void* frames[];             /*!< Return addresses, innermost first */
+} qlog_stack_t;
+
+void qlog_stack_set_capture(unsigned int max_depth, unsigned int skip);
+qlog_stack_id_t qlog_stack_capture(void);
+qlog_stack_id_t qlog_stack_intern(void* const* frames, unsigned int depth);
+const qlog_stack_t* qlog_stack_get(qlog_stack_id_t id);
+size_t qlog_stack_count(void);
+
+#endif
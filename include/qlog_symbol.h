@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_symbol.h
+ * \brief Cached symbolization of code addresses.
+ */
+#ifndef __QLOG_SYMBOL_H
+#define __QLOG_SYMBOL_H
+
+#define QLOG_SYMBOL_HASH_SIZE   1024    /*!< Number of hash buckets (power of 2) */
+#define QLOG_SYMBOL_MAX_NUM     16384   /*!< The cache is flushed above this many entries */
+#define QLOG_SYMBOL_STR_SIZE    512     /*!< Maximum length of a resolved symbol string */
+
+size_t qlog_symbol_resolve(void* address, char* buffer, size_t size);
+void qlog_symbol_refresh(void);
+void qlog_symbol_flush(void);
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_thread.h
+ * \brief Registry of the logging threads.
+ *
+ * The threads register themselves by qlog_thread_init() and get a small id
+ * which is stored in the events instead of the thread name. The entry of
+ * an exited thread is kept (and shown as exited) until the registry is
+ * full, then the ids of the exited threads are reused, oldest first. The
+ * events of a thread whose id has been reused show the new thread name.
+ */
+#ifndef __QLOG_THREAD_H
+#define __QLOG_THREAD_H
+
+#include <stdint.h>
+
+#define QLOG_MAX_THREAD_NUM     1024
+#define QLOG_THREAD_NAME_SIZE   32
+#define QLOG_THREAD_MAX_CPU     256
+#define QLOG_THREAD_HASH_SIZE   2048    /* interned names, power of 2, > 2 * QLOG_MAX_THREAD_NUM */
+#define QLOG_THREAD_ID_NONE     0   /*!< The thread is not registered */
+
+#define QLOG_THREAD_CPU_BITS    (8 * sizeof(unsigned long))
+
+/**
+ * \struct qlog_thread_info_t
+ * \brief Registry entry of a thread
+ *
+ * The entries created for thread names passed to the logging functions
+ * explicitly (e.g. qlog_log_long) have no OS thread id.
+ */
+typedef struct qlog_thread_info_t {
+    char name[QLOG_THREAD_NAME_SIZE];   /*!< The thread name */
+    long tid;                           /*!< OS thread id, 0 for an interned name */
+    unsigned long affinity[QLOG_THREAD_MAX_CPU / QLOG_THREAD_CPU_BITS]; /*!< CPU affinity at registration */
+    uint8_t exited;                     /*!< The thread has exited */
+} qlog_thread_info_t;
+
+/* id of the calling thread, QLOG_THREAD_ID_NONE if not registered */
+extern __thread qlog_thread_id_t qlog_thread_self_id;
+
+qlog_thread_id_t qlog_thread_register(const char* name);
+qlog_thread_id_t qlog_thread_intern(const char* name);
+size_t qlog_thread_count(void);
+const qlog_thread_info_t* qlog_thread_get(qlog_thread_id_t id);
+const char* qlog_thread_get_name(qlog_thread_id_t id);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_thread_block.h
+ * \brief Per-thread data blocks of the hot path counters.
+ *
+ * The counters updated on the logging hot path (call site hits, metric
+ * accumulators, self instrumentation) are kept in a data block per thread
+ * found through a TLS pointer of the module, so they are updated without
+ * locking and without sharing a cache line with the other threads.
+ * The blocks of a registry are linked into a list walked by the readers
+ * under the lock of the registry; the data is read while the owners are
+ * updating it. When a thread exits the fold callback of the registry adds
+ * the data of its block to the totals of the exited threads, then the
+ * block is cleared and reused by the next new thread.
+ */
+#ifndef __QLOG_THREAD_BLOCK_H
+#define __QLOG_THREAD_BLOCK_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* folds the data of the block of an exiting thread into the totals of the
+ * exited threads. Called in the exiting thread under the registry lock,
+ * it has to clear the TLS pointer of the module to the data too. */
+typedef void (*qlog_thread_block_fold_cb_t)(void* data);
+
+/**
+ * \struct qlog_thread_block_t
+ * \brief Header of a per-thread data block
+ */
+typedef struct qlog_thread_block_t {
+    struct qlog_thread_block_t* next;           /*!< Next block of the registry */
+    struct qlog_thread_block_registry_t* registry; /*!< The registry of the block */
+    const qlog_thread_id_t* owner;              /*!< TLS thread id of the owner, NULL if the block is free */
+    uint64_t data[];                            /*!< The data of the block (registry size bytes) */
+} qlog_thread_block_t;
+
+/**
+ * \struct qlog_thread_block_registry_t
+ * \brief Registry of the per-thread blocks of a module
+ */
+typedef struct qlog_thread_block_registry_t {
+    size_t size;                        /*!< Size of the data of a block, set before the first block */
+    qlog_thread_block_fold_cb_t fold;   /*!< Folds the data of an exiting thread */
+    pthread_mutex_t* lock;              /*!< Lock of the block list and the totals of the module */
+    qlog_thread_block_t* blocks;        /*!< The blocks, walked under the lock */
+    pthread_key_t key;                  /*!< Calls the fold callback when the owner exits */
+    int key_created;
+} qlog_thread_block_registry_t;
+
+/* initializer of a registry */
+#define QLOG_THREAD_BLOCK_REGISTRY_INIT(size, fold, lock) {size, fold, lock, NULL, 0, 0}
+
+/* the data of a block */
+#define QLOG_THREAD_BLOCK_DATA(block, type) ((type*) (void*) (block)->data)
+
+void* qlog_thread_block_get(qlog_thread_block_registry_t* registry);
+void qlog_thread_block_clear_all(qlog_thread_block_registry_t* registry);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_trace.h
+ * \brief Export of the log buffers in Chrome Trace Event JSON format.
+ *
+ * The output can be loaded into chrome://tracing or the Perfetto UI.
+ */
+#ifndef __QLOG_TRACE_H
+#define __QLOG_TRACE_H
+
+int qlog_trace_export(FILE* stream, qlog_buffer_id_t buffer_id);
+int qlog_trace_export_file(const char* path, qlog_buffer_id_t buffer_id);
+
+#endif
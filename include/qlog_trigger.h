@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_trigger.h
+ * \brief Triggered freeze and snapshots of the log buffers.
+ *
+ * A trigger preserves the context of an error condition before it is
+ * overwritten: it either freezes the buffer after a number of further
+ * events (the new events are dropped until the buffer is thawed) or copies
+ * the current content of the buffer into a snapshot slot while the logging
+ * continues. The triggers are fired by rules matching the logged events
+ * (call site, external event type, message prefix) or explicitly by
+ * qlog_trigger().
+ */
+#ifndef __QLOG_TRIGGER_H
+#define __QLOG_TRIGGER_H
+
+#include <stdio.h>
+#include <sys/time.h>
+#include "qlog_ext.h"
+
+#define QLOG_TRIGGER_SITE       1   /*!< The event comes from a call site matching the pattern */
+#define QLOG_TRIGGER_EXT_TYPE   2   /*!< The event has the external event type */
+#define QLOG_TRIGGER_PREFIX     3   /*!< The message of the event starts with the pattern */
+
+#define QLOG_TRIGGER_FREEZE     1   /*!< Freeze the buffer after the given number of events */
+#define QLOG_TRIGGER_SNAPSHOT   2   /*!< Copy the buffer into a snapshot slot */
+
+#define QLOG_MAX_TRIGGER_NUM    16
+#define QLOG_MAX_SNAPSHOT_NUM   4
+#define QLOG_SNAPSHOT_SIZE      128 /*!< Number of events (the newest ones) kept in a snapshot */
+#define QLOG_TRIGGER_PATTERN_SIZE 128
+#define QLOG_TRIGGER_REASON_SIZE 64
+
+/**
+ * \struct qlog_trigger_rule_t
+ * \brief A trigger rule (see qlog_trigger_add)
+ */
+typedef struct qlog_trigger_rule_t {
+    int match;                                  /*!< QLOG_TRIGGER_SITE, _EXT_TYPE or _PREFIX */
+    char pattern[QLOG_TRIGGER_PATTERN_SIZE];    /*!< Call site pattern (see qlog_site_match) or message prefix */
+    qlog_ext_event_type_t ext_type;             /*!< External event type (QLOG_TRIGGER_EXT_TYPE) */
+    int action;                                 /*!< QLOG_TRIGGER_FREEZE or QLOG_TRIGGER_SNAPSHOT */
+    unsigned int after;                         /*!< Number of events logged after the trigger before the freeze */
+} qlog_trigger_rule_t;
+
+/**
+ * \struct qlog_snapshot_info_t
+ * \brief Description of a snapshot (see qlog_snapshot_get_info)
+ */
+typedef struct qlog_snapshot_info_t {
+    qlog_buffer_id_t buffer_id;                 /*!< The buffer the snapshot has been taken of */
+    struct timeval timestamp;                   /*!< Time of the trigger */
+    size_t event_num;                           /*!< Number of the events in the snapshot */
+    char reason[QLOG_TRIGGER_REASON_SIZE];      /*!< The rule or the reason given to qlog_trigger() */
+} qlog_snapshot_info_t;
+
+int qlog_trigger_add(const qlog_trigger_rule_t* rule);
+int qlog_trigger_parse(const char* spec, qlog_trigger_rule_t* rule);
+void qlog_trigger_clear(void);
+int qlog_trigger(qlog_buffer_id_t buffer_id, int action, unsigned int after, const char* reason);
+
+int qlog_freeze_buffer(qlog_buffer_id_t buffer_id, unsigned int after);
+int qlog_thaw_buffer(qlog_buffer_id_t buffer_id);
+int qlog_is_frozen(qlog_buffer_id_t buffer_id);
+
+size_t qlog_snapshot_count(void);
+int qlog_snapshot_get_info(size_t index, qlog_snapshot_info_t* info);
+int qlog_snapshot_print(FILE* stream, size_t index);
+unsigned long qlog_snapshot_get_missed(void);
+void qlog_snapshot_clear(void);
+
+#endif
@@ -4,68 +4,154 @@
  */
 
 #include <execinfo.h>
+#include "qlog_site.h"
+#include "qlog_stack.h"
+#include "qlog_latency.h"
+#include "qlog_fields.h"
+
+/*
+ * Every macro defines a static call site descriptor (qlog_site), so the
+ * function name, line number and literal message are not copied into the
+ * events.
+ * The level and the enabled flag of the call site are checked first, if
+ * the call site is not enabled (or the logging is disabled) the arguments
+ * are not evaluated at all.
+ */
+
+/* the message is formatted directly into the reserved event */
+#define QLOG_VA_LIMITED(level, sample, rate, burst, format_str, ...) \
+    do {                                                        \
+        QLOG_SITE_DEFINE_LIMITED(level, 0, format_str,          \
+                                 sample, rate, burst);          \
+        if (QLOG_SITE_ENABLED(level)) {                         \
+            qlog_reservation_t qlog_res;                        \
+            if (qlog_reserve_site(&qlog_site, 0, &qlog_res) == QLOG_RET_OK) { \
+                qlog_commit(&qlog_res,                          \
+                        snprintf(qlog_res.data, qlog_res.size,  \
+                                 format_str, ## __VA_ARGS__));  \
+            }                                                   \
+        }                                                       \
+    } while (0);
+
+#define QLOG_VA_LVL(level, format_str, ...)                     \
+    QLOG_VA_LIMITED(level, 0, 0, 0, format_str, ## __VA_ARGS__)
 
 #define QLOG_VA(format_str, ...)                                \
+    QLOG_VA_LVL(QLOG_LEVEL_INFO, format_str, ## __VA_ARGS__)
+
+#define QLOG_LIMITED(level, sample, rate, burst, message)       \
     do {                                                        \
-        char buffer[256];                                       \
-        memset(buffer, 0, sizeof(buffer));                      \
-        snprintf(buffer, sizeof(buffer) - 1,                    \
-                 format_str, ## __VA_ARGS__);                   \
-        qlog_log_long(NULL, __FUNCTION__, __LINE__, buffer);    \
+        QLOG_SITE_DEFINE_LIMITED(level, 0, message,             \
+                                 sample, rate, burst);          \
+        if (QLOG_SITE_ENABLED(level)) {                         \
+            qlog_log_site(&qlog_site,                           \
+                    QLOG_IS_LITERAL(message) ? NULL : (message)); \
+        }                                                       \
     } while (0);
 
+#define QLOG_LVL(level, message)                                \
+    QLOG_LIMITED(level, 0, 0, 0, message)
+
 #define QLOG(message)                                           \
+    QLOG_LVL(QLOG_LEVEL_INFO, message)
+
+/* only every Nth call is logged, the others are counted as suppressed.
+ * The limits are per thread and can be changed at runtime (see
+ * qlog_site_set_sampling and qlog_site_set_rate_limit) */
+#define QLOG_SAMPLE(every, message)                             \
+    QLOG_LIMITED(QLOG_LEVEL_INFO, every, 0, 0, message)
+
+#define QLOG_SAMPLE_VA(every, format_str, ...)                  \
+    QLOG_VA_LIMITED(QLOG_LEVEL_INFO, every, 0, 0, format_str, ## __VA_ARGS__)
+
+/* at most rate events per second after a burst of burst events */
+#define QLOG_RATELIMIT(rate, burst, message)                    \
+    QLOG_LIMITED(QLOG_LEVEL_INFO, 0, rate, burst, message)
+
+#define QLOG_RATELIMIT_VA(rate, burst, format_str, ...)         \
+    QLOG_VA_LIMITED(QLOG_LEVEL_INFO, 0, rate, burst, format_str, ## __VA_ARGS__)
+
+/* typed key/value fields encoded in binary into the event, e.g.
+ * QLOG_FIELDS("request done", QLOG_F_INT("latency_us", us), QLOG_F_STR("path", path)) */
+#define QLOG_FIELDS_LVL(level, message, ...)                    \
     do {                                                        \
-        qlog_log_long(NULL, __FUNCTION__, __LINE__, message);   \
+        QLOG_SITE_DEFINE(level, 0, message);                    \
+        if (QLOG_SITE_ENABLED(level)) {                         \
+            const qlog_field_t qlog_fields[] = {__VA_ARGS__};   \
+            qlog_log_fields_site(&qlog_site,                    \
+                    QLOG_IS_LITERAL(message) ? NULL : (message), \
+                    qlog_fields, sizeof(qlog_fields) / sizeof(qlog_fields[0])); \
+        }                                                       \
     } while (0);
 
+#define QLOG_FIELDS(message, ...)                               \
+    QLOG_FIELDS_LVL(QLOG_LEVEL_INFO, message, __VA_ARGS__)
 
+/* the indention is maintained even if the logging is disabled at runtime
+ * so it stays balanced. The function latency is measured independently
+ * of the log level (see qlog_latency_set_enabled) */
 #define QLOG_ENTRY                                              \
     do {                                                        \
-        qlog_inc_indent();                                      \
-        qlog_log_long(NULL, __FUNCTION__, __LINE__, "ENTRY");   \
+        QLOG_SITE_DEFINE(QLOG_LEVEL_TRACE, QLOG_SITE_ENTRY, "ENTRY"); \
+        if (QLOG_LEVEL_TRACE <= QLOG_COMPILE_LEVEL) {           \
+            qlog_inc_indent();                                  \
+            if (qlog_latency_enabled) {                         \
+                qlog_latency_enter(&qlog_site);                 \
+            }                                                   \
+        }                                                       \
+        if (QLOG_SITE_ENABLED(QLOG_LEVEL_TRACE)) {              \
+            qlog_log_site(&qlog_site, NULL);                    \
+        }                                                       \
     } while (0);
 
 #define QLOG_LEAVE                                              \
     do {                                                        \
-        qlog_log_long(NULL, __FUNCTION__, __LINE__, "LEAVE");   \
-        qlog_dec_indent();                                      \
+        QLOG_SITE_DEFINE(QLOG_LEVEL_TRACE, QLOG_SITE_LEAVE, "LEAVE"); \
+        if (QLOG_SITE_ENABLED(QLOG_LEVEL_TRACE)) {              \
+            qlog_log_site(&qlog_site, NULL);                    \
+        }                                                       \
+        if (QLOG_LEVEL_TRACE <= QLOG_COMPILE_LEVEL) {           \
+            if (qlog_latency_enabled) {                         \
+                qlog_latency_leave(&qlog_site);                 \
+            }                                                   \
+            qlog_dec_indent();                                  \
+        }                                                       \
     } while (0);
 
 #define QLOG_RET_FN(function, ret_type)                         \
     do {                                                        \
         ret_type temp_ret_value;                                \
         temp_ret_value = function;                              \
-        qlog_log_long(NULL, __FUNCTION__, __LINE__, "LEAVE");   \
-        qlog_dec_indent();                                      \
+        QLOG_LEAVE;                                             \
         return temp_ret_value;                                  \
     } while (0);
 
 #define QLOG_RET_EXP(expression)                                \
     do {                                                        \
-        qlog_log_long(NULL, __FUNCTION__, __LINE__, "LEAVE");   \
-        qlog_dec_indent();                                      \
+        QLOG_LEAVE;                                             \
         return (expression);                                    \
     } while (0);
 
+/* the stack is interned (see qlog_stack_set_capture), the event holds
+ * the stack id only */
 #define QLOG_BT                                                 \
     do {                                                        \
-        void* array[256];                                       \
-        size_t size = 0;                                        \
-        memset(array, 0 ,sizeof(array));                        \
-        size = backtrace(array, sizeof(array));                 \
-        qlog_ext_log_long(QLOG_EXT_EVENT_TYPE_BT,               \
-                          array, size * sizeof(void*),          \
-                          NULL, __FUNCTION__,                   \
-                          __LINE__, "Backtrace");               \
+        QLOG_SITE_DEFINE(QLOG_LEVEL_DEBUG, 0, "Backtrace");     \
+        if (QLOG_SITE_ENABLED(QLOG_LEVEL_DEBUG)) {              \
+            qlog_stack_id_t qlog_stack_id = qlog_stack_capture(); \
+            qlog_ext_log_site(&qlog_site, QLOG_EXT_EVENT_TYPE_STACK, \
+                              &qlog_stack_id, sizeof(qlog_stack_id), NULL); \
+        }                                                       \
     } while (0);
 
 #define QLOG_HEX(data, data_size)                               \
     do {                                                        \
-        qlog_ext_log_long(QLOG_EXT_EVENT_TYPE_HEXDUMP,          \
-                          data, data_size, NULL,                \
-                          __FUNCTION__, __LINE__,               \
-                          "External log message");              \
+        QLOG_SITE_DEFINE(QLOG_LEVEL_DEBUG, 0,                   \
+                         "External log message");               \
+        if (QLOG_SITE_ENABLED(QLOG_LEVEL_DEBUG)) {              \
+            qlog_ext_log_site(&qlog_site, QLOG_EXT_EVENT_TYPE_HEXDUMP, \
+                              data, data_size, NULL);           \
+        }                                                       \
     } while (0);
 
 #define QLOG_INC_IND                                            \
@@ -77,5 +163,3 @@
     do {                                                        \
         qlog_dec_indent();                                      \
     } while (0);
-
-
@@ -7,21 +7,41 @@
  * \file qlog.c
  * \brief qlog library implementation
  */
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/time.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<sys/rseq.h>) && !defined(QLOG_NO_RSEQ)
+#include <sys/rseq.h>
+#define QLOG_HAVE_RSEQ
+#endif
+#endif
 
 #include "qlog.h"
 #include "qlog_internal.h"
 #include "qlog_debug.h"
 #include "qlog_display.h"
 #include "qlog_ext.h"
+#include "qlog_metric.h"
+#include "qlog_instr.h"
 
 int qlog_lib_inited = 0;
 int qlog_enabled = 0;
+static int qlog_level = QLOG_LEVEL_TRACE;
+
+/* bit per log level, checked by the QLOG macros before doing any work.
+ * Zero while the logging is disabled. */
+unsigned int qlog_level_mask = 0;
 
 qlog_buffer_t* qlog_buffers[QLOG_MAX_BUF_NUM];
 qlog_buffer_t* qlog_default_buf = 0;
@@ -30,8 +50,29 @@ int qlog_default_buf_id = -1;
 pthread_spinlock_t qlog_global_lock;
 static qlog_lock_state_t qlog_global_lock_state = QLOG_LOCK_UNINITED;
 
-__thread char qlog_thread_name[16] = {0};
 __thread uint8_t qlog_thread_indent_level = 0;
+__thread int qlog_thread_stats_shard = -1;
+
+/*
+ * Deduplication state of the thread: the last event the thread has written
+ * to the recently used buffers. The event pointers are valid while the ring
+ * epoch is unchanged (it is incremented when a ring is switched or freed).
+ */
+typedef struct qlog_dedup_slot_t {
+    const qlog_buffer_t* buffer;
+    qlog_buffer_t* ring;        /* the buffer or the shard holding the event */
+    qlog_event_t* event;
+    unsigned long epoch;
+} qlog_dedup_slot_t;
+
+static unsigned long qlog_ring_epoch = 1;
+static __thread qlog_dedup_slot_t qlog_thread_dedup[QLOG_DEDUP_SLOTS];
+static __thread char qlog_thread_dedup_message[QLOG_MSG_BUF_SIZE];
+static unsigned int qlog_stats_next_shard = 0;
+
+#define QLOG_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+#define QLOG_MAX_NUMA_NODE  1024    /* size of the node mask passed to mbind */
+#define QLOG_MPOL_BIND      2       /* MPOL_BIND of <numaif.h>, no libnuma needed */
 
 /******************************************************************************
  *
@@ -75,7 +116,7 @@ int qlog_init(size_t size){
     memset(qlog_buffers, 0, sizeof(qlog_buffers));
 
     if (size != 0) {
-        qlog_buffers[0] = qlog_init_buffer_internal(size);
+        qlog_buffers[0] = qlog_init_buffer_internal(size, 0, -1);
         if (qlog_buffers[0]) {
             qlog_default_buf = qlog_buffers[0];
             qlog_default_buf_id = 0;
@@ -93,18 +134,17 @@ int qlog_init(size_t size){
 }
 
 /**
- * \brief Sets the thread name TLS variable
+ * \brief Registers the calling thread
  *
  * \param thread_name The name of the thread
+ * \return The registry id of the thread (see qlog_thread_register)
  *
- * If this variable is set, the events logged by the thread
- * will contain the thread name
+ * If the thread is registered, the events logged by the thread
+ * will contain its id which is resolved to the thread name when displayed.
  */
-void qlog_thread_init(const char* thread_name){
-    if (thread_name){
-        snprintf(qlog_thread_name, sizeof(qlog_thread_name) - 1, "%s", thread_name);
-    }
+qlog_thread_id_t qlog_thread_init(const char* thread_name){
     qlog_thread_indent_level = 0;
+    return qlog_thread_register(thread_name);
 }
 
 /**
@@ -167,6 +207,11 @@ int qlog_reset_buffer_id(qlog_buffer_id_t buffer_id){
 void qlog_cleanup(void){
     int i = 0, lock_res = 0;
     if (qlog_lib_inited){
+        /* the metric flusher logs into the buffers */
+        qlog_metric_stop();
+        /* drop the trigger rules and free the snapshots */
+        qlog_trigger_cleanup_internal();
+
         lock_res = qlog_lock_global(0);
         if (lock_res != QLOG_RET_OK){
             return;
@@ -208,11 +253,55 @@ void qlog_cleanup(void){
  * place the log message into.
  */
 qlog_buffer_id_t qlog_create_buffer(size_t size){
+    qlog_buffer_attr_t attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = size;
+    return qlog_create_buffer_attr(&attr);
+}
+
+/**
+ * \brief Create a new qlog log buffer with attributes
+ *
+ * \param attr The attributes of the buffer
+ * \return the index of the new buffer or -1 in case of any error
+ *
+ * With the QLOG_BUFFER_PER_CPU flag the buffer is split into shards (one
+ * per CPU by default) with attr->size events each. The writers use the
+ * shard of the CPU they are running on, so the threads on different CPUs
+ * do not contend, the memory is bounded by the number of CPUs and not by
+ * the number of threads. The readers merge the shards by timestamp.
+ *
+ * The events are allocated as one contiguous region per ring, prefaulted
+ * at creation. QLOG_BUFFER_HUGEPAGES backs it by huge pages (hugetlbfs,
+ * transparent huge pages as fallback), QLOG_BUFFER_MLOCK locks it into the
+ * memory and QLOG_BUFFER_NUMA binds it to attr->numa_node (-1: the node of
+ * the creating CPU, for per-CPU buffers the node of the shard's CPU). These
+ * are best effort, the buffer is created even if the system refuses them.
+ */
+qlog_buffer_id_t qlog_create_buffer_attr(const qlog_buffer_attr_t* attr){
     int buffer_index = -1;
     int i = 0;
     int lock_res = QLOG_RET_ERR;
+    size_t size = 0;
+    long shard_num = 0;
+    unsigned int mem_flags = 0;
+
+    if (qlog_lib_inited && attr){
+        mem_flags = attr->flags & (QLOG_BUFFER_HUGEPAGES | QLOG_BUFFER_MLOCK | QLOG_BUFFER_NUMA);
+        size = attr->size;
+        if (size == 0 || size > QLOG_MAX_EVENT_NUM) {
+            size = QLOG_MAX_EVENT_NUM;
+        }
+        if (attr->flags & QLOG_BUFFER_PER_CPU){
+            shard_num = attr->shard_num ? (long) attr->shard_num : sysconf(_SC_NPROCESSORS_CONF);
+            if (shard_num < 1){
+                shard_num = 1;
+            } else if (shard_num > QLOG_MAX_SHARD_NUM){
+                shard_num = QLOG_MAX_SHARD_NUM;
+            }
+        }
 
-    if (qlog_lib_inited){
         lock_res = qlog_lock_global(0);
         if (lock_res != QLOG_RET_OK){
             return -1;
@@ -228,10 +317,12 @@ qlog_buffer_id_t qlog_create_buffer(size_t size){
 
         /* there is a free buffer, initialize it */
         if (buffer_index >= 0) {    
-            if (size == 0 || size > QLOG_MAX_EVENT_NUM) {
-                size = QLOG_MAX_EVENT_NUM;
+            if (shard_num > 0){
+                qlog_buffers[buffer_index] = qlog_init_sharded_buffer_internal(size, (unsigned int) shard_num,
+                        mem_flags, attr->numa_node);
+            } else {
+                qlog_buffers[buffer_index] = qlog_init_buffer_internal(size, mem_flags, attr->numa_node);
             }
-            qlog_buffers[buffer_index] = qlog_init_buffer_internal(size);
             if (qlog_default_buf == NULL){
                 qlog_default_buf = qlog_buffers[buffer_index];
                 qlog_default_buf_id = buffer_index;
@@ -246,6 +337,84 @@ qlog_buffer_id_t qlog_create_buffer(size_t size){
     return -1;
 }
 
+/**
+ * \brief Resizes a log buffer without losing its content
+ *
+ * \param buffer_id The id of the log buffer to be resized
+ * \param new_size The new maximum number of log messages in the buffer.
+ *                 For a per-CPU buffer it is the size of a shard.
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of any error
+ *
+ * A new event ring is allocated and the newest events of the buffer are
+ * migrated into it. The logging is not stopped during the resize, the new
+ * ring is switched in under the buffer lock and the old one is released
+ * after the writers have left it.
+ */
+int qlog_resize_buffer(qlog_buffer_id_t buffer_id, size_t new_size){
+    int res = QLOG_RET_ERR;
+    int lock_res = QLOG_RET_ERR;
+
+    if (qlog_lib_inited && buffer_id < QLOG_MAX_BUF_NUM){
+        if (new_size == 0 || new_size > QLOG_MAX_EVENT_NUM) {
+            new_size = QLOG_MAX_EVENT_NUM;
+        }
+
+        /* the global lock keeps away the other resize and cleanup calls */
+        lock_res = qlog_lock_global(0);
+        if (lock_res != QLOG_RET_OK){
+            return lock_res;
+        }
+        if (qlog_buffers[buffer_id]){
+            res = qlog_resize_buffer_internal(qlog_buffers[buffer_id], new_size);
+        }
+        lock_res = qlog_unlock_global();
+    }
+    return (res == QLOG_RET_OK && lock_res == QLOG_RET_OK) ? QLOG_RET_OK : QLOG_RET_ERR;
+}
+
+/**
+ * \brief Enables or disables the deduplication of a log buffer
+ *
+ * \param buffer_id The id of the log buffer
+ * \param enabled 1 to enable, 0 to disable the deduplication
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the buffer does not exist
+ *
+ * In dedup mode a text event repeating the last event the thread has logged
+ * into the buffer (same call site, function, line and message) is not
+ * stored in a new slot, the repeat counter and the last seen timestamp of
+ * that event are updated instead, so an error loop does not flush the
+ * buffer. Only back-to-back repeats are folded, the events of the thread
+ * stay in order.
+ * The messages formatted by qlog_reserve() are copied once more in this
+ * mode since they have to be compared before a slot is taken. The events
+ * with external data are never folded.
+ */
+int qlog_set_dedup(qlog_buffer_id_t buffer_id, int enabled){
+    qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
+
+    if (buffer == NULL){
+        return QLOG_RET_ERR;
+    }
+    buffer->dedup = enabled ? 1 : 0;
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Provides the deduplication mode of a log buffer
+ *
+ * \param buffer_id The id of the log buffer
+ * \return 1 if the deduplication is enabled, 0 if not, QLOG_RET_ERR if the
+ *         buffer does not exist
+ */
+int qlog_get_dedup(qlog_buffer_id_t buffer_id){
+    qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
+
+    if (buffer == NULL){
+        return QLOG_RET_ERR;
+    }
+    return buffer->dedup;
+}
+
 /**
  * \brief Logs a new event to the default log buffer
  *
@@ -257,12 +426,8 @@ qlog_buffer_id_t qlog_create_buffer(size_t size){
  */
 int qlog_log(const char* message){
     int res = QLOG_RET_ERR;
-    char* thread_name = NULL;
     if (qlog_lib_inited && qlog_default_buf && qlog_enabled && message) {
-        if (qlog_thread_name[0] != '0'){
-            thread_name = qlog_thread_name;
-        }
-        res = qlog_log_internal(qlog_default_buf, thread_name, NULL, 0, message, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
+        res = qlog_log_internal(qlog_default_buf, NULL, qlog_thread_self_id, NULL, 0, message, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
     }
     return res;
 }
@@ -283,7 +448,7 @@ int qlog_log_id(qlog_buffer_id_t buffer_id, const char* message){
     int res = QLOG_RET_ERR;
     if (qlog_lib_inited && qlog_enabled && message){
         if (buffer_id < QLOG_MAX_BUF_NUM && qlog_buffers[buffer_id]){
-            res = qlog_log_internal(qlog_buffers[buffer_id], NULL, NULL, 0, message, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
+            res = qlog_log_internal(qlog_buffers[buffer_id], NULL, QLOG_THREAD_ID_NONE, NULL, 0, message, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
         }
     }
     return res;
@@ -309,12 +474,8 @@ int qlog_log_long(const char* thread,
         const char* message)
 {
     int res = QLOG_RET_ERR;
-    char * thread_name = NULL;
     if (qlog_lib_inited && qlog_default_buf && qlog_enabled && message) {
-        if (thread == NULL && qlog_thread_name[0] != '\0'){
-            thread_name = qlog_thread_name;
-        }
-        res = qlog_log_internal(qlog_default_buf, thread_name, function, line_num, message, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
+        res = qlog_log_internal(qlog_default_buf, NULL, thread ? qlog_thread_intern(thread) : qlog_thread_self_id, function, line_num, message, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
     }
     return res;
 }
@@ -346,12 +507,144 @@ int qlog_log_long_id(
     int res = QLOG_RET_ERR;
     if (qlog_lib_inited && qlog_enabled && message){
         if (buffer_id < QLOG_MAX_BUF_NUM && qlog_buffers[buffer_id]){
-            res = qlog_log_internal(qlog_buffers[buffer_id], thread, function, line_num, message, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
+            res = qlog_log_internal(qlog_buffers[buffer_id], NULL, qlog_thread_intern(thread), function, line_num, message, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
         }
     }
     return res;
 }
 
+/**
+ * \brief Logs a new event of a call site to the default log buffer
+ *
+ * \param site The call site descriptor (see QLOG_SITE_DEFINE)
+ * \param message The log message string. If NULL the literal message of the
+ *                call site is used.
+ * \return 0 if success, -1 in case of any error
+ *
+ * The function name and the line number are not copied into the event,
+ * only the call site descriptor is referenced. This is used by the QLOG
+ * macros. The hit counter of the call site is updated.
+ */
+int qlog_log_site(qlog_site_t* site, const char* message){
+    int res = QLOG_RET_ERR;
+    if (qlog_lib_inited && qlog_default_buf && qlog_enabled && site && (message || site->message)) {
+        res = qlog_log_internal(qlog_default_buf, site, qlog_thread_self_id, NULL, 0, message, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
+        if (res == QLOG_RET_OK){
+            qlog_site_hit(site);
+        }
+    }
+    return res;
+}
+
+/**
+ * \brief Logs a new event of a call site to a buffer with a specified id
+ *
+ * \param buffer_id the id of the buffer into the message will be put
+ * \param site The call site descriptor (see QLOG_SITE_DEFINE)
+ * \param message The log message string. If NULL the literal message of the
+ *                call site is used.
+ * \return 0 if success, -1 in case of any error
+ */
+int qlog_log_site_id(qlog_buffer_id_t buffer_id, qlog_site_t* site, const char* message){
+    int res = QLOG_RET_ERR;
+    if (qlog_lib_inited && qlog_enabled && site && (message || site->message)){
+        if (buffer_id < QLOG_MAX_BUF_NUM && qlog_buffers[buffer_id]){
+            res = qlog_log_internal(qlog_buffers[buffer_id], site, qlog_thread_self_id, NULL, 0, message, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
+            if (res == QLOG_RET_OK){
+                qlog_site_hit(site);
+            }
+        }
+    }
+    return res;
+}
+
+/**
+ * \brief Reserves the message field of a new event in a log buffer
+ *
+ * \param buffer_id The id of the buffer into the message will be placed
+ * \param max_len The maximum message length including the terminating zero.
+ *                0 reserves the whole message field.
+ * \param handle The reservation is returned here. handle->data points to
+ *               the writable region of handle->size bytes inside the event.
+ * \return 0 on success, -1 in case of error, -2 if the event is dropped
+ *
+ * The message can be formatted directly into the buffer, there is no
+ * need for a temporary buffer and an extra copy. The event is locked until
+ * it is published by qlog_commit(), which has to be called as soon as
+ * possible on every successful reservation.
+ */
+int qlog_reserve(qlog_buffer_id_t buffer_id, size_t max_len, qlog_reservation_t* handle){
+    int res = QLOG_RET_ERR;
+    if (qlog_lib_inited && qlog_enabled && handle){
+        if (buffer_id < QLOG_MAX_BUF_NUM && qlog_buffers[buffer_id]){
+            res = qlog_reserve_internal(qlog_buffers[buffer_id], NULL, qlog_thread_self_id, max_len, handle);
+        }
+    }
+    return res;
+}
+
+/**
+ * \brief Reserves the message field of a new call site event in the default buffer
+ *
+ * \param site The call site descriptor (see QLOG_SITE_DEFINE)
+ * \param max_len The maximum message length including the terminating zero.
+ *                0 reserves the whole message field.
+ * \param handle The reservation is returned here
+ * \return 0 on success, -1 in case of error, -2 if the event is dropped
+ *
+ * Same as qlog_reserve(), used by the QLOG_VA macros.
+ */
+int qlog_reserve_site(qlog_site_t* site, size_t max_len, qlog_reservation_t* handle){
+    int res = QLOG_RET_ERR;
+    if (qlog_lib_inited && qlog_default_buf && qlog_enabled && site && handle){
+        res = qlog_reserve_internal(qlog_default_buf, site, qlog_thread_self_id, max_len, handle);
+    }
+    return res;
+}
+
+/**
+ * \brief Publishes a reserved event
+ *
+ * \param handle The reservation got from qlog_reserve()
+ * \param len The length of the message written into handle->data. If it
+ *            does not fit (e.g. the snprintf return value of a truncated
+ *            message) the message is cut at the end of the reserved region.
+ * \return 0 on success, -1 in case of error
+ */
+int qlog_commit(qlog_reservation_t* handle, size_t len){
+    qlog_event_t* event = NULL;
+    qlog_site_t* site = NULL;
+    int res = QLOG_RET_OK;
+
+    if (handle == NULL || handle->data == NULL){
+        return QLOG_RET_ERR;
+    }
+
+    event = handle->event;
+    site = handle->site;
+    if (len >= handle->size){
+        len = strnlen(handle->data, handle->size - 1);
+    }
+    handle->data[len] = '\0';
+
+    if (event == NULL){
+        /* dedup mode, the message is in the thread local buffer */
+        res = qlog_log_internal(handle->buffer, site, qlog_thread_self_id, NULL, 0,
+                handle->data, NULL, 0, QLOG_EXT_EVENT_TYPE_NONE);
+    } else {
+        qlog_release_event_internal(handle->buffer, event, len, 0);
+    }
+    handle->event = NULL;
+    handle->data = NULL;
+    if (res != QLOG_RET_OK){
+        return res;
+    }
+    if (site){
+        qlog_site_hit(site);
+    }
+    return QLOG_RET_OK;
+}
+
 void qlog_toggle_status(void){
     if (qlog_enabled == 1){
         qlog_disable_internal();
@@ -364,6 +657,28 @@ int qlog_get_status(void){
     return qlog_enabled;
 }
 
+/**
+ * \brief Sets the log level
+ *
+ * \param level The most verbose level logged (QLOG_LEVEL_*)
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the level is invalid
+ *
+ * The QLOG macros of the call sites with a more verbose level return
+ * without evaluating their arguments.
+ */
+int qlog_set_level(int level){
+    if (level < QLOG_LEVEL_ERROR || level > QLOG_LEVEL_TRACE){
+        return QLOG_RET_ERR;
+    }
+    qlog_level = level;
+    qlog_update_level_mask_internal();
+    return QLOG_RET_OK;
+}
+
+int qlog_get_level(void){
+    return qlog_level;
+}
+
 void qlog_inc_indent(void){
     qlog_thread_indent_level++;
 }
@@ -374,6 +689,25 @@ void qlog_dec_indent(void){
     }
 }
 
+/**
+ * \brief Provides the runtime statistics of a log buffer
+ *
+ * \param buffer_id The id of the log buffer
+ * \param stats The statistics are copied into this structure
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of any error
+ *
+ * The per-thread counters of the buffer are summed up and the average
+ * rates are calculated for the period since the buffer has been created
+ * or last reset.
+ */
+int qlog_get_stats(qlog_buffer_id_t buffer_id, qlog_stats_t* stats){
+    qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
+    if (buffer == NULL || stats == NULL){
+        return QLOG_RET_ERR;
+    }
+    return qlog_get_stats_internal(buffer, stats);
+}
+
 
 /******************************************************************************
  *
@@ -381,10 +715,163 @@ void qlog_dec_indent(void){
  *
  ******************************************************************************/
 
+/* the NUMA node of a CPU (from sysfs), -1 if unknown */
+static int qlog_cpu_node_internal(int cpu){
+    char path[64];
+    DIR* dir = NULL;
+    struct dirent* entry = NULL;
+    int node = -1;
+
+    if (cpu < 0){
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(path);
+    if (dir == NULL){
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL){
+        if (strncmp(entry->d_name, "node", 4) == 0 &&
+                entry->d_name[4] >= '0' && entry->d_name[4] <= '9'){
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+/* binds a memory region to a NUMA node. Must be called before the pages
+ * are touched. */
+static int qlog_bind_region_internal(void* addr, size_t length, int node){
+#ifdef SYS_mbind
+    unsigned long mask[QLOG_MAX_NUMA_NODE / (8 * sizeof(unsigned long))];
+    const size_t bits = 8 * sizeof(unsigned long);
+
+    if (node < 0 || node >= QLOG_MAX_NUMA_NODE){
+        return QLOG_RET_ERR;
+    }
+    memset(mask, 0, sizeof(mask));
+    mask[node / bits] = 1UL << (node % bits);
+    if (syscall(SYS_mbind, addr, length, QLOG_MPOL_BIND, mask,
+                (unsigned long) (sizeof(mask) * 8 + 1), 0UL) == 0){
+        return QLOG_RET_OK;
+    }
+#else
+    (void) addr;
+    (void) length;
+    (void) node;
+#endif
+    return QLOG_RET_ERR;
+}
+
+/**
+ * \brief Allocates a ring of log events
+ *
+ * \param size The number of events in the ring
+ * \param mem_flags QLOG_BUFFER_HUGEPAGES, QLOG_BUFFER_MLOCK and/or QLOG_BUFFER_NUMA
+ * \param numa_node The NUMA node of the events (QLOG_BUFFER_NUMA)
+ * \return Pointer to the first event of the ring or NULL in case of error.
+ *
+ * The events are allocated as one contiguous anonymous mapping and linked
+ * into a circular list in memory order, the last event points back to the
+ * first one. The mapping is bound to the NUMA node first and every page is
+ * touched at once, so the writers do not take page faults during the first
+ * wrap. The flags are best effort, the ones actually applied are recorded
+ * in the region header (see qlog_ring_region_t).
+ */
+qlog_event_t* qlog_alloc_ring_internal(size_t size, unsigned int mem_flags, int numa_node){
+    qlog_ring_region_t* region = NULL;
+    qlog_event_t* head = NULL;
+    void* addr = MAP_FAILED;
+    size_t length = 0, page_size = 0, offset = 0, i = 0;
+    unsigned int applied = 0;
+
+    if (size == 0){
+        return NULL;
+    }
+    page_size = (size_t) sysconf(_SC_PAGESIZE);
+    length = QLOG_CACHE_LINE_SIZE + size * sizeof(qlog_event_t);
+
+#ifdef MAP_HUGETLB
+    if (mem_flags & QLOG_BUFFER_HUGEPAGES){
+        /* fails if no huge pages are reserved (vm.nr_hugepages) */
+        addr = mmap(NULL, (length + QLOG_HUGE_PAGE_SIZE - 1) & ~(QLOG_HUGE_PAGE_SIZE - 1),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (addr != MAP_FAILED){
+            length = (length + QLOG_HUGE_PAGE_SIZE - 1) & ~(QLOG_HUGE_PAGE_SIZE - 1);
+            applied |= QLOG_BUFFER_HUGEPAGES;
+        }
+    }
+#endif
+    if (addr == MAP_FAILED){
+        length = (length + page_size - 1) & ~(page_size - 1);
+        addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED){
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if ((mem_flags & QLOG_BUFFER_HUGEPAGES) && length >= QLOG_HUGE_PAGE_SIZE &&
+                madvise(addr, length, MADV_HUGEPAGE) == 0){
+            applied |= QLOG_BUFFER_HUGEPAGES;
+        }
+#endif
+    }
+
+    if ((mem_flags & QLOG_BUFFER_NUMA) && qlog_bind_region_internal(addr, length, numa_node) == QLOG_RET_OK){
+        applied |= QLOG_BUFFER_NUMA;
+    }
+
+    /* prefault, the pages are allocated on the bound node */
+    for (offset = 0; offset < length; offset += page_size){
+        ((volatile char*) addr)[offset] = 0;
+    }
+    if ((mem_flags & QLOG_BUFFER_MLOCK) && mlock(addr, length) == 0){
+        applied |= QLOG_BUFFER_MLOCK;
+    }
+
+    region = (qlog_ring_region_t*) addr;
+    region->length = length;
+    region->flags = applied;
+    region->numa_node = (applied & QLOG_BUFFER_NUMA) ? numa_node : -1;
+
+    /* the mapping is zero filled, only the links have to be set */
+    head = (qlog_event_t*) ((char*) addr + QLOG_CACHE_LINE_SIZE);
+    for (i = 0; i < size; i++){
+        head[i].next = &head[(i + 1) % size];
+    }
+    return head;
+}
+
+/**
+ * \brief Releases a ring of log events
+ *
+ * \param head The first event of the ring
+ *
+ * Frees the external data of all the events and unmaps the region of
+ * the ring.
+ */
+void qlog_free_ring_internal(qlog_event_t* head){
+    qlog_ring_region_t* region = NULL;
+    qlog_event_t* event = head;
+
+    if (head == NULL){
+        return;
+    }
+    do {
+        qlog_cleanup_event_internal(event);
+        event = event->next;
+    } while (event != head);
+    region = QLOG_RING_REGION(head);
+    munmap(region, region->length);
+}
+
 /**
  * \brief Internal buffer initialization function
  *
  * \param size The maximum number of log messages in the log buffer.
+ * \param mem_flags Memory flags of the ring (see qlog_alloc_ring_internal)
+ * \param numa_node NUMA node of the ring, -1 for the node of the current CPU
  * \return Pointer to the allocated log buffer or NULL in case of error.
  *
  * By design the library is capable of creating and using multiple log buffers.
@@ -394,37 +881,30 @@ void qlog_dec_indent(void){
  * Because of this all public library function is a wrapper in which 
  * the internal function is called with the default log buffer.
  */
-qlog_buffer_t* qlog_init_buffer_internal(size_t size){
+qlog_buffer_t* qlog_init_buffer_internal(size_t size, unsigned int mem_flags, int numa_node){
     qlog_buffer_t* buffer = 0;
-    qlog_event_t* event = NULL, *prev_event = NULL;
-    unsigned int i = 0;
     int res = 0;
 
-    /* Allocate the log buffer */
-    buffer = (qlog_buffer_t*) malloc(sizeof(qlog_buffer_t));
-    if (buffer == NULL){
+    /* Allocate the log buffer. The statistics shards are cache line aligned. */
+    if (posix_memalign((void**) &buffer, QLOG_CACHE_LINE_SIZE, sizeof(qlog_buffer_t))){
         return NULL;
     }
     memset(buffer, 0, sizeof(qlog_buffer_t));
+    gettimeofday(&buffer->stats_start, NULL);
 
     /* Allocate all log event structures */
-    for (i = 0; i < size; i++){
-        event = (qlog_event_t*) malloc(sizeof(qlog_event_t));
-        if (event == NULL) {
-            qlog_cleanup_buffer_internal(buffer);
-            return NULL;
-        }
-        memset(event, 0, sizeof(qlog_event_t));
-        if (buffer->head == NULL) {
-            buffer->head = event;
-        } else {
-            prev_event->next = event;
-        }
-        prev_event = event;
+    if ((mem_flags & QLOG_BUFFER_NUMA) && numa_node < 0){
+        numa_node = qlog_cpu_node_internal(sched_getcpu());
+    }
+    buffer->mem_flags = mem_flags;
+    buffer->numa_node = numa_node;
+    buffer->head = qlog_alloc_ring_internal(size, mem_flags, numa_node);
+    if (buffer->head == NULL){
+        free(buffer);
+        return NULL;
     }
 
     /* Set the defaults, initialize lock */
-    event->next = buffer->head;
     buffer->next_write = buffer->head;
     buffer->buffer_size = size;
     res = pthread_spin_init(&buffer->lock, PTHREAD_PROCESS_PRIVATE);
@@ -438,88 +918,365 @@ qlog_buffer_t* qlog_init_buffer_internal(size_t size){
 
 
 /**
- * \brief Internal library reset function
+ * \brief Internal sharded buffer initialization function
  *
- * \param log_buffer The log buffer to be reset
- * \return 0 on success, -1 in case of any error
+ * \param size The number of events of a shard
+ * \param shard_num The number of the shards
+ * \param mem_flags Memory flags of the rings (see qlog_alloc_ring_internal)
+ * \param numa_node NUMA node of the rings, -1 for the node of the CPU of each shard
+ * \return Pointer to the allocated log buffer or NULL in case of error.
  *
- * Resets the log buffer provided as a parameter.
+ * The shards are complete buffers (ring, lock, statistics), the buffer
+ * itself has no events. Its statistics and drop counters are updated by
+ * the writers, the lock and wrap counters are collected from the shards.
  */
-int qlog_reset_buffer_internal(qlog_buffer_t* log_buffer) {
-    int res = QLOG_RET_ERR, start = 1;
-    qlog_event_t *event = NULL;
+qlog_buffer_t* qlog_init_sharded_buffer_internal(size_t size, unsigned int shard_num,
+        unsigned int mem_flags, int numa_node){
+    qlog_buffer_t* buffer = NULL;
+    unsigned int i = 0;
 
-    if (log_buffer){
-        res = qlog_lock_buffer_internal(log_buffer);
-        if (res){
-            return res;
-        }
+    if (posix_memalign((void**) &buffer, QLOG_CACHE_LINE_SIZE, sizeof(qlog_buffer_t))){
+        return NULL;
+    }
+    memset(buffer, 0, sizeof(qlog_buffer_t));
+    gettimeofday(&buffer->stats_start, NULL);
+    if (pthread_spin_init(&buffer->lock, PTHREAD_PROCESS_PRIVATE)){
+        free(buffer);
+        return NULL;
+    }
 
-        event = log_buffer->head;
-        while (event){
-            if (event == log_buffer->head){
-                if (start == 1){    /* check if we have reached back to the head again or just starting to delete*/
-                    start = 0;
-                    qlog_reset_event_internal(event);
-                    event = event->next;
-                } else {
-                    event = NULL;
-                }
-            } else {
-                qlog_reset_event_internal(event);
-                event = event->next;
-            }
+    buffer->shards = calloc(shard_num, sizeof(qlog_buffer_t*));
+    if (buffer->shards == NULL){
+        free(buffer);
+        return NULL;
+    }
+    buffer->shard_num = shard_num;
+    for (i = 0; i < shard_num; i++){
+        /* shard i serves CPU i (and i + shard_num, ...) */
+        buffer->shards[i] = qlog_init_buffer_internal(size, mem_flags,
+                (numa_node < 0 && (mem_flags & QLOG_BUFFER_NUMA)) ? qlog_cpu_node_internal((int) i) : numa_node);
+        if (buffer->shards[i] == NULL){
+            qlog_cleanup_buffer_internal(buffer);
+            return NULL;
         }
-        log_buffer->wrapped = 0;
-        log_buffer->event_locked = 0;
-        log_buffer->next_write = log_buffer->head;
-        res = qlog_unlock_buffer_internal(log_buffer);
     }
-    return res;
+    buffer->buffer_size = size * shard_num;
+    return buffer;
 }
 
-/**
- * \brief Internal event reset function
- *
- * \param event The event to be cleared/reset
- *
- * Deletes all the fields in the event structure provided as a parameter
- */
-void qlog_reset_event_internal(qlog_event_t* event){
-    if (event){
+/* the oldest event of a ring (the next write position if it has wrapped) */
+static qlog_event_t* qlog_ring_oldest_internal(const qlog_buffer_t* buffer){
+    return buffer->next_write->used ? buffer->next_write : buffer->head;
+}
+
+/* merges the shards by the event timestamps. Every shard is in write order,
+ * the oldest current event of the shards is visited next. No memory is
+ * allocated (used by the crash handler too). */
+static void qlog_walk_shards_internal(qlog_buffer_t* buffer, qlog_event_walk_cb_t callback, void* data){
+    qlog_event_t* cursor[QLOG_MAX_SHARD_NUM];
+    size_t left[QLOG_MAX_SHARD_NUM];
+    qlog_event_t* event = NULL;
+    unsigned int i = 0, oldest = 0;
+    int found = 0;
+
+    if (callback == NULL){
+        return;
+    }
+    for (i = 0; i < buffer->shard_num; i++){
+        cursor[i] = qlog_ring_oldest_internal(buffer->shards[i]);
+        left[i] = buffer->shards[i]->buffer_size;
+    }
+    while (1){
+        found = 0;
+        for (i = 0; i < buffer->shard_num; i++){
+            /* skip the empty slots and the events being written */
+            while (left[i] > 0 && (!cursor[i]->used || cursor[i]->lock)){
+                cursor[i] = cursor[i]->next;
+                left[i]--;
+            }
+            if (left[i] == 0){
+                continue;
+            }
+            if (!found || timercmp(&cursor[i]->timestamp, &cursor[oldest]->timestamp, <)){
+                oldest = i;
+                found = 1;
+            }
+        }
+        if (!found){
+            break;
+        }
+        event = cursor[oldest];
+        cursor[oldest] = event->next;
+        left[oldest]--;
+        callback(event, data);
+    }
+}
+
+/**
+ * \brief Internal function for walking the events of a buffer
+ *
+ * \param buffer The log buffer
+ * \param callback The function called for each event
+ * \param data User data passed to the callback
+ *
+ * The events are visited from the oldest to the newest one, the empty
+ * slots are skipped. The caller has to hold the buffer lock. The events
+ * locked by writers are skipped too: they were taken before the buffer lock
+ * and their content (and external data) is changing.
+ * The shards of a per-CPU buffer are merged by the event timestamps.
+ */
+void qlog_walk_buffer_internal(qlog_buffer_t* buffer, qlog_event_walk_cb_t callback, void* data){
+    qlog_event_t* event = NULL;
+    size_t i = 0;
+
+    if (buffer && buffer->shards){
+        qlog_walk_shards_internal(buffer, callback, data);
+        return;
+    }
+    if (buffer == NULL || buffer->head == NULL || callback == NULL){
+        return;
+    }
+
+    /* if the next write position holds an event the buffer has
+     * wrapped and that is the oldest event */
+    event = qlog_ring_oldest_internal(buffer);
+    for (i = 0; i < buffer->buffer_size; i++){
+        if (event->used && !event->lock){
+            callback(event, data);
+        }
+        event = event->next;
+    }
+}
+
+/**
+ * \brief Moves the content of an event into another one
+ *
+ * \param dest The destination event
+ * \param src The source event
+ *
+ * The ring position of the destination is kept, the external data is
+ * handed over to the destination.
+ */
+static void qlog_move_event_internal(qlog_event_t* dest, qlog_event_t* src){
+    qlog_event_t* next = dest->next;
+    memcpy(dest, src, sizeof(qlog_event_t));
+    dest->next = next;
+    if (src->ext_data == (void*) src->ext_inline){
+        dest->ext_data = dest->ext_inline;
+    }
+    src->ext_data = NULL;
+    src->ext_data_size = 0;
+    src->ext_orig_size = 0;
+}
+
+/**
+ * \brief Internal buffer resize function
+ *
+ * \param buffer The log buffer to be resized
+ * \param new_size The new number of events in the buffer
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of any error
+ *
+ * The new ring is switched in under the buffer lock with the slots of the
+ * migrated events reserved (locked) at its beginning, so the writers can
+ * continue logging right after the switch. The newest events are copied
+ * into the reserved slots after that. Every writer locks its event before
+ * releasing the buffer lock, so by grabbing all the event locks of the old
+ * ring we wait for the in-flight writers and the old ring can be released.
+ */
+int qlog_resize_buffer_internal(qlog_buffer_t* buffer, size_t new_size){
+    qlog_event_t *new_head = NULL, *old_head = NULL, *start = NULL;
+    qlog_event_t *event = NULL, *slot = NULL;
+    size_t old_size = 0, taken = 0, migrate = 0, i = 0;
+
+    /* the shards are resized one by one, new_size is the size of a shard */
+    if (buffer->shards){
+        for (i = 0; i < buffer->shard_num; i++){
+            if (qlog_resize_buffer_internal(buffer->shards[i], new_size) != QLOG_RET_OK){
+                return QLOG_RET_ERR;
+            }
+        }
+        buffer->buffer_size = new_size * buffer->shard_num;
+        return QLOG_RET_OK;
+    }
+
+    new_head = qlog_alloc_ring_internal(new_size, buffer->mem_flags, buffer->numa_node);
+    if (new_head == NULL){
+        return QLOG_RET_ERR;
+    }
+
+    if (qlog_lock_buffer_internal(buffer)){
+        qlog_free_ring_internal(new_head);
+        return QLOG_RET_ERR;
+    }
+
+    /* find the oldest event and the number of slots handed out to writers */
+    old_head = buffer->head;
+    old_size = buffer->buffer_size;
+    if (buffer->next_write->used || buffer->next_write->lock){
+        start = buffer->next_write;
+        taken = old_size;
+    } else {
+        start = old_head;
+        for (event = old_head; event != buffer->next_write; event = event->next){
+            taken++;
+        }
+    }
+    migrate = taken < new_size ? taken : new_size;
+
+    /* reserve the slots of the migrated events and switch to the new ring */
+    slot = new_head;
+    for (i = 0; i < migrate; i++){
+        slot->lock = 1;
+        slot = slot->next;
+    }
+    buffer->head = new_head;
+    buffer->next_write = slot;
+    buffer->buffer_size = new_size;
+    __sync_fetch_and_add(&qlog_ring_epoch, 1);
+    qlog_unlock_buffer_internal(buffer);
+
+    /* wait for the in-flight writers and migrate the newest events */
+    slot = new_head;
+    event = start;
+    for (i = 0; i < old_size; i++){
+        while (__sync_lock_test_and_set(&event->lock, 1)){
+            /* the writer is still filling the event */
+        }
+        if (i >= taken - migrate && i < taken){
+            if (event->used){
+                qlog_move_event_internal(slot, event);
+            }
+            __sync_and_and_fetch(&slot->lock, 0);
+            slot = slot->next;
+        }
+        event = event->next;
+    }
+
+    qlog_free_ring_internal(old_head);
+    return QLOG_RET_OK;
+}
+
+/* resets an event unless a writer is filling it, the writer owns its
+ * external data until it releases the event */
+static void qlog_reset_idle_event_internal(qlog_event_t* event){
+    if (__sync_lock_test_and_set(&event->lock, 1) == 0){
+        qlog_reset_event_internal(event);   /* releases the lock */
+    }
+}
+
+/**
+ * \brief Internal library reset function
+ *
+ * \param log_buffer The log buffer to be reset
+ * \return 0 on success, -1 in case of any error
+ *
+ * Resets the log buffer provided as a parameter. The events being filled
+ * by writers are left to them.
+ */
+int qlog_reset_buffer_internal(qlog_buffer_t* log_buffer) {
+    int res = QLOG_RET_ERR, start = 1;
+    qlog_event_t *event = NULL;
+    unsigned int i = 0;
+
+    if (log_buffer && log_buffer->shards){
+        for (i = 0; i < log_buffer->shard_num; i++){
+            res = qlog_reset_buffer_internal(log_buffer->shards[i]);
+            if (res){
+                return res;
+            }
+        }
+        log_buffer->event_locked = 0;
+        qlog_reset_stats_internal(log_buffer);
+        return QLOG_RET_OK;
+    }
+
+    if (log_buffer){
+        res = qlog_lock_buffer_internal(log_buffer);
+        if (res){
+            return res;
+        }
+
+        event = log_buffer->head;
+        while (event){
+            if (event == log_buffer->head){
+                if (start == 1){    /* check if we have reached back to the head again or just starting to delete*/
+                    start = 0;
+                    qlog_reset_idle_event_internal(event);
+                    event = event->next;
+                } else {
+                    event = NULL;
+                }
+            } else {
+                qlog_reset_idle_event_internal(event);
+                event = event->next;
+            }
+        }
+        log_buffer->wrapped = 0;
+        log_buffer->event_locked = 0;
+        log_buffer->next_write = log_buffer->head;
+        qlog_reset_stats_internal(log_buffer);
+        res = qlog_unlock_buffer_internal(log_buffer);
+    }
+    return res;
+}
+
+/**
+ * \brief Internal event reset function
+ *
+ * \param event The event to be cleared/reset
+ *
+ * Deletes all the fields in the event structure provided as a parameter
+ */
+void qlog_reset_event_internal(qlog_event_t* event){
+    if (event){
         memset(event->function_name, 0, QLOG_FNAME_BUF_SIZE);
-        memset(event->thread_name, 0, QLOG_TNAME_BUF_SIZE);
+        event->thread_id = QLOG_THREAD_ID_NONE;
         memset(event->message, 0, QLOG_MSG_BUF_SIZE);
+        event->site = NULL;
+        event->message_ref = NULL;
         event->line_number = 0;
         event->indent_level = 0;
+        event->suppressed = 0;
+        event->repeats = 0;
+        event->fields_size = 0;
         memset(&event->timestamp, 0, sizeof(struct timeval));
         event->lock = 0;
         event->used = 0;
-        if (event->ext_data){
-            free(event->ext_data);
-            event->ext_data = NULL;
-        }
-        event->ext_data_size = 0;
-        event->ext_event_type = QLOG_EXT_EVENT_TYPE_NONE;
+        qlog_free_ext_data_internal(event);
         event->ext_print_cb = NULL;
     }
 }
 
+/**
+ * \brief Releases the extended data of an event
+ *
+ * \param event The event
+ *
+ * The small extended data is stored in the event itself, only the
+ * allocated data is freed.
+ */
+void qlog_free_ext_data_internal(qlog_event_t* event){
+    if (event->ext_data != NULL && event->ext_data != (void*) event->ext_inline){
+        free(event->ext_data);
+    }
+    event->ext_data = NULL;
+    event->ext_data_size = 0;
+    event->ext_orig_size = 0;
+    event->ext_event_type = QLOG_EXT_EVENT_TYPE_NONE;
+}
+
 /**
  * \brief Internal event cleanup function
  *
  * \param event The event to be cleaned up
  *
  * Generic event cleanup routine. 
- * Free the extended data if allocated for the event.
+ * Free the extended data if allocated for the event. The event itself
+ * belongs to the region of its ring (see qlog_free_ring_internal).
  */
 void qlog_cleanup_event_internal(qlog_event_t* event){
     if (event){
-        if (event->ext_data){
-            free(event->ext_data);
-            event->ext_data = NULL;
-        }
-        free(event);
+        qlog_free_ext_data_internal(event);
     }
 }
 
@@ -533,84 +1290,217 @@ void qlog_cleanup_event_internal(qlog_event_t* event){
  */
 /* TODO: free spinlock of the buffer */
 void qlog_cleanup_buffer_internal(qlog_buffer_t* buffer){
-    qlog_event_t *event, *tmp = 0;
     int res = 0;
-    int start = 1;
+    unsigned int i = 0;
+
+    if (buffer && buffer->shards){
+        for (i = 0; i < buffer->shard_num; i++){
+            qlog_cleanup_buffer_internal(buffer->shards[i]);
+        }
+        free(buffer->shards);
+        free(buffer);
+        return;
+    }
     if (buffer){
         res = qlog_lock_buffer_internal(buffer); /* lock the buffer so no other thread will try to log a new event */
         if (res == -1) {
             return;
         }
-        event = buffer->head;
-        while (event){
-            tmp = event;
-            if (event == buffer->head){
-                if (start == 1){    /* check if we have reached back to the head again or just starting to delete*/
-                    start = 0;
-                    event = event->next;
-                    qlog_cleanup_event_internal(tmp);
-                } else {
-                    event = NULL;
-                }
-            } else {
-                event = event->next;
-                qlog_cleanup_event_internal(tmp);
-            }
-        }
+        __sync_fetch_and_add(&qlog_ring_epoch, 1);
+        qlog_free_ring_internal(buffer->head);
         free(buffer);
     }
 }
 
 /**
- * \brief Internal function for saving a new log message in the buffer
+ * \brief Copies a string into a fixed size event field
  *
- * \param log_buffer The buffer into the new message will be placed
- * \param thread The thread name from where the message is logged (optional)
- * \param function The name of the function from where the message is logged (optional)
- * \param line_num The source code line number of the log message (optional)
- * \param message The log message string
- * \return 0 on success, -1 in case of error
+ * \param dest The destination field
+ * \param src The source string
+ * \param size The size of the destination field
+ * \return The number of characters copied
  *
- * This function is the workhorse of the log message handling.
- * Gets the next free log buffer position and copies the message into the buffer
- * The buffer is locked only for the pointer handling. As soon as the log message
- * structure for the new message is secured, a temporary pointer is provided, and the 
- * buffer lock is released.
+ * Unlike strncpy only the characters of the string and the terminating
+ * zero are written, the rest of the field is not padded.
  */
-int qlog_log_internal(
-        qlog_buffer_t* log_buffer, 
-        const char* thread, 
-        const char* function, 
-        unsigned int line_num, 
-        const char* message,
-        void* ext_data,
-        size_t ext_data_size,
-        qlog_ext_event_type_t ext_event_type)
+static size_t qlog_copy_str_internal(char* dest, const char* src, size_t size){
+    size_t len = strnlen(src, size - 1);
+    memcpy(dest, src, len);
+    dest[len] = '\0';
+    return len;
+}
+
+/**
+ * \brief Provides the statistics shard of the calling thread
+ *
+ * \param buffer The log buffer
+ * \return Pointer to the statistics shard of the thread in the buffer
+ *
+ * The threads get their shard index round robin when they first log.
+ */
+static qlog_stats_shard_t* qlog_stats_get_shard_internal(qlog_buffer_t* buffer){
+    if (qlog_thread_stats_shard < 0){
+        qlog_thread_stats_shard = __sync_fetch_and_add(&qlog_stats_next_shard, 1) % QLOG_STATS_SHARD_NUM;
+    }
+    return &buffer->stats[qlog_thread_stats_shard];
+}
+
+/**
+ * \brief Resets the statistics of a log buffer
+ *
+ * \param buffer The log buffer
+ *
+ * Clears the per-thread counters and starts a new statistics period.
+ */
+void qlog_reset_stats_internal(qlog_buffer_t* buffer){
+    if (buffer){
+        memset(buffer->stats, 0, sizeof(buffer->stats));
+        gettimeofday(&buffer->stats_start, NULL);
+    }
+}
+
+/* the lock contention counted in the statistics of a shard */
+static unsigned long qlog_get_stats_contention_internal(const qlog_buffer_t* shard){
+    unsigned long contended = 0;
+    int i = 0;
+
+    for (i = 0; i < QLOG_STATS_SHARD_NUM; i++){
+        contended += shard->stats[i].lock_contended;
+    }
+    return contended;
+}
+
+/* the number of wraps of a buffer, summed up over the shards */
+unsigned long qlog_get_wraps_internal(const qlog_buffer_t* buffer){
+    unsigned long wraps = buffer->wrapped;
+    unsigned int i = 0;
+
+    for (i = 0; buffer->shards && i < buffer->shard_num; i++){
+        wraps += buffer->shards[i]->wrapped;
+    }
+    return wraps;
+}
+
+/**
+ * \brief Sums up the statistics of a log buffer
+ *
+ * \param buffer The log buffer
+ * \param stats The result is stored in this structure
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of any error
+ */
+int qlog_get_stats_internal(qlog_buffer_t* buffer, qlog_stats_t* stats){
+    struct timeval now;
+    int i = 0;
+
+    if (buffer == NULL || stats == NULL){
+        return QLOG_RET_ERR;
+    }
+
+    memset(stats, 0, sizeof(qlog_stats_t));
+    for (i = 0; i < QLOG_STATS_SHARD_NUM; i++){
+        stats->events += buffer->stats[i].events;
+        stats->bytes += buffer->stats[i].bytes;
+        stats->ext_bytes += buffer->stats[i].ext_bytes;
+        stats->lock_contended += buffer->stats[i].lock_contended;
+        stats->repeats += buffer->stats[i].repeats;
+        stats->frozen += buffer->stats[i].frozen;
+    }
+    for (i = 0; buffer->shards && i < (int) buffer->shard_num; i++){
+        stats->lock_contended += qlog_get_stats_contention_internal(buffer->shards[i]);
+    }
+    stats->drops = buffer->event_locked;
+    stats->wraps = qlog_get_wraps_internal(buffer);
+
+    gettimeofday(&now, NULL);
+    stats->elapsed = (now.tv_sec - buffer->stats_start.tv_sec) +
+        (now.tv_usec - buffer->stats_start.tv_usec) / 1000000.0;
+    if (stats->elapsed > 0){
+        stats->events_per_sec = stats->events / stats->elapsed;
+        stats->bytes_per_sec = stats->bytes / stats->elapsed;
+    }
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Provides the CPU the calling thread is running on
+ *
+ * The CPU id maintained by the kernel in the rseq area of the thread is
+ * read if glibc has registered it, sched_getcpu() (vDSO) is called
+ * otherwise. If none works the threads are spread round robin (the
+ * statistics shard of the thread). The result is only a hint, the thread
+ * may be migrated right after, the shard lock keeps the ring consistent.
+ */
+static unsigned int qlog_get_cpu_internal(void){
+    int cpu = -1;
+#ifdef QLOG_HAVE_RSEQ
+    const struct rseq* rseq_area = NULL;
+
+    if (__rseq_size > 0){
+        rseq_area = (const struct rseq*) ((char*) __builtin_thread_pointer() + __rseq_offset);
+        cpu = (int) __atomic_load_n(&rseq_area->cpu_id, __ATOMIC_RELAXED);
+        if (cpu >= 0){
+            return (unsigned int) cpu;
+        }
+    }
+#endif
+    cpu = sched_getcpu();
+    if (cpu >= 0){
+        return (unsigned int) cpu;
+    }
+    if (qlog_thread_stats_shard < 0){
+        qlog_thread_stats_shard = __sync_fetch_and_add(&qlog_stats_next_shard, 1) % QLOG_STATS_SHARD_NUM;
+    }
+    return (unsigned int) qlog_thread_stats_shard;
+}
+
+/* the dedup slot of a buffer in the calling thread */
+static qlog_dedup_slot_t* qlog_dedup_get_slot_internal(const qlog_buffer_t* log_buffer){
+    uintptr_t key = (uintptr_t) log_buffer >> 6;
+    return &qlog_thread_dedup[(key * 0x9E3779B97F4A7C15ULL) >> 61 & (QLOG_DEDUP_SLOTS - 1)];
+}
+
+/**
+ * \brief Internal function for getting the next event slot of a buffer
+ *
+ * \param log_buffer The buffer into the new event will be placed
+ * \param site The call site descriptor (optional)
+ * \param thread_id The registry id of the thread (optional)
+ * \param event The locked event is returned here
+ * \return 0 on success, -1 in case of error, QLOG_RET_EVNT_LOCKED if the
+ *         event has been dropped, QLOG_RET_FROZEN if the buffer is frozen
+ *
+ * The buffer is locked only for the pointer handling. As soon as the log
+ * event structure for the new message is secured (locked), the buffer lock
+ * is released. The event is cleared, the timestamp, the call site and the
+ * thread id are stored. The event has to be handed back by
+ * qlog_release_event_internal().
+ */
+int qlog_acquire_event_internal(
+        qlog_buffer_t* log_buffer,
+        const qlog_site_t* site,
+        qlog_thread_id_t thread_id,
+        qlog_event_t** event_out)
 {
     qlog_event_t* event = NULL;
+    qlog_buffer_t* ring = log_buffer;
+    qlog_dedup_slot_t* slot = NULL;
     int res = 0;
     unsigned char lock_state = 0;
 
+    /* a frozen buffer keeps its content until it is thawed */
+    if (log_buffer->frozen){
+        __sync_fetch_and_add(&qlog_stats_get_shard_internal(log_buffer)->frozen, 1);
+        return QLOG_RET_FROZEN;
+    }
+
+    /* the log call is timed until the event is released */
+    QLOG_INSTR_BEGIN(QLOG_INSTR_LOG);
+
     /* grab the buffer lock
      * get the next free slot and release the lock as soon as possible 
      * if the lock cannot be aquired, return with error
-     */
-    res = qlog_lock_buffer_internal(log_buffer);
-    if (res == 0){
-        event = log_buffer -> next_write;
-        log_buffer -> next_write = event->next;
-        if (log_buffer->next_write == log_buffer->head){
-            log_buffer->wrapped++;
-        }
-        res = qlog_unlock_buffer_internal(log_buffer);
-        if (res) {
-            return QLOG_RET_ERR;
-        }
-    } else {
-        return QLOG_RET_ERR;
-    }
-
-    /* Check if the event is not locked, i.e. other thread is not
+     *
+     * Check if the event is not locked, i.e. other thread is not
      * filling the event structure. This could happen if the buffer
      * is wrapped since the event structure is provided to another
      * thread but that one has not been finished updating the event 
@@ -620,69 +1510,364 @@ int qlog_log_internal(
      * next write pointer is selected. If the buffer wraps very 
      * often, the same events could be used by multiple threads
      * so we have to lock the event structure as well.
+     * The event lock is grabbed before the buffer lock is released so
+     * the event cannot be freed under us (see qlog_resize_buffer()).
      *
      * After the event is filled with the data, we release the 
      * event structure lock.
      *
      * If we happen to get a event which is currently locked,
-     * we return with -1 and do not store the event.
+     * we return with -2 and do not store the event.
      */
-    lock_state = __sync_lock_test_and_set(&event->lock, 1);
+    if (log_buffer->shards){
+        ring = log_buffer->shards[qlog_get_cpu_internal() % log_buffer->shard_num];
+    }
+    res = qlog_lock_buffer_internal(ring);
+    if (res == 0){
+        event = ring -> next_write;
+        ring -> next_write = event->next;
+        if (ring->next_write == ring->head){
+            ring->wrapped++;
+        }
+        lock_state = __sync_lock_test_and_set(&event->lock, 1);
+        res = qlog_unlock_buffer_internal(ring);
+        if (res) {
+            if (lock_state == 0){
+                __sync_and_and_fetch(&event->lock, 0);
+            }
+            return QLOG_RET_ERR;
+        }
+    } else {
+        return QLOG_RET_ERR;
+    }
+
     if (lock_state != 0) {
         /*
          * This event is still in use from another thread.
          * We have to leave now, this event is getting dropped.
          */
+        __sync_fetch_and_add(&log_buffer->event_locked, 1);
         return QLOG_RET_EVNT_LOCKED;
     }
 
-    gettimeofday(&(event->timestamp), NULL);
+    QLOG_INSTR_TIMED(QLOG_INSTR_TIME, gettimeofday(&(event->timestamp), NULL));
 
-    event->thread_name[0] = '\0';
     event->function_name[0] = '\0';
     event->message[0] = '\0';
-    /* store thread name if it is provided */
-    if (thread){
-        strncpy(event->thread_name, thread, QLOG_TNAME_BUF_SIZE - 1);
-    }
+    event->line_number = 0;
+    event->site = site;
+    event->message_ref = NULL;
+    event->thread_id = thread_id;
+    event->repeats = 0;
+    event->fields_size = 0;
+    event->suppressed = (site && (site->flags & QLOG_SITE_LIMITED)) ? qlog_site_take_suppressed(site) : 0;
 
-    /* store the function name if it is provided */
-    if (function){
-        strncpy(event->function_name, function, QLOG_FNAME_BUF_SIZE - 1);
+    /* clean up external event data */
+    if (event->ext_data != NULL){
+        qlog_free_ext_data_internal(event);
     }
 
-    /* store or clear the line number */
-    event->line_number = line_num;
+    /* remember the newest event of the thread for the deduplication. The
+     * epoch is read while the event is locked so a ring switch in between
+     * invalidates the slot. */
+    slot = qlog_dedup_get_slot_internal(log_buffer);
+    slot->buffer = log_buffer;
+    slot->ring = ring;
+    slot->event = event;
+    slot->epoch = qlog_ring_epoch;
 
-    /* store the log message */
-    if (message) {
-        strncpy(event->message, message, QLOG_MSG_BUF_SIZE - 1);
+    *event_out = event;
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Internal function for publishing a filled event
+ *
+ * \param log_buffer The buffer of the event
+ * \param event The event got from qlog_acquire_event_internal()
+ * \param bytes The number of message bytes stored
+ * \param ext_bytes The number of external payload bytes stored
+ *
+ * Marks the event used, releases the event lock and updates the
+ * statistics counters of the thread. The event must not be touched after
+ * this call. The trigger rules are checked while the event is still locked,
+ * the trigger is fired after it has been released (see qlog_trigger.h).
+ */
+void qlog_release_event_internal(qlog_buffer_t* log_buffer, qlog_event_t* event, size_t bytes, size_t ext_bytes){
+    qlog_stats_shard_t* stats = NULL;
+    int rule = -1;
+
+    event->indent_level = qlog_thread_indent_level;
+    event->used = 1;
+    if (qlog_trigger_rule_num > 0){
+        rule = qlog_trigger_match_internal(event);
     }
+    __sync_and_and_fetch(&event->lock, 0);
 
-    /* clean up external event data */
-    if (event->ext_data != NULL){
-        free(event->ext_data);
-        event->ext_data = NULL;
-        event->ext_data_size = 0;
-        event->ext_event_type = QLOG_EXT_EVENT_TYPE_NONE;
+    /* update the statistics counters of the thread */
+    stats = qlog_stats_get_shard_internal(log_buffer);
+    __sync_fetch_and_add(&stats->events, 1);
+    __sync_fetch_and_add(&stats->bytes, bytes + ext_bytes);
+    if (ext_bytes > 0){
+        __sync_fetch_and_add(&stats->ext_bytes, ext_bytes);
     }
 
-    /* if external log data has been provided, store it in the event */
-    if (ext_event_type != QLOG_EXT_EVENT_TYPE_NONE && ext_data && ext_data_size > 0) {
-        event->ext_data = malloc(ext_data_size);
-        memcpy(event->ext_data, ext_data, ext_data_size);
-        event->ext_event_type = ext_event_type;
-        event->ext_print_cb = qlog_ext_get_print_cb(ext_event_type);
-        event->ext_data_size = ext_data_size;
+    /* count down a pending freeze, the last event of the countdown freezes the buffer */
+    if (log_buffer->freeze_left > 0 && __sync_sub_and_fetch(&log_buffer->freeze_left, 1) == 0){
+        log_buffer->frozen = 1;
+    }
+    if (rule >= 0){
+        qlog_trigger_fire_internal(log_buffer, rule);
     }
+    QLOG_INSTR_END(QLOG_INSTR_LOG);
+}
 
-    event->indent_level = qlog_thread_indent_level;
-    event->used = 1;
+/**
+ * \brief Internal function for folding a repeated event into the previous one
+ *
+ * \param log_buffer The buffer of the event (in dedup mode)
+ * \param site The call site descriptor (optional)
+ * \param thread_id The registry id of the thread the message is logged from
+ * \param function The name of the function (optional)
+ * \param line_num The source code line number (optional)
+ * \param message The log message string, NULL for the literal of the call site
+ * \return QLOG_RET_OK if the event has been folded, QLOG_RET_ERR if it is
+ *         not a repeat and has to be stored
+ *
+ * Only the last event the thread has written to the buffer is a candidate
+ * (see qlog_acquire_event_internal()), so a repeat is folded only if it
+ * follows the previous event directly and the order of the events of the
+ * thread is kept. The event is locked (as by a writer) while it is compared
+ * and updated so it cannot be overwritten or freed meanwhile, the ring
+ * epoch is checked under the lock of the ring (the buffer or its shard)
+ * holding the event before that.
+ * If the event has been overwritten since, the comparison fails.
+ */
+static int qlog_dedup_internal(
+        qlog_buffer_t* log_buffer,
+        const qlog_site_t* site,
+        qlog_thread_id_t thread_id,
+        const char* function,
+        unsigned int line_num,
+        const char* message)
+{
+    qlog_dedup_slot_t* slot = qlog_dedup_get_slot_internal(log_buffer);
+    qlog_event_t* event = slot->event;
+    int res = QLOG_RET_ERR;
+
+    if (event == NULL || log_buffer->frozen || slot->buffer != log_buffer ||
+            slot->epoch != qlog_ring_epoch){
+        return QLOG_RET_ERR;
+    }
+    QLOG_INSTR_BEGIN(QLOG_INSTR_LOG);
+    if (qlog_lock_buffer_internal(slot->ring)){
+        return QLOG_RET_ERR;
+    }
+    if (slot->epoch != qlog_ring_epoch || __sync_lock_test_and_set(&event->lock, 1) != 0){
+        qlog_unlock_buffer_internal(slot->ring);
+        return QLOG_RET_ERR;
+    }
+    qlog_unlock_buffer_internal(slot->ring);
+
+    if (event->used && event->site == site && event->thread_id == thread_id &&
+            event->ext_event_type == QLOG_EXT_EVENT_TYPE_NONE && event->fields_size == 0 &&
+            event->indent_level == qlog_thread_indent_level &&
+            (site != NULL ||
+             (event->line_number == line_num &&
+              strncmp(event->function_name, function ? function : "", QLOG_FNAME_BUF_SIZE - 1) == 0)) &&
+            (message ? (event->message_ref == NULL &&
+                        strncmp(event->message, message, QLOG_MSG_BUF_SIZE - 1) == 0)
+                     : (site != NULL && event->message_ref == site->message))){
+        event->repeats++;
+        gettimeofday(&event->last_seen, NULL);
+        __sync_fetch_and_add(&qlog_stats_get_shard_internal(log_buffer)->repeats, 1);
+        res = QLOG_RET_OK;
+    }
     __sync_and_and_fetch(&event->lock, 0);
+    if (res == QLOG_RET_OK){
+        QLOG_INSTR_END(QLOG_INSTR_LOG);
+    }
+    return res;
+}
+
+/**
+ * \brief Internal function for saving a new log message in the buffer
+ *
+ * \param log_buffer The buffer into the new message will be placed
+ * \param site The call site descriptor (optional)
+ * \param thread_id The registry id of the thread the message is logged from (optional)
+ * \param function The name of the function from where the message is logged (optional)
+ * \param line_num The source code line number of the log message (optional)
+ * \param message The log message string
+ * \return 0 on success, -1 in case of error
+ *
+ * Stores an event with a single external data fragment,
+ * see qlog_logv_internal().
+ */
+int qlog_log_internal(
+        qlog_buffer_t* log_buffer, 
+        const qlog_site_t* site,
+        qlog_thread_id_t thread_id,
+        const char* function, 
+        unsigned int line_num, 
+        const char* message,
+        void* ext_data,
+        size_t ext_data_size,
+        qlog_ext_event_type_t ext_event_type)
+{
+    struct iovec iov;
+
+    iov.iov_base = ext_data;
+    iov.iov_len = ext_data ? ext_data_size : 0;
+    return qlog_logv_internal(log_buffer, site, thread_id, function, line_num, message,
+            &iov, 1, 0, ext_event_type);
+}
 
+/**
+ * \brief Internal function for saving a new log message with scattered external data
+ *
+ * \param log_buffer The buffer into the new message will be placed
+ * \param site The call site descriptor (optional)
+ * \param thread_id The registry id of the thread the message is logged from (optional)
+ * \param function The name of the function from where the message is logged (optional)
+ * \param line_num The source code line number of the log message (optional)
+ * \param message The log message string
+ * \param iov The fragments of the external data
+ * \param iovcnt The number of the fragments
+ * \param max_size The external data is truncated to this size, 0 for no limit
+ * \param ext_event_type The external event type
+ * \return 0 on success, -1 in case of error
+ *
+ * This function is the workhorse of the log message handling.
+ * Gets the next free log buffer position and copies the message into the buffer
+ * (see qlog_acquire_event_internal()).
+ * If the call site descriptor is provided, the function name and line number
+ * are taken from it and not copied. If the message is NULL, the literal
+ * message of the call site is referenced.
+ * The fragments are copied one after the other into the external data of
+ * the event. If it is truncated, the original size is kept in the event.
+ */
+int qlog_logv_internal(
+        qlog_buffer_t* log_buffer,
+        const qlog_site_t* site,
+        qlog_thread_id_t thread_id,
+        const char* function,
+        unsigned int line_num,
+        const char* message,
+        const struct iovec* iov,
+        int iovcnt,
+        size_t max_size,
+        qlog_ext_event_type_t ext_event_type)
+{
+    qlog_event_t* event = NULL;
+    size_t bytes = 0, ext_bytes = 0, total_size = 0, ext_data_size = 0, chunk = 0;
+    int res = 0, i = 0;
+
+    for (i = 0; iov && i < iovcnt; i++){
+        total_size += iov[i].iov_len;
+    }
+    ext_data_size = (max_size > 0 && total_size > max_size) ? max_size : total_size;
+
+    if (log_buffer->dedup && ext_data_size == 0 &&
+            qlog_dedup_internal(log_buffer, site, thread_id, function, line_num, message) == QLOG_RET_OK){
+        return QLOG_RET_OK;
+    }
+
+    res = qlog_acquire_event_internal(log_buffer, site, thread_id, &event);
+    if (res != QLOG_RET_OK){
+        return res;
+    }
+
+    /* store the function name and the line number if the call site
+     * does not hold them */
+    if (site == NULL){
+        if (function){
+            QLOG_INSTR_TIMED(QLOG_INSTR_COPY,
+                    bytes += qlog_copy_str_internal(event->function_name, function, QLOG_FNAME_BUF_SIZE));
+        }
+        event->line_number = line_num;
+    }
+
+    /* store the log message or reference the literal of the call site */
+    if (message) {
+        QLOG_INSTR_TIMED(QLOG_INSTR_COPY,
+                bytes += qlog_copy_str_internal(event->message, message, QLOG_MSG_BUF_SIZE));
+    } else if (site) {
+        event->message_ref = site->message;
+    }
+
+    /* if external log data has been provided, store it in the event
+     * (inline if it is small enough) */
+    if (ext_event_type != QLOG_EXT_EVENT_TYPE_NONE && ext_data_size > 0) {
+        if (ext_data_size <= sizeof(event->ext_inline)){
+            event->ext_data = event->ext_inline;
+        } else {
+            QLOG_INSTR_TIMED(QLOG_INSTR_MALLOC, event->ext_data = malloc(ext_data_size));
+        }
+        if (event->ext_data){
+            for (i = 0; i < iovcnt && ext_bytes < ext_data_size; i++){
+                chunk = iov[i].iov_len;
+                if (chunk > ext_data_size - ext_bytes){
+                    chunk = ext_data_size - ext_bytes;
+                }
+                memcpy((char*) event->ext_data + ext_bytes, iov[i].iov_base, chunk);
+                ext_bytes += chunk;
+            }
+            event->ext_event_type = ext_event_type;
+            event->ext_print_cb = qlog_ext_get_print_cb(ext_event_type);
+            event->ext_data_size = ext_data_size;
+            event->ext_orig_size = total_size;
+        }
+    }
+
+    qlog_release_event_internal(log_buffer, event, bytes, ext_bytes);
     return QLOG_RET_OK;
 }
 
+/**
+ * \brief Internal function for reserving the message field of an event
+ *
+ * \param log_buffer The buffer into the new event will be placed
+ * \param site The call site descriptor (optional)
+ * \param thread_id The registry id of the thread the message is logged from (optional)
+ * \param max_len The maximum message length including the terminating zero.
+ *                0 reserves the whole message field.
+ * \param handle The reservation is returned here
+ * \return 0 on success, -1 in case of error, QLOG_RET_EVNT_LOCKED if the
+ *         event has been dropped
+ *
+ * The event stays locked until qlog_commit() is called.
+ */
+int qlog_reserve_internal(
+        qlog_buffer_t* log_buffer,
+        qlog_site_t* site,
+        qlog_thread_id_t thread_id,
+        size_t max_len,
+        qlog_reservation_t* handle)
+{
+    qlog_event_t* event = NULL;
+    int res = 0;
+
+    handle->size = (max_len == 0 || max_len > QLOG_MSG_BUF_SIZE) ? QLOG_MSG_BUF_SIZE : max_len;
+    handle->buffer = log_buffer;
+    handle->site = site;
+
+    /* in dedup mode the message is formatted into a thread local buffer
+     * and logged (or folded) by qlog_commit() */
+    if (log_buffer->dedup){
+        handle->data = qlog_thread_dedup_message;
+        handle->event = NULL;
+        return QLOG_RET_OK;
+    }
+
+    res = qlog_acquire_event_internal(log_buffer, site, thread_id, &event);
+    if (res != QLOG_RET_OK){
+        return res;
+    }
+    handle->data = event->message;
+    handle->event = event;
+    return QLOG_RET_OK;
+}
 
 /**
  * \brief Internal buffer locking function. Aquire buffer lock.
@@ -697,8 +1882,28 @@ int qlog_log_internal(
  */
 int qlog_lock_buffer_internal(qlog_buffer_t* buffer){
     int res = 0;
+    unsigned int i = 0;
+
+    /* a per-CPU buffer is locked by locking all of its shards (readers) */
+    if (qlog_lib_inited && buffer && buffer->shards){
+        for (i = 0; i < buffer->shard_num; i++){
+            if (qlog_lock_buffer_internal(buffer->shards[i])){
+                while (i-- > 0){
+                    qlog_unlock_buffer_internal(buffer->shards[i]);
+                }
+                return QLOG_RET_ERR;
+            }
+        }
+        return QLOG_RET_OK;
+    }
     if (qlog_lib_inited && buffer) {
-        res = pthread_spin_lock(&buffer->lock);
+        res = pthread_spin_trylock(&buffer->lock);
+        if (res == EBUSY){
+            /* count the contention and wait for the lock */
+            __sync_fetch_and_add(&qlog_stats_get_shard_internal(buffer)->lock_contended, 1);
+            res = QLOG_INSTR_SPIN_LOCK(QLOG_INSTR_LOCK, &buffer->lock);
+        }
+        QLOG_INSTR_COUNT(QLOG_INSTR_LOCK);
         return res  == 0 ? QLOG_RET_OK : QLOG_RET_ERR;
     }
     return QLOG_RET_ERR;
@@ -712,6 +1917,14 @@ int qlog_lock_buffer_internal(qlog_buffer_t* buffer){
  */
 int qlog_unlock_buffer_internal(qlog_buffer_t* buffer) {
     int res = 0;
+    unsigned int i = 0;
+
+    if (qlog_lib_inited && buffer && buffer->shards){
+        for (i = buffer->shard_num; i > 0; i--){
+            res |= qlog_unlock_buffer_internal(buffer->shards[i - 1]);
+        }
+        return res == 0 ? QLOG_RET_OK : QLOG_RET_ERR;
+    }
     if (qlog_lib_inited && buffer){
         res = pthread_spin_unlock(&buffer->lock);
         return res == 0 ? QLOG_RET_OK : QLOG_RET_ERR;
@@ -728,6 +1941,7 @@ void qlog_disable_internal(void){
     if (qlog_enabled == 1){
         __sync_fetch_and_sub(&qlog_enabled, 1);
     }
+    qlog_update_level_mask_internal();
 }
 
 /**
@@ -739,6 +1953,21 @@ void qlog_enable_internal(void){
     if (qlog_enabled == 0){
         __sync_fetch_and_add(&qlog_enabled, 1);
     }
+    qlog_update_level_mask_internal();
+}
+
+/**
+ * \brief Recalculates the level mask checked by the QLOG macros
+ *
+ * All the levels up to the current log level are enabled if the
+ * logging is enabled, none of them otherwise.
+ */
+void qlog_update_level_mask_internal(void){
+    unsigned int mask = 0;
+    if (qlog_enabled){
+        mask = (1u << (qlog_level + 1)) - 1;
+    }
+    __sync_lock_test_and_set(&qlog_level_mask, mask);
 }
 
 /**
@@ -761,10 +1990,11 @@ int qlog_lock_global(int full_lock){
 
     if (qlog_lib_inited && qlog_global_lock_state == QLOG_LOCK_UNLOCKED){
         /* grab the global lock */
-        pt_res = pthread_spin_lock(&qlog_global_lock);
+        pt_res = QLOG_INSTR_SPIN_LOCK(QLOG_INSTR_GLOBAL_LOCK, &qlog_global_lock);
         if (pt_res){
             return QLOG_RET_ERR;
         }
+        QLOG_INSTR_COUNT(QLOG_INSTR_GLOBAL_LOCK);
         qlog_global_lock_state = QLOG_LOCK_SIMPLE;
 
         if (full_lock) {
@@ -844,8 +2074,45 @@ int qlog_internal_is_logging_enabled(void){
 }
 
 
-char* qlog_internal_get_thread_name(void){
-    return qlog_thread_name;
+/**
+ * \brief Provides the thread name of an event
+ *
+ * \param event The log event
+ * \return The name registered for the thread id of the event, NULL if none
+ */
+const char* qlog_internal_get_event_thread(const qlog_event_t* event){
+    return qlog_thread_get_name(event->thread_id);
+}
+
+/**
+ * \brief Provides the function name of an event
+ *
+ * Taken from the call site descriptor if the event has one.
+ */
+const char* qlog_internal_get_event_function(const qlog_event_t* event){
+    return event->site ? event->site->function : event->function_name;
+}
+
+/**
+ * \brief Provides the source line number of an event
+ */
+unsigned int qlog_internal_get_event_line(const qlog_event_t* event){
+    return event->site ? event->site->line : event->line_number;
+}
+
+/**
+ * \brief Provides the message of an event
+ *
+ * The literal message of the call site if it was not copied into the event.
+ */
+const char* qlog_internal_get_event_message(const qlog_event_t* event){
+    return event->message_ref ? event->message_ref : event->message;
+}
+
+/* the encoded fields of the event (see qlog_fields.h), NULL if it has none */
+const void* qlog_internal_get_event_fields(const qlog_event_t* event, size_t* size){
+    *size = event->fields_size;
+    return event->fields_size ? event->message + QLOG_MSG_BUF_SIZE - event->fields_size : NULL;
 }
 
 qlog_buffer_t* qlog_internal_get_default_buf(void){
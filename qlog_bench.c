@@ -0,0 +1,603 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_bench.c
+ * \brief Latency and throughput benchmark of the logging entry points.
+ *
+ * Every configuration (entry point, logging enabled/disabled, number of
+ * threads, buffer size and layout, message length) is run twice with the
+ * writer threads pinned to the CPUs round robin: a timed pass measuring
+ * the duration of every call (clock_gettime around the call, the cost of
+ * the clock is reported in the timer_ns column) and an untimed pass
+ * measuring the aggregate throughput. One line of CSV (or JSON) is printed
+ * per configuration so the runs can be compared by scripts.
+ *
+ * In reader mode (-r) every configuration is run without and with a reader
+ * thread dumping the buffer while the writers log, to measure how much the
+ * readers hurt the writers: the reader prints the buffer into a slow sink
+ * (qlog_display_print_buffer_id holds the buffer lock while writing),
+ * resets the buffer and dumps it like the server does (header, statistics
+ * and events into a fully buffered stream), over and over. The sink
+ * blocks the reader as a slow terminal or TCP peer would (-w bytes/sec).
+ * The drops (events found locked) are collected before every reset.
+ *
+ * usage: qlog_bench [-t threads] [-s sizes] [-m msg_lens] [-e entries]
+ *                   [-n calls] [-l layouts] [-d] [-j] [-r] [-w bytes_per_sec]
+ *   -t  comma separated thread counts (default 1,2,4 and the number of CPUs)
+ *   -s  comma separated buffer sizes in events (default 16,128, per shard
+ *       for the percpu layout, at most QLOG_MAX_EVENT_NUM)
+ *   -m  comma separated message lengths (default 16,64,255), the external
+ *       payload size of ext_log
+ *   -e  comma separated entry points: log, log_long_id, ext_log, QLOG,
+ *       QLOG_VA (default all)
+ *   -n  calls per thread and pass (default 20000)
+ *   -l  comma separated buffer layouts: single, percpu (default single)
+ *   -d  measure with the logging enabled only (no disabled pass)
+ *   -j  JSON lines instead of CSV
+ *   -r  reader interference mode (each configuration without and with the reader)
+ *   -w  speed of the slow sink of the reader in bytes/sec (default 10000000)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <stdint.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_display.h"
+#include "qlog_utils.h"
+
+#define QLOG_BENCH_MAX_LIST     16
+#define QLOG_BENCH_MAX_THREADS  256
+#define QLOG_BENCH_SUB_BITS     4
+#define QLOG_BENCH_SUB_NUM      (1 << QLOG_BENCH_SUB_BITS)
+#define QLOG_BENCH_BUCKET_NUM   ((64 - QLOG_BENCH_SUB_BITS + 1) * QLOG_BENCH_SUB_NUM)
+
+typedef enum {
+    QLOG_BENCH_LOG = 0,
+    QLOG_BENCH_LOG_LONG_ID,
+    QLOG_BENCH_EXT_LOG,
+    QLOG_BENCH_QLOG,
+    QLOG_BENCH_QLOG_VA,
+    QLOG_BENCH_ENTRY_NUM
+} qlog_bench_entry_t;
+
+static const char* qlog_bench_entry_names[QLOG_BENCH_ENTRY_NUM] = {
+    "log", "log_long_id", "ext_log", "QLOG", "QLOG_VA"
+};
+
+#define QLOG_BENCH_SINGLE   0
+#define QLOG_BENCH_PERCPU   1
+
+static const char* qlog_bench_layout_names[] = {"single", "percpu"};
+
+/* log-linear histogram of the call durations of a thread (ns), 6% error */
+typedef struct qlog_bench_hist_t {
+    unsigned long count;
+    uint64_t sum;
+    uint64_t max;
+    unsigned long buckets[QLOG_BENCH_BUCKET_NUM];
+} qlog_bench_hist_t;
+
+/* one configuration */
+typedef struct qlog_bench_config_t {
+    qlog_bench_entry_t entry;
+    int enabled;
+    unsigned int threads;
+    size_t buffer_size;
+    int layout;
+    size_t msg_len;
+    unsigned long calls;
+    int reader;                 /* a reader dumps the buffer during the passes */
+} qlog_bench_config_t;
+
+typedef struct qlog_bench_thread_t {
+    pthread_t thread;
+    unsigned int index;
+    int timed;
+    const qlog_bench_config_t* config;
+    pthread_barrier_t* barrier;
+    uint64_t start;             /* first and last call of the thread */
+    uint64_t end;
+    qlog_bench_hist_t hist;
+} __attribute__ ((aligned (64))) qlog_bench_thread_t;
+
+/* the result of a configuration */
+typedef struct qlog_bench_result_t {
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+    double mean;
+    double calls_per_sec;
+    unsigned long drops;
+    unsigned long wraps;
+    unsigned long reader_cycles;    /* print, reset and dump cycles done by the reader */
+} qlog_bench_result_t;
+
+/* the reader thread of the interference mode */
+typedef struct qlog_bench_reader_t {
+    pthread_t thread;
+    unsigned int cpu;
+    volatile int stop;
+    unsigned long cycles;
+    unsigned long drops;        /* drops counted before the resets */
+} qlog_bench_reader_t;
+
+static qlog_buffer_id_t qlog_bench_buffer = 0;
+static long qlog_bench_cpu_num = 1;
+static uint64_t qlog_bench_timer_ns = 0;
+static int qlog_bench_json = 0;
+static unsigned long qlog_bench_sink_rate = 10000000;
+
+static uint64_t qlog_bench_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int qlog_bench_bucket(uint64_t value){
+    unsigned int exponent = 0;
+
+    if (value < QLOG_BENCH_SUB_NUM){
+        return (unsigned int) value;
+    }
+    exponent = 63 - __builtin_clzll(value);
+    return (exponent - QLOG_BENCH_SUB_BITS + 1) * QLOG_BENCH_SUB_NUM +
+        ((value >> (exponent - QLOG_BENCH_SUB_BITS)) & (QLOG_BENCH_SUB_NUM - 1));
+}
+
+/* the highest value falling into a bucket */
+static uint64_t qlog_bench_bucket_max(unsigned int bucket){
+    unsigned int exponent = 0;
+    uint64_t base = 0;
+
+    if (bucket < QLOG_BENCH_SUB_NUM){
+        return bucket;
+    }
+    exponent = bucket / QLOG_BENCH_SUB_NUM + QLOG_BENCH_SUB_BITS - 1;
+    base = (uint64_t) (QLOG_BENCH_SUB_NUM + bucket % QLOG_BENCH_SUB_NUM) << (exponent - QLOG_BENCH_SUB_BITS);
+    return base + ((uint64_t) 1 << (exponent - QLOG_BENCH_SUB_BITS)) - 1;
+}
+
+static void qlog_bench_hist_add(qlog_bench_hist_t* hist, uint64_t value){
+    hist->buckets[qlog_bench_bucket(value)]++;
+    hist->count++;
+    hist->sum += value;
+    if (value > hist->max){
+        hist->max = value;
+    }
+}
+
+static void qlog_bench_hist_merge(qlog_bench_hist_t* dest, const qlog_bench_hist_t* src){
+    unsigned int i = 0;
+
+    for (i = 0; i < QLOG_BENCH_BUCKET_NUM; i++){
+        dest->buckets[i] += src->buckets[i];
+    }
+    dest->count += src->count;
+    dest->sum += src->sum;
+    if (src->max > dest->max){
+        dest->max = src->max;
+    }
+}
+
+static uint64_t qlog_bench_hist_percentile(const qlog_bench_hist_t* hist, double percentile){
+    unsigned long rank = 0, seen = 0;
+    unsigned int i = 0;
+
+    if (hist->count == 0){
+        return 0;
+    }
+    rank = (unsigned long) (hist->count * percentile);
+    if (rank >= hist->count){
+        rank = hist->count - 1;
+    }
+    for (i = 0; i < QLOG_BENCH_BUCKET_NUM; i++){
+        seen += hist->buckets[i];
+        if (seen > rank){
+            return qlog_bench_bucket_max(i) < hist->max ? qlog_bench_bucket_max(i) : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+/* pins the calling thread to a CPU */
+static void qlog_bench_pin(unsigned int cpu){
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* the entry points, the QLOG macros define a call site per expansion */
+#define QLOG_BENCH_CALL(entry, message, payload, msg_len, seq)                      \
+    switch (entry){                                                                 \
+        case QLOG_BENCH_LOG:                                                        \
+            qlog_log(message);                                                      \
+            break;                                                                  \
+        case QLOG_BENCH_LOG_LONG_ID:                                                \
+            qlog_log_long_id(qlog_bench_buffer, "bench", __func__, __LINE__, message); \
+            break;                                                                  \
+        case QLOG_BENCH_EXT_LOG:                                                    \
+            qlog_ext_log(QLOG_EXT_EVENT_TYPE_HEXDUMP, payload, msg_len, "payload"); \
+            break;                                                                  \
+        case QLOG_BENCH_QLOG:                                                       \
+            QLOG(message);                                                          \
+            break;                                                                  \
+        default:                                                                    \
+            QLOG_VA("%s %lu", message, seq);                                        \
+            break;                                                                  \
+    }
+
+static void* qlog_bench_writer(void* data){
+    qlog_bench_thread_t* thread = (qlog_bench_thread_t*) data;
+    const qlog_bench_config_t* config = thread->config;
+    char message[QLOG_MSG_BUF_SIZE];
+    char payload[QLOG_MSG_BUF_SIZE];
+    unsigned long i = 0;
+    uint64_t start = 0;
+
+    qlog_bench_pin(thread->index % qlog_bench_cpu_num);
+    memset(message, 'm', config->msg_len);
+    message[config->msg_len] = '\0';
+    memset(payload, 'p', sizeof(payload));
+
+    pthread_barrier_wait(thread->barrier);
+    thread->start = qlog_bench_now();
+    if (thread->timed){
+        for (i = 0; i < config->calls; i++){
+            start = qlog_bench_now();
+            QLOG_BENCH_CALL(config->entry, message, payload, config->msg_len, i);
+            qlog_bench_hist_add(&thread->hist, qlog_bench_now() - start);
+        }
+    } else {
+        for (i = 0; i < config->calls; i++){
+            QLOG_BENCH_CALL(config->entry, message, payload, config->msg_len, i);
+        }
+    }
+    thread->end = qlog_bench_now();
+    return NULL;
+}
+
+/* write function of the slow sink: the data is dropped after the time it
+ * would take to send it */
+static ssize_t qlog_bench_sink_write(void* cookie UNUSED, const char* data UNUSED, size_t size){
+    struct timespec delay;
+    uint64_t ns = (uint64_t) size * 1000000000ULL / (qlog_bench_sink_rate ? qlog_bench_sink_rate : 1);
+
+    delay.tv_sec = ns / 1000000000ULL;
+    delay.tv_nsec = ns % 1000000000ULL;
+    nanosleep(&delay, NULL);
+    return size;
+}
+
+/* a stream writing into the slow sink through a buffer of the given size */
+static FILE* qlog_bench_sink_open(size_t buffer_size){
+    cookie_io_functions_t functions;
+    FILE* stream = NULL;
+
+    memset(&functions, 0, sizeof(functions));
+    functions.write = qlog_bench_sink_write;
+    stream = fopencookie(NULL, "w", functions);
+    if (stream){
+        setvbuf(stream, NULL, _IOFBF, buffer_size);
+    }
+    return stream;
+}
+
+/* collects the drops of the buffer, they are cleared by the reset */
+static void qlog_bench_reader_reset(qlog_bench_reader_t* reader){
+    qlog_stats_t stats;
+
+    if (qlog_get_stats(qlog_bench_buffer, &stats) == QLOG_RET_OK){
+        reader->drops += stats.drops;
+    }
+    qlog_reset_buffer_id(qlog_bench_buffer);
+}
+
+static void* qlog_bench_reader(void* data){
+    qlog_bench_reader_t* reader = (qlog_bench_reader_t*) data;
+    FILE* terminal = qlog_bench_sink_open(512);
+    FILE* server = qlog_bench_sink_open(4096);
+
+    qlog_bench_pin(reader->cpu);
+    while (terminal && server && !reader->stop){
+        /* print the buffer */
+        qlog_display_print_buffer_id(terminal, qlog_bench_buffer);
+        fflush(terminal);
+        qlog_bench_reader_reset(reader);
+
+        /* dump it as the server does */
+        fprintf(server, "\n================================================================================\n");
+        fprintf(server, "Print logs from the active buffer\n");
+        fprintf(server, "================================================================================\n");
+        qlog_display_print_buffer_stats(server);
+        qlog_display_print_buffer_id(server, qlog_bench_buffer);
+        fprintf(server, "================================================================================\n\n");
+        fflush(server);
+        qlog_bench_reader_reset(reader);
+        reader->cycles++;
+    }
+    if (terminal){
+        fclose(terminal);
+    }
+    if (server){
+        fclose(server);
+    }
+    return NULL;
+}
+
+/* a fresh library instance with the buffer of the configuration */
+static int qlog_bench_setup(const qlog_bench_config_t* config){
+    qlog_buffer_attr_t attr;
+
+    if (qlog_init(0) != QLOG_RET_OK){
+        return QLOG_RET_ERR;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.size = config->buffer_size;
+    attr.flags = config->layout == QLOG_BENCH_PERCPU ? QLOG_BUFFER_PER_CPU : 0;
+    attr.numa_node = -1;
+    if (qlog_create_buffer_attr(&attr) != 0){
+        qlog_cleanup();
+        return QLOG_RET_ERR;
+    }
+    qlog_bench_buffer = 0;
+    if (!config->enabled){
+        qlog_toggle_status();
+    }
+    return QLOG_RET_OK;
+}
+
+/* runs the writers of a pass, returns the wall time in ns (first call to
+ * last call of all the writers) */
+static uint64_t qlog_bench_pass(const qlog_bench_config_t* config, qlog_bench_thread_t* threads,
+        int timed, qlog_bench_reader_t* reader){
+    pthread_barrier_t barrier;
+    uint64_t start = 0, end = 0;
+    unsigned int i = 0;
+
+    /* the reader runs on the CPU after the writers */
+    if (config->reader){
+        reader->cpu = config->threads % qlog_bench_cpu_num;
+        reader->stop = 0;
+        pthread_create(&reader->thread, NULL, qlog_bench_reader, reader);
+    }
+    pthread_barrier_init(&barrier, NULL, config->threads);
+    for (i = 0; i < config->threads; i++){
+        memset(&threads[i].hist, 0, sizeof(threads[i].hist));
+        threads[i].index = i;
+        threads[i].timed = timed;
+        threads[i].config = config;
+        threads[i].barrier = &barrier;
+        pthread_create(&threads[i].thread, NULL, qlog_bench_writer, &threads[i]);
+    }
+    for (i = 0; i < config->threads; i++){
+        pthread_join(threads[i].thread, NULL);
+        if (i == 0 || threads[i].start < start){
+            start = threads[i].start;
+        }
+        if (threads[i].end > end){
+            end = threads[i].end;
+        }
+    }
+    if (config->reader){
+        reader->stop = 1;
+        pthread_join(reader->thread, NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+    return end - start;
+}
+
+static int qlog_bench_run(const qlog_bench_config_t* config, qlog_bench_result_t* result){
+    static qlog_bench_thread_t threads[QLOG_BENCH_MAX_THREADS];
+    qlog_bench_reader_t reader;
+    qlog_bench_hist_t* total = NULL;
+    qlog_stats_t stats;
+    uint64_t wall = 0;
+    unsigned int i = 0;
+
+    memset(result, 0, sizeof(qlog_bench_result_t));
+    memset(&reader, 0, sizeof(reader));
+    total = calloc(1, sizeof(qlog_bench_hist_t));
+    if (total == NULL || qlog_bench_setup(config) != QLOG_RET_OK){
+        free(total);
+        return QLOG_RET_ERR;
+    }
+
+    /* latency pass */
+    qlog_bench_pass(config, threads, 1, &reader);
+    for (i = 0; i < config->threads; i++){
+        qlog_bench_hist_merge(total, &threads[i].hist);
+    }
+    result->p50 = qlog_bench_hist_percentile(total, 0.50);
+    result->p99 = qlog_bench_hist_percentile(total, 0.99);
+    result->p999 = qlog_bench_hist_percentile(total, 0.999);
+    result->max = total->max;
+    result->mean = total->count ? (double) total->sum / total->count : 0;
+    free(total);
+
+    /* throughput pass, the drops and wraps of both passes are reported
+     * (the wraps since the last reset of the reader) */
+    wall = qlog_bench_pass(config, threads, 0, &reader);
+    result->calls_per_sec = wall ? (double) config->calls * config->threads * 1e9 / wall : 0;
+    if (qlog_get_stats(qlog_bench_buffer, &stats) == QLOG_RET_OK){
+        result->drops = stats.drops + reader.drops;
+        result->wraps = stats.wraps;
+    }
+    result->reader_cycles = reader.cycles;
+    qlog_cleanup();
+    return QLOG_RET_OK;
+}
+
+/* the p50 cost of reading the clock, included in every measured call */
+static uint64_t qlog_bench_timer_cost(void){
+    qlog_bench_hist_t* hist = calloc(1, sizeof(qlog_bench_hist_t));
+    uint64_t start = 0, res = 0;
+    int i = 0;
+
+    if (hist == NULL){
+        return 0;
+    }
+    for (i = 0; i < 100000; i++){
+        start = qlog_bench_now();
+        qlog_bench_hist_add(hist, qlog_bench_now() - start);
+    }
+    res = qlog_bench_hist_percentile(hist, 0.50);
+    free(hist);
+    return res;
+}
+
+static void qlog_bench_print_header(void){
+    if (!qlog_bench_json){
+        printf("entry,enabled,threads,layout,buffer_size,msg_len,calls,reader,"
+                "p50_ns,p99_ns,p999_ns,max_ns,mean_ns,calls_per_sec,drops,wraps,reader_cycles,timer_ns\n");
+    }
+}
+
+static void qlog_bench_print_result(const qlog_bench_config_t* config, const qlog_bench_result_t* result){
+    const char* format = qlog_bench_json ?
+        "{\"entry\":\"%s\",\"enabled\":%d,\"threads\":%u,\"layout\":\"%s\",\"buffer_size\":%lu,"
+        "\"msg_len\":%lu,\"calls\":%lu,\"reader\":%d,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+        "\"max_ns\":%llu,\"mean_ns\":%.1f,\"calls_per_sec\":%.0f,\"drops\":%lu,\"wraps\":%lu,"
+        "\"reader_cycles\":%lu,\"timer_ns\":%llu}\n" :
+        "%s,%d,%u,%s,%lu,%lu,%lu,%d,%llu,%llu,%llu,%llu,%.1f,%.0f,%lu,%lu,%lu,%llu\n";
+
+    printf(format, qlog_bench_entry_names[config->entry], config->enabled, config->threads,
+            qlog_bench_layout_names[config->layout], (unsigned long) config->buffer_size,
+            (unsigned long) config->msg_len, config->calls, config->reader,
+            (unsigned long long) result->p50, (unsigned long long) result->p99,
+            (unsigned long long) result->p999, (unsigned long long) result->max,
+            result->mean, result->calls_per_sec, result->drops, result->wraps,
+            result->reader_cycles, (unsigned long long) qlog_bench_timer_ns);
+    fflush(stdout);
+}
+
+/* parses a comma separated list of numbers */
+static size_t qlog_bench_parse_list(const char* arg, unsigned long* list){
+    char* end = NULL;
+    size_t num = 0;
+
+    while (*arg && num < QLOG_BENCH_MAX_LIST){
+        list[num++] = strtoul(arg, &end, 10);
+        if (end == arg){
+            return 0;
+        }
+        arg = *end == ',' ? end + 1 : end;
+    }
+    return num;
+}
+
+/* parses a comma separated list of names, returns their indices */
+static size_t qlog_bench_parse_names(const char* arg, const char** names, size_t name_num,
+        unsigned long* list){
+    char buffer[256];
+    char *token = NULL, *save = NULL;
+    size_t num = 0, i = 0;
+
+    snprintf(buffer, sizeof(buffer), "%s", arg);
+    for (token = strtok_r(buffer, ",", &save); token && num < QLOG_BENCH_MAX_LIST;
+            token = strtok_r(NULL, ",", &save)){
+        for (i = 0; i < name_num && strcmp(token, names[i]) != 0; i++);
+        if (i == name_num){
+            fprintf(stderr, "qlog_bench: unknown name %s\n", token);
+            return 0;
+        }
+        list[num++] = i;
+    }
+    return num;
+}
+
+static void qlog_bench_usage(void){
+    fprintf(stderr, "usage: qlog_bench [-t threads] [-s sizes] [-m msg_lens] [-e entries]\n"
+            "                  [-n calls] [-l layouts] [-d] [-j] [-r] [-w bytes_per_sec]\n"
+            "  entries: log,log_long_id,ext_log,QLOG,QLOG_VA  layouts: single,percpu\n");
+}
+
+int main(int argc, char** argv){
+    unsigned long threads[QLOG_BENCH_MAX_LIST] = {1, 2, 4};
+    unsigned long sizes[QLOG_BENCH_MAX_LIST] = {16, QLOG_MAX_EVENT_NUM};
+    unsigned long msg_lens[QLOG_BENCH_MAX_LIST] = {16, 64, QLOG_MSG_BUF_SIZE - 1};
+    unsigned long entries[QLOG_BENCH_MAX_LIST] = {0, 1, 2, 3, 4};
+    unsigned long layouts[QLOG_BENCH_MAX_LIST] = {QLOG_BENCH_SINGLE};
+    size_t thread_num = 3, size_num = 2, msg_len_num = 3, entry_num = QLOG_BENCH_ENTRY_NUM, layout_num = 1;
+    size_t e = 0, t = 0, s = 0, m = 0, l = 0;
+    int enabled = 0, enabled_only = 0, reader = 0, reader_mode = 0, opt = 0;
+    qlog_bench_config_t config;
+    qlog_bench_result_t result;
+
+    qlog_bench_cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    if (qlog_bench_cpu_num < 1){
+        qlog_bench_cpu_num = 1;
+    }
+    if (qlog_bench_cpu_num > 4){
+        threads[thread_num++] = (unsigned long) qlog_bench_cpu_num;
+    }
+    memset(&config, 0, sizeof(config));
+    config.calls = 20000;
+
+    while ((opt = getopt(argc, argv, "t:s:m:e:n:l:djrw:h")) != -1){
+        switch (opt){
+            case 't': thread_num = qlog_bench_parse_list(optarg, threads); break;
+            case 's': size_num = qlog_bench_parse_list(optarg, sizes); break;
+            case 'm': msg_len_num = qlog_bench_parse_list(optarg, msg_lens); break;
+            case 'e': entry_num = qlog_bench_parse_names(optarg, qlog_bench_entry_names,
+                              QLOG_BENCH_ENTRY_NUM, entries); break;
+            case 'l': layout_num = qlog_bench_parse_names(optarg, qlog_bench_layout_names, 2, layouts); break;
+            case 'n': config.calls = strtoul(optarg, NULL, 10); break;
+            case 'd': enabled_only = 1; break;
+            case 'j': qlog_bench_json = 1; break;
+            case 'r': reader_mode = 1; break;
+            case 'w': qlog_bench_sink_rate = strtoul(optarg, NULL, 10); break;
+            default:
+                qlog_bench_usage();
+                return 1;
+        }
+    }
+    if (!thread_num || !size_num || !msg_len_num || !entry_num || !layout_num){
+        qlog_bench_usage();
+        return 1;
+    }
+
+    qlog_bench_timer_ns = qlog_bench_timer_cost();
+    qlog_bench_print_header();
+    for (e = 0; e < entry_num; e++){
+        for (enabled = 1; enabled >= (enabled_only ? 1 : 0); enabled--){
+            for (t = 0; t < thread_num; t++){
+                for (l = 0; l < layout_num; l++){
+                    for (s = 0; s < size_num; s++){
+                        for (m = 0; m < msg_len_num; m++){
+                          for (reader = 0; reader <= reader_mode; reader++){
+                            config.reader = reader;
+                            config.entry = (qlog_bench_entry_t) entries[e];
+                            config.enabled = enabled;
+                            config.threads = threads[t] < 1 ? 1 :
+                                threads[t] > QLOG_BENCH_MAX_THREADS ? QLOG_BENCH_MAX_THREADS : threads[t];
+                            config.layout = (int) layouts[l];
+                            config.buffer_size = sizes[s];
+                            config.msg_len = msg_lens[m] < QLOG_MSG_BUF_SIZE ? msg_lens[m] : QLOG_MSG_BUF_SIZE - 1;
+                            if (qlog_bench_run(&config, &result) == QLOG_RET_OK){
+                                qlog_bench_print_result(&config, &result);
+                            } else {
+                                fprintf(stderr, "qlog_bench: error setting up the configuration\n");
+                            }
+                          }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
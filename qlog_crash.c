@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_crash.c
+ * \brief Crash dump of the log buffers on fatal signals.
+ *
+ * The dump runs in signal handler context so only async-signal-safe
+ * functions are used: the output is formatted by hand into a stack buffer
+ * and written with write(). No locks are taken, the buffers are dumped as
+ * they are at the moment of the crash.
+ */
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_crash.h"
+#include "qlog_stack.h"
+
+#define QLOG_CRASH_OUT_BUF_SIZE     4096
+#define QLOG_CRASH_HEX_LINE_SIZE    32
+#define QLOG_CRASH_ALT_STACK_SIZE   65536
+
+extern qlog_buffer_t* qlog_buffers[];
+extern int qlog_lib_inited;
+
+typedef struct qlog_crash_out_t {
+    int fd;
+    size_t len;
+    char buf[QLOG_CRASH_OUT_BUF_SIZE];
+} qlog_crash_out_t;
+
+static const int qlog_crash_fatal_signals[] = {SIGSEGV, SIGABRT, SIGBUS};
+
+static int qlog_crash_fd = -1;
+static int qlog_crash_fd_owned = 0;
+static int qlog_crash_flags = 0;
+static volatile sig_atomic_t qlog_crash_in_progress = 0;
+static struct sigaction qlog_crash_old_actions[NSIG];
+static char qlog_crash_alt_stack[QLOG_CRASH_ALT_STACK_SIZE];
+
+
+static void qlog_crash_flush(qlog_crash_out_t* out){
+    size_t written = 0;
+    ssize_t res = 0;
+
+    while (written < out->len){
+        res = write(out->fd, out->buf + written, out->len - written);
+        if (res < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        written += res;
+    }
+    out->len = 0;
+}
+
+static void qlog_crash_put_mem(qlog_crash_out_t* out, const char* data, size_t size){
+    size_t chunk = 0;
+
+    while (size > 0){
+        if (out->len == sizeof(out->buf)){
+            qlog_crash_flush(out);
+        }
+        chunk = sizeof(out->buf) - out->len;
+        if (chunk > size){
+            chunk = size;
+        }
+        memcpy(out->buf + out->len, data, chunk);
+        out->len += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static void qlog_crash_put_str(qlog_crash_out_t* out, const char* str, size_t max_len){
+    size_t len = 0;
+
+    while (len < max_len && str[len] != '\0'){
+        len++;
+    }
+    qlog_crash_put_mem(out, str, len);
+}
+
+static void qlog_crash_put_dec(qlog_crash_out_t* out, unsigned long value, int width){
+    char digits[24];
+    int i = sizeof(digits);
+
+    do {
+        digits[--i] = '0' + value % 10;
+        value /= 10;
+        width--;
+    } while (value != 0 && i > 0);
+    while (width-- > 0 && i > 0){
+        digits[--i] = '0';
+    }
+    qlog_crash_put_mem(out, digits + i, sizeof(digits) - i);
+}
+
+static void qlog_crash_put_hex(qlog_crash_out_t* out, const unsigned char* data, size_t size){
+    static const char hex_digits[] = "0123456789abcdef";
+    char hex[2];
+    size_t i = 0;
+
+    for (i = 0; i < size; i++){
+        hex[0] = hex_digits[data[i] >> 4];
+        hex[1] = hex_digits[data[i] & 0x0f];
+        qlog_crash_put_mem(out, hex, 2);
+    }
+}
+
+static void qlog_crash_put_addr(qlog_crash_out_t* out, unsigned long value){
+    static const char hex_digits[] = "0123456789abcdef";
+    char digits[2 + 2 * sizeof(unsigned long)];
+    int i = sizeof(digits);
+
+    do {
+        digits[--i] = hex_digits[value & 0x0f];
+        value >>= 4;
+    } while (value != 0 && i > 2);
+    digits[--i] = 'x';
+    digits[--i] = '0';
+    qlog_crash_put_mem(out, digits + i, sizeof(digits) - i);
+}
+
+static void qlog_crash_dump_ext(qlog_crash_out_t* out, const qlog_event_t* event){
+    size_t i = 0, chunk = 0, num_frames = 0;
+    void* const* frames = NULL;
+    const qlog_stack_t* stack = NULL;
+    qlog_stack_id_t stack_id = QLOG_STACK_ID_NONE;
+
+    qlog_crash_put_str(out, "\text type ", 16);
+    qlog_crash_put_dec(out, event->ext_event_type, 0);
+    qlog_crash_put_str(out, ", ", 4);
+    qlog_crash_put_dec(out, event->ext_data_size, 0);
+    qlog_crash_put_str(out, " bytes", 8);
+    if (event->ext_orig_size > event->ext_data_size){
+        qlog_crash_put_str(out, " (truncated from ", 32);
+        qlog_crash_put_dec(out, event->ext_orig_size, 0);
+        qlog_crash_put_mem(out, ")", 1);
+    }
+    qlog_crash_put_mem(out, "\n", 1);
+
+    if (event->ext_event_type == QLOG_EXT_EVENT_TYPE_BT ||
+            event->ext_event_type == QLOG_EXT_EVENT_TYPE_FTRACE){
+        /* a trace record is printed as the function and its caller frame */
+        frames = (void* const*) event->ext_data;
+        num_frames = event->ext_data_size / sizeof(void*);
+    } else if (event->ext_event_type == QLOG_EXT_EVENT_TYPE_STACK &&
+            event->ext_data_size == sizeof(stack_id)){
+        memcpy(&stack_id, event->ext_data, sizeof(stack_id));
+        stack = qlog_stack_get(stack_id);
+        if (stack){
+            frames = stack->frames;
+            num_frames = stack->depth;
+        }
+    }
+
+    if (frames){
+        for (i = 0; i < num_frames; i++){
+            qlog_crash_put_str(out, "\tframe#", 8);
+            qlog_crash_put_dec(out, i, 0);
+            qlog_crash_put_str(out, ": ", 4);
+            qlog_crash_put_addr(out, (unsigned long) frames[i]);
+            qlog_crash_put_mem(out, "\n", 1);
+        }
+        return;
+    }
+
+    for (i = 0; i < event->ext_data_size; i += QLOG_CRASH_HEX_LINE_SIZE){
+        chunk = event->ext_data_size - i;
+        if (chunk > QLOG_CRASH_HEX_LINE_SIZE){
+            chunk = QLOG_CRASH_HEX_LINE_SIZE;
+        }
+        qlog_crash_put_str(out, "\t+", 4);
+        qlog_crash_put_dec(out, i, 6);
+        qlog_crash_put_mem(out, " ", 1);
+        qlog_crash_put_hex(out, (const unsigned char*) event->ext_data + i, chunk);
+        qlog_crash_put_mem(out, "\n", 1);
+    }
+}
+
+/*
+ * Format: <sec>.<usec> [thread:function:line]: message
+ * The timestamp is not broken down into date and time (localtime_r is
+ * not async-signal-safe).
+ */
+static void qlog_crash_dump_event(const qlog_event_t* event, void* data){
+    qlog_crash_out_t* out = (qlog_crash_out_t*) data;
+    const char* function_name = NULL;
+    const char* thread_name = NULL;
+
+    qlog_crash_put_dec(out, event->timestamp.tv_sec, 0);
+    qlog_crash_put_mem(out, ".", 1);
+    qlog_crash_put_dec(out, event->timestamp.tv_usec, 6);
+    qlog_crash_put_str(out, " [", 4);
+    thread_name = qlog_internal_get_event_thread(event);
+    qlog_crash_put_str(out, thread_name ? thread_name : "-", QLOG_THREAD_NAME_SIZE);
+    qlog_crash_put_mem(out, ":", 1);
+    function_name = qlog_internal_get_event_function(event);
+    qlog_crash_put_str(out, function_name[0] != '\0' ? function_name : "-", QLOG_FNAME_BUF_SIZE);
+    qlog_crash_put_mem(out, ":", 1);
+    qlog_crash_put_dec(out, qlog_internal_get_event_line(event), 0);
+    qlog_crash_put_str(out, "]: ", 4);
+    qlog_crash_put_str(out, qlog_internal_get_event_message(event), QLOG_MSG_BUF_SIZE);
+    if (event->suppressed){
+        qlog_crash_put_str(out, " (", 4);
+        qlog_crash_put_dec(out, event->suppressed, 0);
+        qlog_crash_put_str(out, " suppressed)", 16);
+    }
+    if (event->repeats){
+        qlog_crash_put_str(out, " (repeated ", 16);
+        qlog_crash_put_dec(out, event->repeats, 0);
+        qlog_crash_put_str(out, " times, last ", 16);
+        qlog_crash_put_dec(out, event->last_seen.tv_sec, 0);
+        qlog_crash_put_mem(out, ".", 1);
+        qlog_crash_put_dec(out, event->last_seen.tv_usec, 6);
+        qlog_crash_put_mem(out, ")", 1);
+    }
+    qlog_crash_put_mem(out, "\n", 1);
+
+    if (event->ext_event_type != QLOG_EXT_EVENT_TYPE_NONE && event->ext_data &&
+            event->ext_data_size > 0){
+        qlog_crash_dump_ext(out, event);
+    }
+}
+
+/**
+ * \brief Dumps all the log buffers into a file descriptor
+ *
+ * \param fd The file descriptor to write the dump into
+ *
+ * Async-signal-safe, no locks are taken and no memory is allocated so it
+ * can be called from a signal handler. The content of the buffers may be
+ * inconsistent if the writers are active during the dump.
+ */
+void qlog_crash_dump(int fd){
+    qlog_crash_out_t out;
+    int i = 0;
+
+    out.fd = fd;
+    out.len = 0;
+
+    if (!qlog_lib_inited){
+        qlog_crash_put_str(&out, "qlog: the library has not been initialized\n", 64);
+        qlog_crash_flush(&out);
+        return;
+    }
+
+    for (i = 0; i < QLOG_MAX_BUF_NUM; i++){
+        if (qlog_buffers[i] == NULL){
+            continue;
+        }
+        qlog_crash_put_str(&out, "=== qlog buffer #", 32);
+        qlog_crash_put_dec(&out, i, 0);
+        qlog_crash_put_str(&out, ", size ", 8);
+        qlog_crash_put_dec(&out, qlog_buffers[i]->buffer_size, 0);
+        qlog_crash_put_str(&out, ", wrapped ", 16);
+        qlog_crash_put_dec(&out, qlog_get_wraps_internal(qlog_buffers[i]), 0);
+        if (qlog_buffers[i]->shards){
+            qlog_crash_put_str(&out, ", shards ", 16);
+            qlog_crash_put_dec(&out, qlog_buffers[i]->shard_num, 0);
+        }
+        qlog_crash_put_str(&out, " ===\n", 8);
+        qlog_walk_buffer_internal(qlog_buffers[i], qlog_crash_dump_event, &out);
+    }
+    qlog_crash_flush(&out);
+}
+
+static void qlog_crash_signal_handler(int sig, siginfo_t* info UNUSED, void* context UNUSED){
+    qlog_crash_out_t out;
+    int saved_errno = errno;
+
+    /* a second crash during the dump goes straight to the old handler */
+    if (qlog_crash_in_progress == 0){
+        qlog_crash_in_progress = 1;
+        out.fd = qlog_crash_fd;
+        out.len = 0;
+        qlog_crash_put_str(&out, "\nqlog dump on signal ", 32);
+        qlog_crash_put_dec(&out, sig, 0);
+        qlog_crash_put_mem(&out, "\n", 1);
+        qlog_crash_flush(&out);
+        qlog_crash_dump(qlog_crash_fd);
+        if (sig == SIGUSR1){
+            qlog_crash_in_progress = 0;
+            errno = saved_errno;
+            return;
+        }
+    }
+
+    /* restore the original action and raise the signal again: it is
+     * delivered when the handler returns */
+    sigaction(sig, &qlog_crash_old_actions[sig], NULL);
+    raise(sig);
+}
+
+static int qlog_crash_set_handler(int sig){
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = qlog_crash_signal_handler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(sig, &action, &qlog_crash_old_actions[sig]) == 0 ? QLOG_RET_OK : QLOG_RET_ERR;
+}
+
+/**
+ * \brief Installs the crash dump signal handlers
+ *
+ * \param fd The pre-opened file descriptor the dump is written into
+ * \param flags QLOG_CRASH_FATAL and/or QLOG_CRASH_ON_DEMAND
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of any error
+ *
+ * With QLOG_CRASH_FATAL the buffers are dumped on SIGSEGV, SIGABRT and
+ * SIGBUS, after the dump the signal is passed on to the original handler.
+ * With QLOG_CRASH_ON_DEMAND the buffers are dumped on SIGUSR1 and the
+ * process continues.
+ * An alternate signal stack is set up for the calling thread so a stack
+ * overflow in this thread can also be dumped.
+ */
+int qlog_crash_handler_install(int fd, int flags){
+    stack_t alt_stack;
+    unsigned int i = 0;
+
+    if (fd < 0 || (flags & (QLOG_CRASH_FATAL | QLOG_CRASH_ON_DEMAND)) == 0){
+        return QLOG_RET_ERR;
+    }
+
+    qlog_crash_handler_uninstall();
+    qlog_crash_fd = fd;
+    qlog_crash_flags = flags;
+
+    memset(&alt_stack, 0, sizeof(alt_stack));
+    alt_stack.ss_sp = qlog_crash_alt_stack;
+    alt_stack.ss_size = sizeof(qlog_crash_alt_stack);
+    sigaltstack(&alt_stack, NULL);
+
+    if (flags & QLOG_CRASH_FATAL){
+        for (i = 0; i < sizeof(qlog_crash_fatal_signals) / sizeof(qlog_crash_fatal_signals[0]); i++){
+            if (qlog_crash_set_handler(qlog_crash_fatal_signals[i]) != QLOG_RET_OK){
+                return QLOG_RET_ERR;
+            }
+        }
+    }
+    if (flags & QLOG_CRASH_ON_DEMAND){
+        if (qlog_crash_set_handler(SIGUSR1) != QLOG_RET_OK){
+            return QLOG_RET_ERR;
+        }
+    }
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Installs the crash dump signal handlers writing into a file
+ *
+ * \param path The path of the dump file, the dump is appended to the file
+ * \param flags QLOG_CRASH_FATAL and/or QLOG_CRASH_ON_DEMAND
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of any error
+ *
+ * The file is opened now, the signal handler only writes into it.
+ */
+int qlog_crash_handler_install_file(const char* path, int flags){
+    int fd = -1;
+
+    if (path == NULL){
+        return QLOG_RET_ERR;
+    }
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0){
+        return QLOG_RET_ERR;
+    }
+    if (qlog_crash_handler_install(fd, flags) != QLOG_RET_OK){
+        close(fd);
+        return QLOG_RET_ERR;
+    }
+    qlog_crash_fd_owned = 1;
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Removes the crash dump signal handlers
+ *
+ * The original signal actions are restored. The dump file is closed if
+ * it was opened by qlog_crash_handler_install_file().
+ */
+void qlog_crash_handler_uninstall(void){
+    unsigned int i = 0;
+
+    if (qlog_crash_flags & QLOG_CRASH_FATAL){
+        for (i = 0; i < sizeof(qlog_crash_fatal_signals) / sizeof(qlog_crash_fatal_signals[0]); i++){
+            sigaction(qlog_crash_fatal_signals[i], &qlog_crash_old_actions[qlog_crash_fatal_signals[i]], NULL);
+        }
+    }
+    if (qlog_crash_flags & QLOG_CRASH_ON_DEMAND){
+        sigaction(SIGUSR1, &qlog_crash_old_actions[SIGUSR1], NULL);
+    }
+    if (qlog_crash_fd_owned && qlog_crash_fd >= 0){
+        close(qlog_crash_fd);
+    }
+    qlog_crash_flags = 0;
+    qlog_crash_fd = -1;
+    qlog_crash_fd_owned = 0;
+}
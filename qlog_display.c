@@ -12,8 +12,14 @@
 #include "qlog.h"
 #include "qlog_internal.h"
 #include "qlog_display.h"
+#include "qlog_latency.h"
+#include "qlog_fields.h"
+#include "qlog_metric.h"
+#include "qlog_trigger.h"
+#include "qlog_symbol.h"
 
 int qlog_display_indention_enabled = 0;
+int qlog_display_fields_json = 0;
 
 void qlog_display_format_timestamp(char* buffer, size_t size, const struct timeval* t){
     struct tm bdt;
@@ -39,6 +45,11 @@ void qlog_display_format_indent(char* buffer, size_t size, uint8_t indent_level)
 void qlog_display_format_event_str(const qlog_event_t* event, char* buffer, size_t buffer_size){
     char timestamp_str[30];
     char indent_str[30];
+    const char* function_name = NULL;
+    const char* thread_name = NULL;
+    const char* message = NULL;
+    const void* fields = NULL;
+    size_t len = 0, fields_size = 0;
 
     if (event == NULL || buffer == NULL || buffer_size == 0){
         return;
@@ -48,19 +59,40 @@ void qlog_display_format_event_str(const qlog_event_t* event, char* buffer, size
     qlog_display_format_timestamp(timestamp_str, sizeof(timestamp_str), &event->timestamp);
     qlog_display_format_indent(indent_str, sizeof(indent_str), event->indent_level);
 
+    function_name = qlog_internal_get_event_function(event);
+    thread_name = qlog_internal_get_event_thread(event);
+    message = qlog_internal_get_event_message(event);
     snprintf(buffer, buffer_size - 1,
             "%s%s[%s:%s:%u]: %s",
             timestamp_str,
             indent_str, 
-            event->thread_name[0] != '\0' ? event->thread_name : "-",
-            event->function_name[0] != '\0' ? event->function_name : "-",
-            event->line_number,
-            event->message[0] != '\0' ? event->message : "-");
+            thread_name ? thread_name : "-",
+            function_name[0] != '\0' ? function_name : "-",
+            qlog_internal_get_event_line(event),
+            message[0] != '\0' ? message : "-");
+    fields = qlog_internal_get_event_fields(event, &fields_size);
+    if (fields){
+        len = strlen(buffer);
+        if (len + 2 < buffer_size){
+            buffer[len++] = ' ';
+            qlog_fields_format(fields, fields_size, buffer + len, buffer_size - 1 - len, qlog_display_fields_json);
+        }
+    }
+    if (event->suppressed){
+        len = strlen(buffer);
+        snprintf(buffer + len, buffer_size - 1 - len, " (%u suppressed)", (unsigned int) event->suppressed);
+    }
+    if (event->repeats){
+        qlog_display_format_timestamp(timestamp_str, sizeof(timestamp_str), &event->last_seen);
+        len = strlen(buffer);
+        snprintf(buffer + len, buffer_size - 1 - len, " (repeated %u times, last %s)",
+                (unsigned int) event->repeats, timestamp_str);
+    }
 }
 
 
 void qlog_display_event(FILE* stream, const qlog_event_t* event){
-    char buffer[256];
+    char buffer[512];
 
     memset(buffer, 0, sizeof(buffer));
     qlog_display_format_event_str(event, buffer, sizeof(buffer));
@@ -69,6 +101,9 @@ void qlog_display_event(FILE* stream, const qlog_event_t* event){
             event->ext_data_size > 0 && event->ext_print_cb){
         fprintf(stream, "\n");
         event->ext_print_cb(stream, event->ext_data, event->ext_data_size);
+        if (event->ext_orig_size > event->ext_data_size){
+            fprintf(stream, "\t(truncated, original size %lu bytes)\n", (unsigned long) event->ext_orig_size);
+        }
         fprintf(stream, "\n");
     }
 }
@@ -78,50 +113,71 @@ void qlog_display_print_buffer(FILE* stream){
     qlog_display_print_buffer_id(stream, 0);
 }
 
+static void qlog_display_event_cb(const qlog_event_t* event, void* data){
+    qlog_display_event((FILE*) data, event);
+}
+
 /*print a buffer with a specified id */
 void qlog_display_print_buffer_id(FILE* stream, qlog_buffer_id_t buffer_id){
-    qlog_event_t* event = NULL, *start = NULL;
     int res = 0;
-    int first = 1;
 
     qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
     if (stream && buffer){
+        qlog_symbol_refresh();
         res = qlog_lock_buffer_internal(buffer);
         if (res){
             return;
         }
+        qlog_walk_buffer_internal(buffer, qlog_display_event_cb, stream);
+        res = qlog_unlock_buffer_internal(buffer);
+    }
+}
 
-        if (buffer->wrapped != 0){
-            event = start = buffer->next_write;
-        } else {
-            event = start = buffer->head;
-        }
+typedef struct qlog_display_filter_ctx_t {
+    FILE* stream;
+    const qlog_fields_filter_t* filter;
+    unsigned int matched;
+} qlog_display_filter_ctx_t;
 
-        while (event){
-            if (event == start){
-                if (first == 1){
-                    first = 0;
-                    if (event->used == 1){
-                        qlog_display_event(stream, event);
-                        event = event->next;
-                    } else {
-                        event = NULL;
-                    }
-                } else {
-                    event = NULL;
-                }
-            } else {
-                if (event->used){
+static void qlog_display_filter_cb(const qlog_event_t* event, void* data){
+    qlog_display_filter_ctx_t* ctx = (qlog_display_filter_ctx_t*) data;
+    const void* fields = NULL;
+    size_t fields_size = 0;
 
-                    qlog_display_event(stream, event);
-                    event=event->next;
-                } else {
-                    event = NULL;
-                }
-            }
-        }
-        res = qlog_unlock_buffer_internal(buffer);
+    fields = qlog_internal_get_event_fields(event, &fields_size);
+    if (fields && qlog_fields_filter_match(ctx->filter, fields, fields_size)){
+        qlog_display_event(ctx->stream, event);
+        ctx->matched++;
+    }
+}
+
+/**
+ * \brief Print the events of a buffer matching a field condition
+ *
+ * \param stream The stream to print the events into
+ * \param buffer_id The id of the buffer
+ * \param expr The field condition, e.g. "latency_us > 500" (see qlog_fields_filter_parse)
+ * \return The number of the matching events, -1 if the condition is invalid
+ *          or the buffer does not exist
+ */
+int qlog_display_print_buffer_filter(FILE* stream, qlog_buffer_id_t buffer_id, const char* expr){
+    qlog_fields_filter_t filter;
+    qlog_display_filter_ctx_t ctx;
+    qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
+
+    if (stream == NULL || buffer == NULL || qlog_fields_filter_parse(expr, &filter) != QLOG_RET_OK){
+        return -1;
+    }
+    ctx.stream = stream;
+    ctx.filter = &filter;
+    ctx.matched = 0;
+    qlog_symbol_refresh();
+    if (qlog_lock_buffer_internal(buffer)){
+        return -1;
     }
+    qlog_walk_buffer_internal(buffer, qlog_display_filter_cb, &ctx);
+    qlog_unlock_buffer_internal(buffer);
+    return (int) ctx.matched;
 }
 
 
@@ -134,10 +190,234 @@ void qlog_display_print_buffer_id(FILE* stream, qlog_buffer_id_t buffer_id){
  */
 void qlog_display_print_buffer_list(FILE* stream){
     int i = 0;
+    qlog_buffer_t* buffer = NULL;
+    if (qlog_internal_is_lib_inited() && stream){
+        for (i = 0; i < qlog_internal_get_max_buf_num(); i++){
+            buffer = qlog_internal_get_buffer_by_id(i);
+            if (buffer && buffer->shards){
+                fprintf(stream, "Qlog log buffer #%d: initialized, per-CPU, %u shards of %lu events\n", i,
+                        buffer->shard_num, (unsigned long) (buffer->buffer_size / buffer->shard_num));
+            } else {
+                fprintf(stream, "Qlog log buffer #%d: %s\n", i, buffer ? "initialized" : "not initialized");
+            }
+        }
+    }
+}
+
+/**
+ * \brief Print the runtime statistics of the buffers
+ *
+ * \param stream The stream to print the statistics into
+ *
+ * Prints the throughput, wrap, drop and lock contention counters of all
+ * the initialized buffers.
+ */
+void qlog_display_print_buffer_stats(FILE* stream){
+    int i = 0;
+    qlog_stats_t stats;
+
     if (qlog_internal_is_lib_inited() && stream){
         for (i = 0; i < qlog_internal_get_max_buf_num(); i++){
-            fprintf(stream, "Qlog log buffer #%d: %s\n", i, qlog_internal_get_buffer_by_id(i) ? "initialized" : "not initialized");
+            if (qlog_get_stats(i, &stats) != QLOG_RET_OK){
+                continue;
+            }
+            fprintf(stream, "Qlog log buffer #%d:\n", i);
+            fprintf(stream, "  Period (sec)        : %.3f\n", stats.elapsed);
+            fprintf(stream, "  Deduplication       : %s\n", qlog_get_dedup(i) == 1 ? "on" : "off");
+            fprintf(stream, "  Frozen              : %s\n", qlog_is_frozen(i) == 1 ? "yes" : "no");
+            fprintf(stream, "  Events              : %lu (%.1f/sec)\n", stats.events, stats.events_per_sec);
+            fprintf(stream, "  Bytes               : %lu (%.1f/sec)\n", stats.bytes, stats.bytes_per_sec);
+            fprintf(stream, "  Ext payload bytes   : %lu\n", stats.ext_bytes);
+            fprintf(stream, "  Wraps               : %lu\n", stats.wraps);
+            fprintf(stream, "  Drops               : %lu\n", stats.drops);
+            fprintf(stream, "  Repeats folded      : %lu\n", stats.repeats);
+            fprintf(stream, "  Dropped while frozen: %lu\n", stats.frozen);
+            fprintf(stream, "  Lock contention     : %lu\n\n", stats.lock_contended);
+        }
+    }
+}
+
+/**
+ * \brief Print the call site table
+ *
+ * \param stream The stream to print the call sites into
+ * \param pattern Only the call sites matching this pattern are printed
+ *                (file:function:line, see qlog_site_match). NULL for all.
+ *
+ * Prints the call sites with their enabled state and hit counter.
+ */
+void qlog_display_print_sites(FILE* stream, const char* pattern){
+    static const char* level_names[] = {"ERROR", "WARNING", "INFO", "DEBUG", "TRACE"};
+    size_t i = 0;
+    qlog_site_t* site = NULL;
+
+    if (stream == NULL){
+        return;
+    }
+    for (i = 0; i < qlog_site_count(); i++){
+        site = qlog_site_get(i);
+        if (pattern && qlog_site_match(site, pattern) == 0){
+            continue;
+        }
+        fprintf(stream, "#%-4lu %s %s:%u %s() %s hits: %lu \"%s\"",
+                (unsigned long) i,
+                site->enabled ? "[on] " : "[off]",
+                site->file, site->line, site->function,
+                site->level <= QLOG_LEVEL_TRACE ? level_names[site->level] : "-",
+                qlog_site_get_hits(site),
+                site->message ? site->message : "");
+        if (site->sample_every > 1){
+            fprintf(stream, " sample: 1/%u", (unsigned int) site->sample_every);
+        }
+        if (site->rate > 0){
+            fprintf(stream, " rate: %u/s burst: %u", (unsigned int) site->rate, (unsigned int) site->burst);
+        }
+        fprintf(stream, "\n");
+    }
+}
+
+/**
+ * \brief Print the thread registry
+ *
+ * \param stream The stream to print the threads into
+ *
+ * Prints the registered threads with their OS thread id and CPU affinity
+ * and the thread names interned from the logging calls.
+ */
+void qlog_display_print_threads(FILE* stream){
+    const qlog_thread_info_t* info = NULL;
+    size_t id = 0, cpu = 0, first = 0;
+    int set = 0, in_range = 0, sep = 0;
+
+    if (stream == NULL){
+        return;
+    }
+    for (id = 1; id < qlog_thread_count(); id++){
+        info = qlog_thread_get(id);
+        if (info == NULL){
+            continue;
+        }
+        if (info->tid == 0){
+            fprintf(stream, "#%-4lu %-32s (name only)\n", (unsigned long) id, info->name);
+            continue;
+        }
+        fprintf(stream, "#%-4lu %-32s tid: %-8ld %s cpus: ", (unsigned long) id,
+                info->name, info->tid, info->exited ? "[exited] " : "[running]");
+        /* print the affinity as a list of CPU ranges */
+        in_range = 0;
+        sep = 0;
+        for (cpu = 0; cpu <= QLOG_THREAD_MAX_CPU; cpu++){
+            set = cpu < QLOG_THREAD_MAX_CPU &&
+                (info->affinity[cpu / QLOG_THREAD_CPU_BITS] & (1UL << (cpu % QLOG_THREAD_CPU_BITS)));
+            if (set && !in_range){
+                first = cpu;
+                in_range = 1;
+            } else if (!set && in_range){
+                fprintf(stream, sep ? ",%lu" : "%lu", (unsigned long) first);
+                if (cpu - 1 > first){
+                    fprintf(stream, "-%lu", (unsigned long) (cpu - 1));
+                }
+                in_range = 0;
+                sep = 1;
+            }
+        }
+        fprintf(stream, "\n");
+    }
+}
+
+/**
+ * \brief Print the latency summary of the functions
+ *
+ * \param stream The stream to print into
+ *
+ * Prints the functions measured by QLOG_ENTRY/QLOG_LEAVE, the durations
+ * are in microseconds.
+ */
+void qlog_display_print_latencies(FILE* stream){
+    qlog_latency_summary_t summary;
+    qlog_site_t* site = NULL;
+    size_t i = 0;
+
+    if (stream == NULL){
+        return;
+    }
+    fprintf(stream, "Latency measurement is %s.\n", qlog_latency_enabled ? "enabled" : "disabled");
+    fprintf(stream, "%-32s %10s %12s %12s %12s %12s %12s\n",
+            "function (us)", "count", "mean", "p50", "p99", "p99.9", "max");
+    for (i = 0; i < qlog_site_count(); i++){
+        site = qlog_site_get(i);
+        if ((site->flags & QLOG_SITE_ENTRY) == 0 ||
+                qlog_latency_get_summary(site, &summary) != QLOG_RET_OK){
+            continue;
+        }
+        fprintf(stream, "%-32.32s %10lu %12.3f %12.3f %12.3f %12.3f %12.3f\n",
+                site->function, summary.count,
+                summary.mean / 1000.0, summary.p50 / 1000.0, summary.p99 / 1000.0,
+                summary.p999 / 1000.0, summary.max / 1000.0);
+    }
+}
+
+/**
+ * \brief Print the metrics
+ *
+ * \param stream The stream to print the metrics into
+ *
+ * Prints the current value of the metrics (counter total, last gauge
+ * value), the gauge range in the last bucket and the most recent buckets
+ * (counter increase, last gauge value), oldest first.
+ */
+void qlog_display_print_metrics(FILE* stream){
+    qlog_metric_info_t info;
+    qlog_metric_id_t id = 0;
+    unsigned int i = 0;
+
+    if (stream == NULL){
+        return;
+    }
+    fprintf(stream, "%-32s %-8s %14s %12s %12s  %s\n", "Metric", "Type", "Value",
+            "Min", "Max", "Recent buckets");
+    for (id = 1; id < qlog_metric_count(); id++){
+        if (qlog_metric_get(id, &info) != QLOG_RET_OK){
+            continue;
         }
+        if (info.type == QLOG_METRIC_COUNTER){
+            fprintf(stream, "%-32.32s %-8s %14lld %12s %12s ", info.name, "counter",
+                    (long long) info.value, "-", "-");
+        } else {
+            fprintf(stream, "%-32.32s %-8s %14lld %12lld %12lld ", info.name, "gauge",
+                    (long long) info.value, (long long) info.min, (long long) info.max);
+        }
+        for (i = info.history_num > 10 ? info.history_num - 10 : 0; i < info.history_num; i++){
+            fprintf(stream, " %lld", (long long) info.history[i]);
+        }
+        fprintf(stream, "\n");
+    }
+}
+
+/**
+ * \brief Print the snapshot list
+ *
+ * \param stream The stream to print the list into
+ *
+ * Prints the buffer, the time, the number of the events and the trigger of
+ * the snapshots taken (see qlog_trigger.h).
+ */
+void qlog_display_print_snapshots(FILE* stream){
+    qlog_snapshot_info_t info;
+    char timestamp_str[30];
+    size_t i = 0;
+
+    if (stream == NULL){
+        return;
+    }
+    fprintf(stream, "%-4s %-6s %-26s %6s  %s\n", "#", "Buffer", "Time", "Events", "Trigger");
+    for (i = 0; qlog_snapshot_get_info(i, &info) == QLOG_RET_OK; i++){
+        qlog_display_format_timestamp(timestamp_str, sizeof(timestamp_str), &info.timestamp);
+        fprintf(stream, "%-4lu %-6d %-26s %6lu  %s\n", (unsigned long) i, info.buffer_id,
+                timestamp_str, (unsigned long) info.event_num, info.reason);
+    }
+    if (qlog_snapshot_get_missed() > 0){
+        fprintf(stream, "%lu trigger(s) missed, no free snapshot slot.\n", qlog_snapshot_get_missed());
     }
 }
 
@@ -148,3 +428,8 @@ void qlog_display_enable_indention(void){
 void qlog_display_disable_indention(void){
     qlog_display_indention_enabled = 0;
 }
+
+/* the fields of the events are printed as JSON instead of key=value pairs */
+void qlog_display_set_fields_json(int enabled){
+    qlog_display_fields_json = enabled ? 1 : 0;
+}
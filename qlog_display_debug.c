@@ -4,17 +4,75 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <sys/time.h>
 #include <pthread.h>
 #include "qlog.h"
 #include "qlog_internal.h"
 #include "qlog_display.h"
 #include "qlog_display_debug.h"
+#include "qlog_thread.h"
+#include "qlog_instr.h"
+#include "qlog_symbol.h"
 
 
 extern qlog_buffer_t* qlog_buffers[];
 extern int qlog_lib_inited;
 
+/* prints all the slots of the ring (of every shard of a per-CPU buffer) */
+static void qlog_display_debug_print_ring(FILE* stream, const qlog_buffer_t* buffer){
+    int start = 1;
+    unsigned int i = 0;
+    qlog_event_t* event = NULL;
+
+    if (buffer->shards){
+        for (i = 0; i < buffer->shard_num; i++){
+            fprintf(stream, "Shard #%u:\n", i);
+            qlog_display_debug_print_ring(stream, buffer->shards[i]);
+        }
+        return;
+    }
+    event = buffer->head;
+    while(event){
+        if (event == buffer->head){
+            if (start == 1){
+                start = 0;
+                qlog_display_event(stream, event);
+                event = event->next;
+            } else {
+                event = NULL;
+            }
+        } else {
+            qlog_display_event(stream, event);
+            event = event->next;
+        }
+    }
+}
+
+
+/* prints the memory region of the ring (or of every shard) */
+static void qlog_display_debug_print_region(FILE* stream, const qlog_buffer_t* buffer, const char* label){
+    const qlog_ring_region_t* region = NULL;
+    char shard_label[32];
+    unsigned int i = 0;
+
+    if (buffer->shards){
+        for (i = 0; i < buffer->shard_num; i++){
+            snprintf(shard_label, sizeof(shard_label), "Shard #%u memory", i);
+            qlog_display_debug_print_region(stream, buffer->shards[i], shard_label);
+        }
+        return;
+    }
+    region = QLOG_RING_REGION(buffer->head);
+    fprintf(stream, "  %-20s: %lu bytes at %p%s%s", label, (unsigned long) region->length,
+            (void*) region, (region->flags & QLOG_BUFFER_HUGEPAGES) ? ", huge pages" : "",
+            (region->flags & QLOG_BUFFER_MLOCK) ? ", locked" : "");
+    if (region->numa_node >= 0){
+        fprintf(stream, ", NUMA node %d", region->numa_node);
+    }
+    fprintf(stream, "\n");
+}
+
 
 /**
  * \brief Print the content of a buffer to a stream
@@ -27,31 +85,16 @@ extern int qlog_lib_inited;
  */
 void qlog_display_debug_print_buffer_id(FILE* stream, qlog_buffer_id_t buffer_id){
     int res = 0;
-    int start = 1;
-    qlog_event_t* event = NULL;
     qlog_buffer_t* buffer = NULL;
 
     buffer = qlog_internal_get_buffer_by_id(buffer_id);
     if (buffer){
+        qlog_symbol_refresh();
         res = qlog_lock_buffer_internal(buffer);
         if (res){
             return;
         }
-        event = buffer->head;
-        while(event){
-            if (event == buffer->head){
-                if (start == 1){
-                    start = 0;
-                    qlog_display_event(stream, event);
-                    event = event->next;
-                } else {
-                    event = NULL;
-                }
-            } else {
-                qlog_display_event(stream, event);
-                event = event->next;
-            }
-        }
+        qlog_display_debug_print_ring(stream, buffer);
 
         res = qlog_unlock_buffer_internal(buffer);
     } else {
@@ -74,10 +117,9 @@ void qlog_display_debug_print_buffer_id(FILE* stream, qlog_buffer_id_t buffer_id
  */
 void qlog_display_debug_print_all_buffers(FILE* stream, int print_status, int print_events){
     int i = 0;
-    int start = 1;
-    qlog_event_t* event = NULL;
     qlog_buffer_t* buffer = NULL;
     if (qlog_lib_inited){
+        qlog_symbol_refresh();
         for (i = 0; i < qlog_internal_get_max_buf_num(); i++){
             fprintf(stream, "Buffer index: %d\n", i);
             buffer = qlog_internal_get_buffer_by_id(i);
@@ -90,27 +132,14 @@ void qlog_display_debug_print_all_buffers(FILE* stream, int print_status, int pr
                     fprintf(stream, "  Buffer head         : %p\n", (void*) buffer->head);
                     fprintf(stream, "  Buffer next         : %p\n", (void*) buffer->next_write);
                     fprintf(stream, "  Buffer size         : %u\n", (unsigned int) buffer->buffer_size);
-                    fprintf(stream, "  Buffer wrapped      : %d\n", buffer->wrapped);
-                    fprintf(stream, "  Buffer event locked : %d\n\n", buffer->event_locked);
+                    fprintf(stream, "  Buffer wrapped      : %lu\n", qlog_get_wraps_internal(buffer));
+                    fprintf(stream, "  Buffer event locked : %d\n", buffer->event_locked);
+                    qlog_display_debug_print_region(stream, buffer, "Buffer memory");
+                    fprintf(stream, "\n");
                 }
                 if (print_events) {
                     fprintf(stream, "Log messages:\n");
-                    event = buffer->head;
-                    start = 1;
-                    while(event){
-                        if (event == buffer->head){
-                            if (start == 1){
-                                start = 0;
-                                qlog_display_event(stream, event);
-                                event = event->next;
-                            } else {
-                                event = NULL;
-                            }
-                        } else {
-                            qlog_display_event(stream, event);
-                            event = event->next;
-                        }
-                    }
+                    qlog_display_debug_print_ring(stream, buffer);
                 }
                 qlog_unlock_buffer_internal(buffer);
             }
@@ -120,3 +149,70 @@ void qlog_display_debug_print_all_buffers(FILE* stream, int print_status, int pr
     }
 }
 
+
+
+#ifdef QLOG_SELF_INSTR
+/* prints the counters of a thread, the lock wait is the time of the contended acquisitions */
+static void qlog_display_debug_print_instr_row(FILE* stream, const qlog_instr_counter_t* counters){
+    const qlog_instr_counter_t* counter = NULL;
+    int i = 0;
+
+    for (i = 0; i < QLOG_INSTR_NUM; i++){
+        counter = &counters[i];
+        if (i == QLOG_INSTR_LOCK || i == QLOG_INSTR_GLOBAL_LOCK){
+            fprintf(stream, "  %-16s: %llu acquired, %llu contended, %llu spins, %llu ns waiting\n",
+                    qlog_instr_get_name(i), (unsigned long long) counter->calls,
+                    (unsigned long long) counter->contended, (unsigned long long) counter->spins,
+                    (unsigned long long) counter->ns);
+        } else {
+            fprintf(stream, "  %-16s: %llu calls, %llu ns (%llu ns/call)\n",
+                    qlog_instr_get_name(i), (unsigned long long) counter->calls,
+                    (unsigned long long) counter->ns,
+                    (unsigned long long) (counter->calls ? counter->ns / counter->calls : 0));
+        }
+    }
+}
+#endif
+
+
+/**
+ * \brief Print the self instrumentation counters into a stream
+ *
+ * \param stream The stream into which the counters are printed
+ *
+ * Prints the hot path counters of every instrumented thread and their
+ * total (see qlog_instr.h). The library has to be built with the
+ * QLOG_SELF_INSTR option.
+ */
+void qlog_display_debug_print_instr(FILE* stream){
+#ifdef QLOG_SELF_INSTR
+    qlog_instr_thread_stats_t stats[QLOG_INSTR_MAX_THREAD_NUM];
+    qlog_instr_counter_t total[QLOG_INSTR_NUM];
+    size_t num = 0, i = 0;
+    int j = 0;
+
+    memset(total, 0, sizeof(total));
+    num = qlog_instr_get(stats, QLOG_INSTR_MAX_THREAD_NUM);
+    for (i = 0; i < num; i++){
+        if (stats[i].exited){
+            fprintf(stream, "Exited threads:\n");
+        } else if (stats[i].thread_id != QLOG_THREAD_ID_NONE){
+            fprintf(stream, "Thread %s (%u):\n", qlog_thread_get_name(stats[i].thread_id),
+                    (unsigned int) stats[i].thread_id);
+        } else {
+            fprintf(stream, "Unregistered thread:\n");
+        }
+        qlog_display_debug_print_instr_row(stream, stats[i].counters);
+        for (j = 0; j < QLOG_INSTR_NUM; j++){
+            total[j].calls += stats[i].counters[j].calls;
+            total[j].ns += stats[i].counters[j].ns;
+            total[j].contended += stats[i].counters[j].contended;
+            total[j].spins += stats[i].counters[j].spins;
+        }
+    }
+    fprintf(stream, "Total:\n");
+    qlog_display_debug_print_instr_row(stream, total);
+#else
+    fprintf(stream, "The self instrumentation is not built in (QLOG_SELF_INSTR)\n");
+#endif
+}
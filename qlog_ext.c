@@ -51,6 +51,14 @@ int qlog_ext_register_built_in_events(void){
         qlog_ext_events.events[qlog_ext_events.index].print_callback = qlog_ext_display_hex_dump;
         qlog_ext_events.index++;
 
+        qlog_ext_events.events[qlog_ext_events.index].event_type = QLOG_EXT_EVENT_TYPE_STACK;
+        qlog_ext_events.events[qlog_ext_events.index].print_callback = qlog_ext_display_stack;
+        qlog_ext_events.index++;
+
+        qlog_ext_events.events[qlog_ext_events.index].event_type = QLOG_EXT_EVENT_TYPE_FTRACE;
+        qlog_ext_events.events[qlog_ext_events.index].print_callback = qlog_ext_display_ftrace;
+        qlog_ext_events.index++;
+
         spin_res = pthread_spin_unlock(&qlog_ext_events.lock);
         if (spin_res == 0){
             ret = QLOG_RET_OK;
@@ -128,7 +136,6 @@ int qlog_ext_log_long_id(qlog_buffer_id_t buffer_id,
         int line_number,
         const char* message)
 {
-    const char *thread_name_p = NULL;
     int res = QLOG_RET_ERR;
     qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
 
@@ -138,15 +145,101 @@ int qlog_ext_log_long_id(qlog_buffer_id_t buffer_id,
             && qlog_ext_event_type_is_valid(event_type)
             && buffer != NULL)
     {
-        if (thread_name == NULL) {
-            if (qlog_internal_get_thread_name()[0] != '0'){
-                thread_name_p = qlog_internal_get_thread_name();
-            }
-        } else {
-            thread_name_p = thread_name;
+        res = qlog_log_internal(buffer, NULL,
+                thread_name ? qlog_thread_intern(thread_name) : qlog_thread_self_id, function_name, line_number, message, ext_data, data_size, event_type);
+    }
+    return res;
+}
+
+/**
+ * \brief Logs an external event of a call site to the default log buffer
+ *
+ * \param site The call site descriptor (see QLOG_SITE_DEFINE)
+ * \param event_type The external event type
+ * \param ext_data The external data to be copied into the event
+ * \param data_size The size of the external data
+ * \param message The log message string. If NULL the literal message of the
+ *                call site is used.
+ * \return 0 if success, -1 in case of any error
+ */
+int qlog_ext_log_site(qlog_site_t* site,
+        qlog_ext_event_type_t event_type,
+        void* ext_data,
+        size_t data_size,
+        const char* message)
+{
+    int res = QLOG_RET_ERR;
+    qlog_buffer_t* buffer = qlog_internal_get_default_buf();
+
+    if (qlog_internal_is_lib_inited()
+            && qlog_internal_is_logging_enabled()
+            && qlog_ext_events.initialized == 1
+            && qlog_ext_event_type_is_valid(event_type)
+            && buffer != NULL
+            && site != NULL)
+    {
+        res = qlog_log_internal(buffer, site, qlog_thread_self_id, NULL, 0, message, ext_data, data_size, event_type);
+        if (res == QLOG_RET_OK){
+            qlog_site_hit(site);
         }
+    }
+    return res;
+}
+
+/**
+ * \brief Logs an external event with scattered data to the default log buffer
+ *
+ * \param event_type The external event type
+ * \param iov The fragments of the external data (e.g. header and body)
+ * \param iovcnt The number of the fragments
+ * \param max_size The external data is truncated to this size, 0 for no limit.
+ *                 The original size is kept in the event.
+ * \param message The log message string
+ * \return 0 if success, -1 in case of any error
+ *
+ * The fragments are copied directly into the event, there is no need to
+ * concatenate them into a temporary buffer.
+ */
+int qlog_ext_logv(qlog_ext_event_type_t event_type,
+        const struct iovec* iov,
+        int iovcnt,
+        size_t max_size,
+        const char* message)
+{
+    return qlog_ext_logv_id(qlog_internal_get_default_buf_id(),
+            event_type, iov, iovcnt, max_size, message);
+}
+
+/**
+ * \brief Logs an external event with scattered data to a buffer with a specified id
+ *
+ * \param buffer_id The id of the buffer into the event will be put
+ * \param event_type The external event type
+ * \param iov The fragments of the external data
+ * \param iovcnt The number of the fragments
+ * \param max_size The external data is truncated to this size, 0 for no limit
+ * \param message The log message string
+ * \return 0 if success, -1 in case of any error
+ */
+int qlog_ext_logv_id(qlog_buffer_id_t buffer_id,
+        qlog_ext_event_type_t event_type,
+        const struct iovec* iov,
+        int iovcnt,
+        size_t max_size,
+        const char* message)
+{
+    int res = QLOG_RET_ERR;
+    qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
 
-        res = qlog_log_internal(buffer, thread_name_p, function_name, line_number, message, ext_data, data_size, event_type);
+    if (qlog_internal_is_lib_inited()
+            && qlog_internal_is_logging_enabled()
+            && qlog_ext_events.initialized == 1
+            && qlog_ext_event_type_is_valid(event_type)
+            && buffer != NULL
+            && iov != NULL && iovcnt > 0)
+    {
+        res = qlog_logv_internal(buffer, NULL, qlog_thread_self_id, NULL, 0, message,
+                iov, iovcnt, max_size, event_type);
     }
     return res;
 }
@@ -156,6 +249,13 @@ qlog_ext_print_cb_t qlog_ext_get_print_cb(qlog_ext_event_type_t ext_event_type){
     int spin_res = 0;
     int i = 0;
 
+    /* the built-in events are registered first in type order and never
+     * change, they are looked up without locking (e.g. function tracing) */
+    if (ext_event_type > QLOG_EXT_EVENT_TYPE_NONE && ext_event_type <= QLOG_EXT_EVENT_TYPE_LAST
+            && qlog_ext_events.initialized){
+        return qlog_ext_events.events[ext_event_type - 1].print_callback;
+    }
+
     spin_res = pthread_spin_lock(&qlog_ext_events.lock);
     if (spin_res == 0){
 
@@ -2,65 +2,257 @@
 #include <string.h>
 #include <execinfo.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include "qlog_stack.h"
+#include "qlog_symbol.h"
+#include "qlog_ftrace.h"
 
 
+/*
+ * Hex dump rendering.
+ *
+ * The bytes are converted to hex digits 16 (SSE2) or 32 (AVX2, selected at
+ * runtime) at a time and whole rows are rendered into a large output
+ * buffer which is written to the stream in one go. The scalar code is used
+ * for the tail and on the other architectures.
+ *
+ * Full format (16 bytes per row):
+ *  +0010   41 42 43 ...                                      ABC...
+ * Compact format (32 bytes per row, no ASCII column):
+ *  +0020   414243...
+ */
+#define QLOG_HEX_ROW_SIZE           16
+#define QLOG_HEX_COMPACT_ROW_SIZE   32
+#define QLOG_HEX_ROW_MAX_LEN        128
+#define QLOG_HEX_OUT_BUF_SIZE       8192
+
+static int qlog_ext_hex_compact = 0;
+static const char qlog_hex_digits[] = "0123456789abcdef";
+
+static void qlog_hex_encode_scalar(char* out, const unsigned char* in, size_t size){
+    size_t i = 0;
+    for (i = 0; i < size; i++){
+        out[2 * i] = qlog_hex_digits[in[i] >> 4];
+        out[2 * i + 1] = qlog_hex_digits[in[i] & 0x0f];
+    }
+}
+
+static void qlog_ascii_encode_scalar(char* out, const unsigned char* in, size_t size){
+    size_t i = 0;
+    for (i = 0; i < size; i++){
+        out[i] = (in[i] > 31 && in[i] < 127) ? (char) in[i] : '.';
+    }
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/* nibble -> '0'..'9', 'a'..'f': add '0' and 39 more above 9 */
+static inline __m128i qlog_hex_nibble_sse2(__m128i nibble){
+    __m128i above_9 = _mm_cmpgt_epi8(nibble, _mm_set1_epi8(9));
+    return _mm_add_epi8(_mm_add_epi8(nibble, _mm_set1_epi8('0')),
+                        _mm_and_si128(above_9, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+static void qlog_hex_encode_16(char* out, const unsigned char* in){
+    __m128i data = _mm_loadu_si128((const __m128i*) in);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i high = qlog_hex_nibble_sse2(_mm_and_si128(_mm_srli_epi16(data, 4), mask));
+    __m128i low = qlog_hex_nibble_sse2(_mm_and_si128(data, mask));
+    _mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128((__m128i*) (out + 16), _mm_unpackhi_epi8(high, low));
+}
+
+static void qlog_ascii_encode_16(char* out, const unsigned char* in){
+    __m128i data = _mm_loadu_si128((const __m128i*) in);
+    /* signed compare: the bytes above 127 are negative, not printable */
+    __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(data, _mm_set1_epi8(31)),
+                                      _mm_cmplt_epi8(data, _mm_set1_epi8(127)));
+    _mm_storeu_si128((__m128i*) out,
+            _mm_or_si128(_mm_and_si128(printable, data),
+                         _mm_andnot_si128(printable, _mm_set1_epi8('.'))));
+}
+#else
+static void qlog_hex_encode_16(char* out, const unsigned char* in){
+    qlog_hex_encode_scalar(out, in, 16);
+}
+
+static void qlog_ascii_encode_16(char* out, const unsigned char* in){
+    qlog_ascii_encode_scalar(out, in, 16);
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define QLOG_HEX_HAVE_AVX2
+
+__attribute__ ((target ("avx2")))
+static void qlog_hex_encode_32_avx2(char* out, const unsigned char* in){
+    __m256i data = _mm256_loadu_si256((const __m256i*) in);
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i nine = _mm256_set1_epi8(9);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(data, 4), mask);
+    __m256i low = _mm256_and_si256(data, mask);
+    __m256i first, second;
+
+    high = _mm256_add_epi8(_mm256_add_epi8(high, _mm256_set1_epi8('0')),
+            _mm256_and_si256(_mm256_cmpgt_epi8(high, nine), _mm256_set1_epi8('a' - '0' - 10)));
+    low = _mm256_add_epi8(_mm256_add_epi8(low, _mm256_set1_epi8('0')),
+            _mm256_and_si256(_mm256_cmpgt_epi8(low, nine), _mm256_set1_epi8('a' - '0' - 10)));
+    /* the unpack works per 128 bit lane, put the lanes in order */
+    first = _mm256_unpacklo_epi8(high, low);
+    second = _mm256_unpackhi_epi8(high, low);
+    _mm256_storeu_si256((__m256i*) out, _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i*) (out + 32), _mm256_permute2x128_si256(first, second, 0x31));
+}
+#endif
+
+/* converts the bytes to 2 * size hex digits */
+static void qlog_hex_encode(char* out, const unsigned char* in, size_t size){
+    size_t i = 0;
+#ifdef QLOG_HEX_HAVE_AVX2
+    static int has_avx2 = -1;
+    if (has_avx2 < 0){
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    if (has_avx2){
+        for (; i + 32 <= size; i += 32){
+            qlog_hex_encode_32_avx2(out + 2 * i, in + i);
+        }
+    }
+#endif
+    for (; i + 16 <= size; i += 16){
+        qlog_hex_encode_16(out + 2 * i, in + i);
+    }
+    qlog_hex_encode_scalar(out + 2 * i, in + i, size - i);
+}
+
+/* renders the row offset field: "+%04x" padded to 8 characters */
+static size_t qlog_hex_put_offset(char* out, size_t offset){
+    size_t digits = 4, i = 0;
+
+    while (digits < 7 && (offset >> (4 * digits)) != 0){
+        digits++;
+    }
+    memset(out, ' ', 8);
+    out[0] = '+';
+    for (i = 0; i < digits; i++){
+        out[digits - i] = qlog_hex_digits[(offset >> (4 * i)) & 0x0f];
+    }
+    return 8;
+}
+
+/* renders a full format row, returns the length */
+static size_t qlog_hex_render_row(char* out, const unsigned char* data, size_t size, size_t offset){
+    char hex[2 * QLOG_HEX_ROW_SIZE];
+    char* ascii = out + 1 + 8 + 3 * QLOG_HEX_ROW_SIZE + 2;
+    size_t i = 0;
+
+    out[0] = '\t';
+    qlog_hex_put_offset(out + 1, offset);
+    memset(out + 9, ' ', 3 * QLOG_HEX_ROW_SIZE + 2 + QLOG_HEX_ROW_SIZE);
+    if (size == QLOG_HEX_ROW_SIZE){
+        qlog_hex_encode_16(hex, data);
+        qlog_ascii_encode_16(ascii, data);
+    } else {
+        qlog_hex_encode_scalar(hex, data, size);
+        qlog_ascii_encode_scalar(ascii, data, size);
+    }
+    for (i = 0; i < size; i++){
+        out[9 + 3 * i] = hex[2 * i];
+        out[9 + 3 * i + 1] = hex[2 * i + 1];
+    }
+    ascii[QLOG_HEX_ROW_SIZE] = '\n';
+    return ascii + QLOG_HEX_ROW_SIZE + 1 - out;
+}
+
+/* renders a compact format row, returns the length */
+static size_t qlog_hex_render_compact_row(char* out, const unsigned char* data, size_t size, size_t offset){
+    out[0] = '\t';
+    qlog_hex_put_offset(out + 1, offset);
+    qlog_hex_encode(out + 9, data, size);
+    out[9 + 2 * size] = '\n';
+    return 9 + 2 * size + 1;
+}
+
 void qlog_ext_display_hex_dump(FILE* stream, void* datap, size_t size){
-    unsigned int i = 0, j = 0;
-    char temp[8] = {0};
-    char buffer[128] = {0};
-    char *ascii;
-    char* data = (char*)datap;
+    char out[QLOG_HEX_OUT_BUF_SIZE];
+    const unsigned char* data = (const unsigned char*) datap;
+    size_t row_size = qlog_ext_hex_compact ? QLOG_HEX_COMPACT_ROW_SIZE : QLOG_HEX_ROW_SIZE;
+    size_t i = 0, len = 0, chunk = 0;
 
-    memset(buffer, 0, sizeof(buffer));
     fprintf(stream, "\tHexdump of %lu bytes:\n", size);
-    fprintf(stream, "\t        +0          +4          +8          +c            0   4   8   c   \n");
-    fprintf(stream, "\t        ------------------------------------------------  ----------------\n");
-
-    ascii = buffer + 58; 
-    memset(buffer, ' ', 58 + 16);
-    buffer[58 + 16] = '\n';
-    buffer[58 + 17] = '\0';
-    buffer[0] = '+';
-    buffer[1] = '0';
-    buffer[2] = '0';
-    buffer[3] = '0';
-    buffer[4] = '0';
-    for (i = 0, j = 0; i < size; i++, j++) {
-        if (j == 16) {
-            fprintf(stream, "\t%s", buffer);
-            memset(buffer, ' ', 58 + 16);
-            sprintf(temp, "+%04x", i); 
-            memcpy(buffer, temp, 5); 
-            j = 0;
-        }
+    if (qlog_ext_hex_compact == 0){
+        fprintf(stream, "\t        +0          +4          +8          +c            0   4   8   c   \n");
+        fprintf(stream, "\t        ------------------------------------------------  ----------------\n");
+    }
 
-        sprintf(temp, "%02x", 0xff & data[i]);
-        memcpy(buffer + 8 + (j * 3), temp, 2); 
-        if ((data[i] > 31) && (data[i] < 127)){
-            ascii[j] = data[i];
-        } else{
-            ascii[j] = '.';
+    for (i = 0; i < size; i += row_size){
+        if (len + QLOG_HEX_ROW_MAX_LEN > sizeof(out)){
+            fwrite(out, 1, len, stream);
+            len = 0;
+        }
+        chunk = size - i < row_size ? size - i : row_size;
+        if (qlog_ext_hex_compact){
+            len += qlog_hex_render_compact_row(out + len, data + i, chunk, i);
+        } else {
+            len += qlog_hex_render_row(out + len, data + i, chunk, i);
         }
-    }   
+    }
+    fwrite(out, 1, len, stream);
+}
+
+void qlog_ext_enable_compact_hex(void){
+    qlog_ext_hex_compact = 1;
+}
 
-    if (j != 0) {
-        fprintf(stream, "\t%s", buffer);
-    }   
+void qlog_ext_disable_compact_hex(void){
+    qlog_ext_hex_compact = 0;
 }
 
 
+/* the frames are resolved by the symbol cache (see qlog_symbol_resolve) */
 void qlog_ext_display_bt(FILE* stream, void* data, size_t size){
     size_t i;
-    char **strings;
+    char symbol[QLOG_SYMBOL_STR_SIZE];
     size_t num_of_stacks = size / sizeof(void*);
     void** bt = (void**)data;
 
-    strings = backtrace_symbols(bt, num_of_stacks);
-
     for (i = 0; i < num_of_stacks; i++){
-        fprintf(stream, "\tframe#%-3lu: %s\n", i, strings[i]);
+        qlog_symbol_resolve(bt[i], symbol, sizeof(symbol));
+        fprintf(stream, "\tframe#%-3lu: %s\n", i, symbol);
     }
+}
+
 
-    free (strings);
+
+void qlog_ext_display_stack(FILE* stream, void* data, size_t size){
+    qlog_stack_id_t id = QLOG_STACK_ID_NONE;
+    const qlog_stack_t* stack = NULL;
+
+    if (size == sizeof(id)){
+        memcpy(&id, data, sizeof(id));
+        stack = qlog_stack_get(id);
+    }
+    if (stack == NULL){
+        fprintf(stream, "\t<stack not stored>\n");
+        return;
+    }
+    fprintf(stream, "\tstack#%u:\n", (unsigned int) id);
+    qlog_ext_display_bt(stream, (void*) stack->frames, stack->depth * sizeof(void*));
 }
 
+void qlog_ext_display_ftrace(FILE* stream, void* data, size_t size){
+    qlog_ftrace_record_t record;
+    char symbol[QLOG_SYMBOL_STR_SIZE];
+
+    if (size != sizeof(record)){
+        fprintf(stream, "\t<invalid trace record>\n");
+        return;
+    }
+    memcpy(&record, data, sizeof(record));
+    qlog_symbol_resolve(record.function, symbol, sizeof(symbol));
+    fprintf(stream, "\tfunction : %s\n", symbol);
+    qlog_symbol_resolve(record.call_site, symbol, sizeof(symbol));
+    fprintf(stream, "\tcall site: %s\n", symbol);
+}
@@ -0,0 +1,561 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_fields.c
+ * \brief Typed key/value fields of the log events.
+ *
+ * The fields are encoded into a stack buffer first (only the fields fitting
+ * completely are kept), the event is locked only for copying the text
+ * message and the encoded fields into it.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_fields.h"
+
+/* zigzag varint: the small negative numbers are short too */
+static size_t qlog_fields_put_varint(unsigned char* out, size_t size, int64_t value){
+    uint64_t v = ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+    size_t len = 0;
+
+    do {
+        if (len >= size){
+            return 0;
+        }
+        out[len++] = (unsigned char) ((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+        v >>= 7;
+    } while (v);
+    return len;
+}
+
+static size_t qlog_fields_get_varint(const unsigned char* in, size_t size, int64_t* value){
+    uint64_t v = 0;
+    size_t len = 0;
+
+    while (len < size && len < 10){
+        v |= (uint64_t) (in[len] & 0x7f) << (7 * len);
+        if ((in[len++] & 0x80) == 0){
+            *value = (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+            return len;
+        }
+    }
+    return 0;
+}
+
+/* copies a string with its terminating zero, truncated to max_len */
+static size_t qlog_fields_put_str(unsigned char* out, size_t size, const char* str, size_t max_len){
+    size_t len = strnlen(str ? str : "", max_len);
+
+    if (len + 1 > size){
+        return 0;
+    }
+    memcpy(out, str ? str : "", len);
+    out[len] = '\0';
+    return len + 1;
+}
+
+/**
+ * \brief Encodes fields into a buffer
+ *
+ * \param out The output buffer
+ * \param size The size of the output buffer
+ * \param fields The fields to be encoded
+ * \param field_num The number of the fields
+ * \return The number of bytes used
+ *
+ * The fields not fitting completely into the buffer (and the ones with
+ * unknown type) are dropped.
+ */
+size_t qlog_fields_encode(void* out, size_t size, const qlog_field_t* fields, size_t field_num){
+    unsigned char* data = (unsigned char*) out;
+    size_t used = 0, len = 0, part = 0, i = 0;
+
+    for (i = 0; fields && i < field_num; i++){
+        if (fields[i].key == NULL || size - used < 2){
+            continue;
+        }
+        len = 1;
+        part = qlog_fields_put_str(data + used + len, size - used - len, fields[i].key, QLOG_FIELD_KEY_MAX_LEN);
+        if (part == 0){
+            continue;
+        }
+        len += part;
+        switch (fields[i].type){
+            case QLOG_FIELD_INT:
+            case QLOG_FIELD_DURATION:
+                part = qlog_fields_put_varint(data + used + len, size - used - len, fields[i].value.i);
+                break;
+            case QLOG_FIELD_DOUBLE:
+                part = size - used - len >= sizeof(double) ? sizeof(double) : 0;
+                if (part){
+                    memcpy(data + used + len, &fields[i].value.d, sizeof(double));
+                }
+                break;
+            case QLOG_FIELD_BOOL:
+                part = size - used - len >= 1 ? 1 : 0;
+                if (part){
+                    data[used + len] = fields[i].value.i ? 1 : 0;
+                }
+                break;
+            case QLOG_FIELD_STR:
+                part = qlog_fields_put_str(data + used + len, size - used - len, fields[i].value.s, QLOG_FIELD_STR_MAX_LEN);
+                break;
+            default:
+                part = 0;
+                break;
+        }
+        if (part == 0){
+            continue;
+        }
+        data[used] = fields[i].type;
+        used += len + part;
+    }
+    return used;
+}
+
+/**
+ * \brief Decodes the next field
+ *
+ * \param data The encoded fields
+ * \param size The size of the encoded fields
+ * \param offset Position of the next field, 0 for the first one. Advanced
+ *               past the decoded field.
+ * \param field The decoded field. The key and the string value point into data.
+ * \return QLOG_RET_OK if a field has been decoded, QLOG_RET_ERR at the end
+ */
+int qlog_fields_decode(const void* data, size_t size, size_t* offset, qlog_field_t* field){
+    const unsigned char* in = (const unsigned char*) data;
+    size_t pos = *offset, len = 0;
+    const unsigned char* end = NULL;
+
+    if (in == NULL || pos + 2 > size){
+        return QLOG_RET_ERR;
+    }
+    field->type = in[pos++];
+    end = memchr(in + pos, '\0', size - pos);
+    if (end == NULL){
+        return QLOG_RET_ERR;
+    }
+    field->key = (const char*) in + pos;
+    pos = end - in + 1;
+
+    switch (field->type){
+        case QLOG_FIELD_INT:
+        case QLOG_FIELD_DURATION:
+            len = qlog_fields_get_varint(in + pos, size - pos, &field->value.i);
+            break;
+        case QLOG_FIELD_DOUBLE:
+            len = size - pos >= sizeof(double) ? sizeof(double) : 0;
+            if (len){
+                memcpy(&field->value.d, in + pos, sizeof(double));
+            }
+            break;
+        case QLOG_FIELD_BOOL:
+            len = size - pos >= 1 ? 1 : 0;
+            if (len){
+                field->value.i = in[pos];
+            }
+            break;
+        case QLOG_FIELD_STR:
+            end = memchr(in + pos, '\0', size - pos);
+            if (end){
+                field->value.s = (const char*) in + pos;
+                len = end - (in + pos) + 1;
+            }
+            break;
+        default:
+            len = 0;
+            break;
+    }
+    if (len == 0){
+        return QLOG_RET_ERR;
+    }
+    *offset = pos + len;
+    return QLOG_RET_OK;
+}
+
+/* appends to a fixed size buffer, the output is truncated if needed */
+static void qlog_fields_append(char* out, size_t out_size, size_t* len, const char* format, ...)
+    __attribute__ ((format (printf, 4, 5)));
+
+static void qlog_fields_append(char* out, size_t out_size, size_t* len, const char* format, ...){
+    va_list args;
+    int res = 0;
+
+    if (*len + 1 >= out_size){
+        return;
+    }
+    va_start(args, format);
+    res = vsnprintf(out + *len, out_size - *len, format, args);
+    va_end(args);
+    if (res > 0){
+        *len += (size_t) res < out_size - *len ? (size_t) res : out_size - *len - 1;
+    }
+}
+
+/* a JSON string literal, or a quoted string if it contains separators */
+static void qlog_fields_append_str(char* out, size_t out_size, size_t* len, const char* str, int json){
+    const unsigned char* c = (const unsigned char*) str;
+
+    if (!json && str[0] != '\0' && strpbrk(str, " \t\"=") == NULL){
+        qlog_fields_append(out, out_size, len, "%s", str);
+        return;
+    }
+    qlog_fields_append(out, out_size, len, "\"");
+    for (; *c; c++){
+        if (*c == '"' || *c == '\\'){
+            qlog_fields_append(out, out_size, len, "\\%c", *c);
+        } else if (*c < 0x20){
+            qlog_fields_append(out, out_size, len, "\\u%04x", *c);
+        } else {
+            qlog_fields_append(out, out_size, len, "%c", *c);
+        }
+    }
+    qlog_fields_append(out, out_size, len, "\"");
+}
+
+static void qlog_fields_append_duration(char* out, size_t out_size, size_t* len, int64_t ns){
+    int64_t abs_ns = ns < 0 ? -ns : ns;
+
+    if (abs_ns < 1000){
+        qlog_fields_append(out, out_size, len, "%lldns", (long long) ns);
+    } else if (abs_ns < 1000000){
+        qlog_fields_append(out, out_size, len, "%.3fus", ns / 1e3);
+    } else if (abs_ns < 1000000000){
+        qlog_fields_append(out, out_size, len, "%.3fms", ns / 1e6);
+    } else {
+        qlog_fields_append(out, out_size, len, "%.3fs", ns / 1e9);
+    }
+}
+
+/**
+ * \brief Renders encoded fields as text
+ *
+ * \param data The encoded fields
+ * \param size The size of the encoded fields
+ * \param out The output buffer (always zero terminated)
+ * \param out_size The size of the output buffer
+ * \param json If 0 the fields are rendered as key=value pairs separated by
+ *             spaces (durations with unit), otherwise as a JSON object
+ *             (durations in ns)
+ * \return The length of the rendered text
+ */
+size_t qlog_fields_format(const void* data, size_t size, char* out, size_t out_size, int json){
+    qlog_field_t field;
+    size_t offset = 0, len = 0;
+    int first = 1;
+
+    if (out == NULL || out_size == 0){
+        return 0;
+    }
+    out[0] = '\0';
+    if (json){
+        qlog_fields_append(out, out_size, &len, "{");
+    }
+    while (qlog_fields_decode(data, size, &offset, &field) == QLOG_RET_OK){
+        if (json){
+            qlog_fields_append(out, out_size, &len, "%s", first ? "" : ",");
+            qlog_fields_append_str(out, out_size, &len, field.key, 1);
+            qlog_fields_append(out, out_size, &len, ":");
+        } else {
+            qlog_fields_append(out, out_size, &len, "%s%s=", first ? "" : " ", field.key);
+        }
+        first = 0;
+        switch (field.type){
+            case QLOG_FIELD_INT:
+                qlog_fields_append(out, out_size, &len, "%lld", (long long) field.value.i);
+                break;
+            case QLOG_FIELD_DURATION:
+                if (json){
+                    qlog_fields_append(out, out_size, &len, "%lld", (long long) field.value.i);
+                } else {
+                    qlog_fields_append_duration(out, out_size, &len, field.value.i);
+                }
+                break;
+            case QLOG_FIELD_DOUBLE:
+                if (json && !isfinite(field.value.d)){
+                    qlog_fields_append(out, out_size, &len, "null");
+                } else {
+                    qlog_fields_append(out, out_size, &len, "%.17g", field.value.d);
+                }
+                break;
+            case QLOG_FIELD_BOOL:
+                qlog_fields_append(out, out_size, &len, "%s", field.value.i ? "true" : "false");
+                break;
+            case QLOG_FIELD_STR:
+                qlog_fields_append_str(out, out_size, &len, field.value.s, json);
+                break;
+        }
+    }
+    if (json){
+        qlog_fields_append(out, out_size, &len, "}");
+    }
+    return len;
+}
+
+/* a number with an optional duration unit (ns, us, ms, s) */
+static int qlog_fields_parse_number(const char* str, double* number){
+    char* end = NULL;
+    double value = strtod(str, &end);
+
+    if (end == str){
+        return QLOG_RET_ERR;
+    }
+    if (*end == '\0' || strcmp(end, "ns") == 0){
+        *number = value;
+    } else if (strcmp(end, "us") == 0){
+        *number = value * 1e3;
+    } else if (strcmp(end, "ms") == 0){
+        *number = value * 1e6;
+    } else if (strcmp(end, "s") == 0){
+        *number = value * 1e9;
+    } else {
+        return QLOG_RET_ERR;
+    }
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Parses a field condition
+ *
+ * \param expr The condition: key op value, e.g. "latency_us > 500",
+ *             "path == /index", "elapsed >= 2ms", "cached == true".
+ *             The operators are ==, =, !=, <, <=, >, >=.
+ * \param filter The parsed condition
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the condition is invalid
+ *
+ * The numbers are compared to the INT, DOUBLE, BOOL and DURATION fields
+ * (durations in ns, the value can have a ns, us, ms or s unit), the other
+ * values to the STR fields.
+ */
+int qlog_fields_filter_parse(const char* expr, qlog_fields_filter_t* filter){
+    static const char* ops[] = {"==", "!=", "<=", ">=", "<", ">", "="};
+    static const int op_codes[] = {QLOG_FIELDS_OP_EQ, QLOG_FIELDS_OP_NE, QLOG_FIELDS_OP_LE,
+        QLOG_FIELDS_OP_GE, QLOG_FIELDS_OP_LT, QLOG_FIELDS_OP_GT, QLOG_FIELDS_OP_EQ};
+    const char* op = NULL;
+    const char* value = NULL;
+    size_t key_len = 0, value_len = 0, i = 0;
+    int quoted = 0;
+
+    if (expr == NULL || filter == NULL){
+        return QLOG_RET_ERR;
+    }
+    memset(filter, 0, sizeof(qlog_fields_filter_t));
+    op = strpbrk(expr, "=!<>");
+    if (op == NULL){
+        return QLOG_RET_ERR;
+    }
+
+    /* key: the trimmed text before the operator */
+    while (*expr == ' ' || *expr == '\t'){
+        expr++;
+    }
+    key_len = op - expr;
+    while (key_len > 0 && (expr[key_len - 1] == ' ' || expr[key_len - 1] == '\t')){
+        key_len--;
+    }
+    if (key_len == 0 || key_len > QLOG_FIELD_KEY_MAX_LEN){
+        return QLOG_RET_ERR;
+    }
+    memcpy(filter->key, expr, key_len);
+
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++){
+        if (strncmp(op, ops[i], strlen(ops[i])) == 0){
+            filter->op = op_codes[i];
+            value = op + strlen(ops[i]);
+            break;
+        }
+    }
+    if (value == NULL){
+        return QLOG_RET_ERR;
+    }
+
+    /* value: trimmed, optionally quoted */
+    while (*value == ' ' || *value == '\t'){
+        value++;
+    }
+    value_len = strlen(value);
+    while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t' ||
+                             value[value_len - 1] == '\n' || value[value_len - 1] == '\r')){
+        value_len--;
+    }
+    if (value_len >= 2 && value[0] == '"' && value[value_len - 1] == '"'){
+        value++;
+        value_len -= 2;
+        quoted = 1;
+    } else if (value_len == 0){
+        return QLOG_RET_ERR;
+    }
+    if (value_len > QLOG_FIELD_STR_MAX_LEN){
+        value_len = QLOG_FIELD_STR_MAX_LEN;
+    }
+    memcpy(filter->str, value, value_len);
+    filter->str[value_len] = '\0';
+
+    if (!quoted){
+        if (strcmp(filter->str, "true") == 0 || strcmp(filter->str, "false") == 0){
+            filter->numeric = 1;
+            filter->number = filter->str[0] == 't' ? 1 : 0;
+        } else if (qlog_fields_parse_number(filter->str, &filter->number) == QLOG_RET_OK){
+            filter->numeric = 1;
+        }
+    }
+    return QLOG_RET_OK;
+}
+
+static int qlog_fields_compare(int op, int cmp){
+    switch (op){
+        case QLOG_FIELDS_OP_EQ: return cmp == 0;
+        case QLOG_FIELDS_OP_NE: return cmp != 0;
+        case QLOG_FIELDS_OP_LT: return cmp < 0;
+        case QLOG_FIELDS_OP_LE: return cmp <= 0;
+        case QLOG_FIELDS_OP_GT: return cmp > 0;
+        case QLOG_FIELDS_OP_GE: return cmp >= 0;
+    }
+    return 0;
+}
+
+/**
+ * \brief Checks encoded fields against a condition
+ *
+ * \param filter The parsed condition
+ * \param data The encoded fields
+ * \param size The size of the encoded fields
+ * \return 1 if a field with the key of the condition satisfies it, 0 otherwise
+ */
+int qlog_fields_filter_match(const qlog_fields_filter_t* filter, const void* data, size_t size){
+    qlog_field_t field;
+    size_t offset = 0;
+    double number = 0;
+
+    while (qlog_fields_decode(data, size, &offset, &field) == QLOG_RET_OK){
+        if (strcmp(field.key, filter->key) != 0){
+            continue;
+        }
+        if (field.type == QLOG_FIELD_STR){
+            if (qlog_fields_compare(filter->op, strcmp(field.value.s, filter->str))){
+                return 1;
+            }
+            continue;
+        }
+        if (!filter->numeric){
+            continue;
+        }
+        number = field.type == QLOG_FIELD_DOUBLE ? field.value.d : (double) field.value.i;
+        if (qlog_fields_compare(filter->op, number < filter->number ? -1 : (number > filter->number ? 1 : 0))){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief Internal function for logging an event with fields
+ *
+ * \param log_buffer The buffer into the new event will be placed
+ * \param site The call site descriptor (optional)
+ * \param message The log message. If NULL the literal message of the call
+ *                site is referenced.
+ * \param fields The fields of the event
+ * \param field_num The number of the fields
+ * \return 0 on success, -1 in case of error, QLOG_RET_EVNT_LOCKED if the
+ *         event has been dropped
+ *
+ * The fields are stored at the end of the message field, the text message
+ * gets the rest of it.
+ */
+static int qlog_log_fields_internal(qlog_buffer_t* log_buffer, const qlog_site_t* site,
+        const char* message, const qlog_field_t* fields, size_t field_num)
+{
+    unsigned char encoded[QLOG_MSG_BUF_SIZE];
+    qlog_event_t* event = NULL;
+    size_t fields_size = 0, len = 0;
+    int res = 0;
+
+    /* one byte is kept for the (empty) text message */
+    fields_size = qlog_fields_encode(encoded, sizeof(encoded) - 1, fields, field_num);
+
+    res = qlog_acquire_event_internal(log_buffer, site, qlog_thread_self_id, &event);
+    if (res != QLOG_RET_OK){
+        return res;
+    }
+    if (message){
+        len = strnlen(message, QLOG_MSG_BUF_SIZE - fields_size - 1);
+        memcpy(event->message, message, len);
+        event->message[len] = '\0';
+    } else if (site){
+        event->message_ref = site->message;
+    }
+    memcpy(event->message + QLOG_MSG_BUF_SIZE - fields_size, encoded, fields_size);
+    event->fields_size = (uint16_t) fields_size;
+
+    qlog_release_event_internal(log_buffer, event, len + fields_size, 0);
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Logs an event with fields to the default log buffer
+ *
+ * \param message The log message
+ * \param fields The fields of the event
+ * \param field_num The number of the fields
+ * \return 0 if success, -1 in case of any error
+ */
+int qlog_log_fields(const char* message, const qlog_field_t* fields, size_t field_num){
+    return qlog_log_fields_id(qlog_internal_get_default_buf_id(), message, fields, field_num);
+}
+
+/**
+ * \brief Logs an event with fields to a buffer with a specified id
+ *
+ * \param buffer_id The id of the buffer into the event will be put
+ * \param message The log message
+ * \param fields The fields of the event
+ * \param field_num The number of the fields
+ * \return 0 if success, -1 in case of any error
+ */
+int qlog_log_fields_id(qlog_buffer_id_t buffer_id, const char* message,
+        const qlog_field_t* fields, size_t field_num)
+{
+    qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
+
+    if (qlog_internal_is_lib_inited() && qlog_internal_is_logging_enabled() && buffer){
+        return qlog_log_fields_internal(buffer, NULL, message ? message : "", fields, field_num);
+    }
+    return QLOG_RET_ERR;
+}
+
+/**
+ * \brief Logs an event with fields of a call site to the default log buffer
+ *
+ * \param site The call site descriptor (see QLOG_SITE_DEFINE)
+ * \param message The log message. If NULL the literal message of the call
+ *                site is used.
+ * \param fields The fields of the event
+ * \param field_num The number of the fields
+ * \return 0 if success, -1 in case of any error
+ */
+int qlog_log_fields_site(qlog_site_t* site, const char* message,
+        const qlog_field_t* fields, size_t field_num)
+{
+    qlog_buffer_t* buffer = qlog_internal_get_default_buf();
+    int res = QLOG_RET_ERR;
+
+    if (qlog_internal_is_lib_inited() && qlog_internal_is_logging_enabled() && buffer && site){
+        res = qlog_log_fields_internal(buffer, site, message, fields, field_num);
+        if (res == QLOG_RET_OK){
+            qlog_site_hit(site);
+        }
+    }
+    return res;
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_ftrace.c
+ * \brief Automatic function tracing by the -finstrument-functions hooks.
+ *
+ * The hooks are cheap when the tracing is stopped (one load and a branch).
+ * While tracing, the function address is checked against the allow and
+ * deny ranges and an event is stored by the internal log function: the
+ * record fits into the inline storage of the event, nothing is allocated.
+ * The enter and exit events are logged by the ftrace enter/exit call sites
+ * (flagged as ENTRY/LEAVE) so the indention, the trace export and the call
+ * site switches work for them as well.
+ * A thread local flag stops the recursion when the library itself is
+ * compiled with -finstrument-functions.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_ftrace.h"
+
+#define QLOG_NO_INSTR __attribute__ ((no_instrument_function))
+
+typedef struct qlog_ftrace_range_t {
+    uintptr_t start;
+    uintptr_t end;      /* exclusive */
+} qlog_ftrace_range_t;
+
+typedef struct qlog_ftrace_filter_t {
+    qlog_ftrace_range_t ranges[QLOG_FTRACE_MAX_RANGE_NUM];
+    unsigned int num;
+} qlog_ftrace_filter_t;
+
+static qlog_site_t qlog_ftrace_enter_site = {__FILE__, "ftrace", "enter", __LINE__,
+    QLOG_LEVEL_TRACE, QLOG_SITE_ENTRY, 1, 0, NULL, 0, 0, 0};
+static qlog_site_t qlog_ftrace_exit_site = {__FILE__, "ftrace", "exit", __LINE__,
+    QLOG_LEVEL_TRACE, QLOG_SITE_LEAVE, 1, 0, NULL, 0, 0, 0};
+/* one pointer per variable like QLOG_SITE_DEFINE: an array would be aligned
+ * to 16 bytes and leave a hole in the site table */
+static qlog_site_t* const qlog_ftrace_enter_site_ptr
+    __attribute__ ((section ("qlog_sites"), used)) = &qlog_ftrace_enter_site;
+static qlog_site_t* const qlog_ftrace_exit_site_ptr
+    __attribute__ ((section ("qlog_sites"), used)) = &qlog_ftrace_exit_site;
+
+static qlog_buffer_t* volatile qlog_ftrace_buffer = NULL;
+static int qlog_ftrace_buffer_id = -1;
+static qlog_ftrace_filter_t qlog_ftrace_allow;
+static qlog_ftrace_filter_t qlog_ftrace_deny;
+static __thread int qlog_ftrace_in_hook = 0;
+
+QLOG_NO_INSTR
+static int qlog_ftrace_in_ranges(const qlog_ftrace_filter_t* filter, uintptr_t address){
+    unsigned int i = 0;
+    for (i = 0; i < filter->num; i++){
+        if (address >= filter->ranges[i].start && address < filter->ranges[i].end){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+QLOG_NO_INSTR
+static int qlog_ftrace_add_range(qlog_ftrace_filter_t* filter, uintptr_t start, uintptr_t end){
+    if (start >= end || filter->num >= QLOG_FTRACE_MAX_RANGE_NUM){
+        return QLOG_RET_ERR;
+    }
+    filter->ranges[filter->num].start = start;
+    filter->ranges[filter->num].end = end;
+    /* the hooks may read the filter, publish the range before the counter */
+    __sync_synchronize();
+    filter->num++;
+    return QLOG_RET_OK;
+}
+
+/* the address range of a function from the dynamic symbol table */
+QLOG_NO_INSTR
+static int qlog_ftrace_add_symbol(qlog_ftrace_filter_t* filter, const char* name){
+    Dl_info info;
+    const ElfW(Sym)* symbol = NULL;
+    void* address = NULL;
+
+    if (name == NULL){
+        return QLOG_RET_ERR;
+    }
+    address = dlsym(RTLD_DEFAULT, name);
+    if (address == NULL || dladdr1(address, &info, (void**) &symbol, RTLD_DL_SYMENT) == 0 || symbol == NULL){
+        return QLOG_RET_ERR;
+    }
+    return qlog_ftrace_add_range(filter, (uintptr_t) address,
+            (uintptr_t) address + (symbol->st_size ? symbol->st_size : 1));
+}
+
+QLOG_NO_INSTR
+static void qlog_ftrace_log(qlog_site_t* site, void* function, void* call_site){
+    qlog_buffer_t* buffer = qlog_ftrace_buffer;
+    qlog_ftrace_record_t record;
+
+    if (buffer == NULL || qlog_ftrace_in_hook || !qlog_internal_is_logging_enabled() || !site->enabled){
+        return;
+    }
+    if ((qlog_ftrace_allow.num > 0 && !qlog_ftrace_in_ranges(&qlog_ftrace_allow, (uintptr_t) function)) ||
+            qlog_ftrace_in_ranges(&qlog_ftrace_deny, (uintptr_t) function)){
+        return;
+    }
+
+    qlog_ftrace_in_hook = 1;
+    record.function = function;
+    record.call_site = call_site;
+    if (site == &qlog_ftrace_enter_site){
+        qlog_inc_indent();
+    }
+    qlog_log_internal(buffer, site, qlog_thread_self_id, NULL, 0, NULL,
+            &record, sizeof(record), QLOG_EXT_EVENT_TYPE_FTRACE);
+    if (site == &qlog_ftrace_exit_site){
+        qlog_dec_indent();
+    }
+    qlog_ftrace_in_hook = 0;
+}
+
+QLOG_NO_INSTR
+void __cyg_profile_func_enter(void* function, void* call_site){
+    if (qlog_ftrace_buffer){
+        qlog_ftrace_log(&qlog_ftrace_enter_site, function, call_site);
+    }
+}
+
+QLOG_NO_INSTR
+void __cyg_profile_func_exit(void* function, void* call_site){
+    if (qlog_ftrace_buffer){
+        qlog_ftrace_log(&qlog_ftrace_exit_site, function, call_site);
+    }
+}
+
+/**
+ * \brief Starts the function tracing
+ *
+ * \param size The number of events in the trace buffer
+ * \return The id of the trace buffer, -1 in case of error
+ *
+ * A new log buffer is created for the trace events at the first start (or
+ * if the previous one has been deleted), a restart continues the same buffer.
+ * The tracing has to be stopped before the buffer is deleted or the library
+ * is cleaned up.
+ */
+QLOG_NO_INSTR
+int qlog_ftrace_start(size_t size){
+    qlog_buffer_t* buffer = NULL;
+    int buffer_id = qlog_ftrace_buffer_id;
+
+    if (buffer_id >= 0){
+        buffer = qlog_internal_get_buffer_by_id(buffer_id);
+    }
+    if (buffer == NULL){
+        buffer_id = qlog_create_buffer(size);
+        buffer = qlog_internal_get_buffer_by_id(buffer_id);
+        if (buffer == NULL){
+            return -1;
+        }
+        qlog_ftrace_buffer_id = buffer_id;
+    }
+    qlog_ftrace_buffer = buffer;
+    return buffer_id;
+}
+
+/**
+ * \brief Stops the function tracing, the trace buffer is kept
+ */
+QLOG_NO_INSTR
+void qlog_ftrace_stop(void){
+    qlog_ftrace_buffer = NULL;
+}
+
+/**
+ * \brief Provides the id of the trace buffer, -1 if the tracing has not been started
+ */
+QLOG_NO_INSTR
+int qlog_ftrace_get_buffer_id(void){
+    return qlog_ftrace_buffer_id;
+}
+
+/**
+ * \brief Adds an address range to the allow list
+ *
+ * \param start The first address of the range
+ * \param end The end of the range (exclusive)
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of any error
+ *
+ * If the allow list is not empty, only the functions in its ranges are traced.
+ */
+QLOG_NO_INSTR
+int qlog_ftrace_allow_range(void* start, void* end){
+    return qlog_ftrace_add_range(&qlog_ftrace_allow, (uintptr_t) start, (uintptr_t) end);
+}
+
+/**
+ * \brief Adds an address range to the deny list
+ *
+ * \param start The first address of the range
+ * \param end The end of the range (exclusive)
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of any error
+ *
+ * The functions in the deny ranges are never traced.
+ */
+QLOG_NO_INSTR
+int qlog_ftrace_deny_range(void* start, void* end){
+    return qlog_ftrace_add_range(&qlog_ftrace_deny, (uintptr_t) start, (uintptr_t) end);
+}
+
+/**
+ * \brief Adds a function to the allow list by name
+ *
+ * \param name The symbol name of the function
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the symbol is not found
+ *
+ * Only the symbols of the dynamic symbol table are found (link the program
+ * with -rdynamic), the static functions can be added by address range.
+ */
+QLOG_NO_INSTR
+int qlog_ftrace_allow_symbol(const char* name){
+    return qlog_ftrace_add_symbol(&qlog_ftrace_allow, name);
+}
+
+/**
+ * \brief Adds a function to the deny list by name
+ *
+ * \param name The symbol name of the function
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the symbol is not found
+ */
+QLOG_NO_INSTR
+int qlog_ftrace_deny_symbol(const char* name){
+    return qlog_ftrace_add_symbol(&qlog_ftrace_deny, name);
+}
+
+/**
+ * \brief Clears the allow and deny lists
+ *
+ * Should be called while the tracing is stopped.
+ */
+QLOG_NO_INSTR
+void qlog_ftrace_clear_filters(void){
+    qlog_ftrace_allow.num = 0;
+    qlog_ftrace_deny.num = 0;
+}
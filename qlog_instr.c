@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_instr.c
+ * \brief Self instrumentation: the cost of the logging hot path per thread.
+ *
+ * Every instrumented thread gets a counter block (see qlog_thread_block.h),
+ * so counting is a TLS load and two adds without any locking; the counters
+ * are read without synchronization. When a thread exits its counters are
+ * folded into the exited row.
+ * The block keeps the address of the thread id of its owner, so the
+ * threads registered after their first log call are shown by name too.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_thread.h"
+#include "qlog_thread_block.h"
+#include "qlog_instr.h"
+
+__thread qlog_instr_counter_t* qlog_instr_thread_counters = NULL;
+__thread uint64_t qlog_instr_thread_start[QLOG_INSTR_NUM];
+
+static const char* qlog_instr_names[QLOG_INSTR_NUM] = {
+    "log call", "buffer lock", "global lock", "gettimeofday", "string copy", "ext data malloc"
+};
+
+static void qlog_instr_thread_exit(void* data);
+
+static qlog_instr_counter_t qlog_instr_exited[QLOG_INSTR_NUM];
+static pthread_mutex_t qlog_instr_lock = PTHREAD_MUTEX_INITIALIZER;
+static qlog_thread_block_registry_t qlog_instr_blocks = QLOG_THREAD_BLOCK_REGISTRY_INIT(
+        sizeof(qlog_instr_counter_t) * QLOG_INSTR_NUM, qlog_instr_thread_exit, &qlog_instr_lock);
+
+/* adds the counters of src to dest */
+static void qlog_instr_sum(qlog_instr_counter_t* dest, const qlog_instr_counter_t* src){
+    int i = 0;
+
+    for (i = 0; i < QLOG_INSTR_NUM; i++){
+        dest[i].calls += src[i].calls;
+        dest[i].ns += src[i].ns;
+        dest[i].contended += src[i].contended;
+        dest[i].spins += src[i].spins;
+    }
+}
+
+/* folds the counters of an exiting thread into the exited row */
+static void qlog_instr_thread_exit(void* data){
+    qlog_instr_sum(qlog_instr_exited, (const qlog_instr_counter_t*) data);
+    qlog_instr_thread_counters = NULL;
+}
+
+/**
+ * \brief Sets up the counters of the calling thread
+ *
+ * \return The counters of the thread or NULL if out of memory
+ *
+ * Called by the hooks on the first instrumented operation of a thread.
+ */
+qlog_instr_counter_t* qlog_instr_thread_init(void){
+    qlog_instr_thread_counters = qlog_thread_block_get(&qlog_instr_blocks);
+    return qlog_instr_thread_counters;
+}
+
+/**
+ * \brief Locks a spinlock counting the spins and the time spent waiting
+ *
+ * \param op The lock operation (QLOG_INSTR_LOCK or QLOG_INSTR_GLOBAL_LOCK)
+ * \param lock The spinlock
+ * \return 0 if the lock is acquired, an error code of pthread_spin_trylock otherwise
+ *
+ * Replaces pthread_spin_lock in the instrumented build. The acquisition
+ * itself is counted by the caller (QLOG_INSTR_COUNT), here only the
+ * contention is.
+ */
+int qlog_instr_spin_lock(int op, pthread_spinlock_t* lock){
+    qlog_instr_counter_t* counter = qlog_instr_counter(op);
+    uint64_t start = qlog_instr_now();
+    uint64_t spins = 0;
+    int res = 0;
+
+    while ((res = pthread_spin_trylock(lock)) == EBUSY){
+        spins++;
+#if defined(__i386__) || defined(__x86_64__)
+        __asm__ __volatile__ ("pause");
+#endif
+    }
+    if (counter && spins > 0){
+        counter->contended++;
+        counter->spins += spins;
+        counter->ns += qlog_instr_now() - start;
+    }
+    return res;
+}
+
+/**
+ * \brief Provides the name of an instrumented operation
+ *
+ * \param op The operation (QLOG_INSTR_LOG, ...)
+ * \return The name of the operation, "unknown" for an invalid one
+ */
+const char* qlog_instr_get_name(int op){
+    return (op >= 0 && op < QLOG_INSTR_NUM) ? qlog_instr_names[op] : "unknown";
+}
+
+/**
+ * \brief Provides the counters of the threads
+ *
+ * \param stats The rows are copied here
+ * \param max_num The number of the rows in stats
+ * \return The number of the rows filled
+ *
+ * A row is returned for every instrumented thread running and one for
+ * the exited threads (if any of them has counted anything). The counters
+ * are read while the threads are updating them, an operation in flight
+ * may be missing from the copy.
+ */
+size_t qlog_instr_get(qlog_instr_thread_stats_t* stats, size_t max_num){
+    const qlog_thread_block_t* block = NULL;
+    size_t num = 0;
+    int i = 0;
+
+    pthread_mutex_lock(&qlog_instr_lock);
+    for (block = qlog_instr_blocks.blocks; block && num < max_num; block = block->next){
+        if (block->owner == NULL){
+            continue;
+        }
+        memset(&stats[num], 0, sizeof(qlog_instr_thread_stats_t));
+        stats[num].thread_id = *block->owner;
+        memcpy(stats[num].counters, block->data, sizeof(stats[num].counters));
+        num++;
+    }
+    for (i = 0; i < QLOG_INSTR_NUM && num < max_num; i++){
+        if (qlog_instr_exited[i].calls > 0){
+            memset(&stats[num], 0, sizeof(qlog_instr_thread_stats_t));
+            stats[num].exited = 1;
+            memcpy(stats[num].counters, qlog_instr_exited, sizeof(qlog_instr_exited));
+            num++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&qlog_instr_lock);
+    return num;
+}
+
+/**
+ * \brief Clears the counters of all the threads
+ *
+ * The operations counted by the threads meanwhile may survive the reset
+ * partially.
+ */
+void qlog_instr_reset(void){
+    pthread_mutex_lock(&qlog_instr_lock);
+    qlog_thread_block_clear_all(&qlog_instr_blocks);
+    memset(qlog_instr_exited, 0, sizeof(qlog_instr_exited));
+    pthread_mutex_unlock(&qlog_instr_lock);
+}
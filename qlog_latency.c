@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_latency.c
+ * \brief Function latency histograms measured by QLOG_ENTRY/QLOG_LEAVE.
+ *
+ * The ENTRY and LEAVE call sites of a function are paired by the function
+ * name pointer (__func__ is the same object in the whole function). If a
+ * LEAVE is missing (e.g. an early return without QLOG_LEAVE) the frames of
+ * the callees are dropped when the caller leaves.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_latency.h"
+
+typedef struct qlog_latency_frame_t {
+    qlog_site_t* site;      /* the ENTRY call site */
+    uint64_t start;         /* entry timestamp (ns) */
+} qlog_latency_frame_t;
+
+int qlog_latency_enabled = 0;
+
+static __thread qlog_latency_frame_t qlog_latency_stack[QLOG_LATENCY_STACK_DEPTH];
+static __thread unsigned int qlog_latency_depth = 0;
+static __thread int qlog_latency_shard = -1;
+static unsigned int qlog_latency_next_shard = 0;
+
+static uint64_t qlog_latency_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* log-linear bucket: the top QLOG_LATENCY_SUB_BITS bits below the leading one */
+static unsigned int qlog_latency_bucket(uint64_t value){
+    unsigned int exponent = 0;
+
+    if (value < QLOG_LATENCY_SUB_NUM){
+        return (unsigned int) value;
+    }
+    exponent = 63 - __builtin_clzll(value);
+    return (exponent - QLOG_LATENCY_SUB_BITS + 1) * QLOG_LATENCY_SUB_NUM +
+        ((value >> (exponent - QLOG_LATENCY_SUB_BITS)) & (QLOG_LATENCY_SUB_NUM - 1));
+}
+
+/* the highest value falling into a bucket */
+static uint64_t qlog_latency_bucket_max(unsigned int bucket){
+    unsigned int exponent = 0;
+
+    if (bucket < QLOG_LATENCY_SUB_NUM){
+        return bucket;
+    }
+    exponent = bucket / QLOG_LATENCY_SUB_NUM + QLOG_LATENCY_SUB_BITS - 1;
+    return ((uint64_t) (QLOG_LATENCY_SUB_NUM + bucket % QLOG_LATENCY_SUB_NUM) << (exponent - QLOG_LATENCY_SUB_BITS)) +
+        ((uint64_t) 1 << (exponent - QLOG_LATENCY_SUB_BITS)) - 1;
+}
+
+/* allocates the histogram of the function on the first measurement */
+static qlog_latency_t* qlog_latency_get_histogram(qlog_site_t* site){
+    qlog_latency_t* latency = site->latency;
+
+    if (latency == NULL){
+        if (posix_memalign((void**) &latency, 64, sizeof(qlog_latency_t))){
+            return NULL;
+        }
+        memset(latency, 0, sizeof(qlog_latency_t));
+        if (!__sync_bool_compare_and_swap(&site->latency, NULL, latency)){
+            /* another thread was faster */
+            free(latency);
+            latency = site->latency;
+        }
+    }
+    return latency;
+}
+
+static void qlog_latency_record(qlog_site_t* site, uint64_t duration){
+    qlog_latency_t* latency = qlog_latency_get_histogram(site);
+    qlog_latency_shard_t* shard = NULL;
+    uint64_t max = 0;
+
+    if (latency == NULL){
+        return;
+    }
+    if (qlog_latency_shard < 0){
+        qlog_latency_shard = __sync_fetch_and_add(&qlog_latency_next_shard, 1) % QLOG_LATENCY_SHARD_NUM;
+    }
+    shard = &latency->shards[qlog_latency_shard];
+    __sync_fetch_and_add(&shard->buckets[qlog_latency_bucket(duration)], 1);
+    __sync_fetch_and_add(&shard->count, 1);
+    __sync_fetch_and_add(&shard->sum, duration);
+    max = shard->max;
+    while (duration > max && !__sync_bool_compare_and_swap(&shard->max, max, duration)){
+        max = shard->max;
+    }
+}
+
+/**
+ * \brief Enables/disables the latency measurement
+ */
+void qlog_latency_set_enabled(int enabled){
+    qlog_latency_enabled = enabled ? 1 : 0;
+}
+
+/**
+ * \brief Records the entry of a function (QLOG_ENTRY)
+ *
+ * \param site The ENTRY call site of the function
+ */
+void qlog_latency_enter(qlog_site_t* site){
+    if (qlog_latency_depth < QLOG_LATENCY_STACK_DEPTH){
+        qlog_latency_stack[qlog_latency_depth].site = site;
+        qlog_latency_stack[qlog_latency_depth].start = qlog_latency_now();
+    }
+    qlog_latency_depth++;
+}
+
+/**
+ * \brief Records the leave of a function (QLOG_LEAVE)
+ *
+ * \param site The LEAVE call site of the function
+ *
+ * The duration is added to the histogram of the matching ENTRY call site.
+ */
+void qlog_latency_leave(const qlog_site_t* site){
+    uint64_t now = qlog_latency_now();
+    unsigned int depth = qlog_latency_depth;
+
+    /* the frames deeper than the stack are not recorded */
+    if (depth > QLOG_LATENCY_STACK_DEPTH){
+        qlog_latency_depth--;
+        return;
+    }
+    while (depth > 0){
+        depth--;
+        if (qlog_latency_stack[depth].site->function == site->function){
+            qlog_latency_record(qlog_latency_stack[depth].site, now - qlog_latency_stack[depth].start);
+            qlog_latency_depth = depth;
+            return;
+        }
+    }
+    /* no matching entry (e.g. the measurement was enabled in the function) */
+}
+
+/**
+ * \brief Summarizes the latency histogram of a function
+ *
+ * \param site The ENTRY call site of the function
+ * \param summary The result is stored here
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the function has no
+ *         measurement
+ *
+ * The percentiles are the upper bounds of their histogram buckets.
+ */
+int qlog_latency_get_summary(const qlog_site_t* site, qlog_latency_summary_t* summary){
+    unsigned long buckets[QLOG_LATENCY_BUCKET_NUM];
+    qlog_latency_t* latency = NULL;
+    unsigned long seen = 0;
+    uint64_t sum = 0;
+    int p50_found = 0, p99_found = 0;
+    unsigned int i = 0, shard = 0;
+
+    if (site == NULL || summary == NULL || site->latency == NULL){
+        return QLOG_RET_ERR;
+    }
+    latency = site->latency;
+    memset(summary, 0, sizeof(qlog_latency_summary_t));
+    memset(buckets, 0, sizeof(buckets));
+    for (shard = 0; shard < QLOG_LATENCY_SHARD_NUM; shard++){
+        summary->count += latency->shards[shard].count;
+        sum += latency->shards[shard].sum;
+        if (latency->shards[shard].max > summary->max){
+            summary->max = latency->shards[shard].max;
+        }
+        for (i = 0; i < QLOG_LATENCY_BUCKET_NUM; i++){
+            buckets[i] += latency->shards[shard].buckets[i];
+        }
+    }
+    if (summary->count == 0){
+        return QLOG_RET_ERR;
+    }
+    summary->mean = sum / summary->count;
+
+    for (i = 0; i < QLOG_LATENCY_BUCKET_NUM; i++){
+        seen += buckets[i];
+        if (!p50_found && seen * 2 >= summary->count){
+            summary->p50 = qlog_latency_bucket_max(i);
+            p50_found = 1;
+        }
+        if (!p99_found && seen * 100 >= summary->count * 99){
+            summary->p99 = qlog_latency_bucket_max(i);
+            p99_found = 1;
+        }
+        if (seen * 1000 >= summary->count * 999){
+            summary->p999 = qlog_latency_bucket_max(i);
+            break;
+        }
+    }
+    /* the bucket bounds are not exact, do not report more than seen */
+    if (summary->p50 > summary->max){
+        summary->p50 = summary->max;
+    }
+    if (summary->p99 > summary->max){
+        summary->p99 = summary->max;
+    }
+    if (summary->p999 > summary->max){
+        summary->p999 = summary->max;
+    }
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Clears the latency histograms of all the functions
+ */
+void qlog_latency_reset(void){
+    qlog_site_t* site = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < qlog_site_count(); i++){
+        site = qlog_site_get(i);
+        if (site->latency){
+            memset(site->latency, 0, sizeof(qlog_latency_t));
+        }
+    }
+}
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_metric.c
+ * \brief Counter and gauge metrics aggregated per thread.
+ *
+ * Every thread recording a metric gets an accumulator block with a slot
+ * for every possible metric id (see qlog_thread_block.h), so the recording
+ * is a TLS load and an add/store. The blocks are walked by the flusher
+ * under the registry mutex. When a thread exits its counter totals (and
+ * its gauge range of the open bucket) are folded into the metric.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_fields.h"
+#include "qlog_metric.h"
+#include "qlog_thread_block.h"
+
+/* the field of a metric in the flushed event: type, key, varint value */
+#define QLOG_METRIC_FIELD_MAX_SIZE(name_len) (1 + (name_len) + 1 + 10)
+
+typedef struct qlog_metric_t {
+    char name[QLOG_METRIC_NAME_SIZE];
+    int type;
+    int64_t retired;            /* counter: total of the exited threads */
+    int64_t flushed;            /* counter: total at the last flush */
+    int64_t retired_min;        /* gauge: range of the exited threads in the open bucket */
+    int64_t retired_max;
+    uint32_t retired_count;
+    uint32_t retired_epoch;
+    int64_t retired_last;       /* gauge: newest value set by the exited threads */
+    uint64_t retired_stamp;
+    int64_t min;                /* gauge: range of the last bucket */
+    int64_t max;
+    int64_t history[QLOG_METRIC_HISTORY];
+    unsigned int history_pos;   /* next position in history */
+    unsigned int history_num;
+} qlog_metric_t;
+
+__thread qlog_metric_slot_t* qlog_metric_thread_slots = NULL;
+uint32_t qlog_metric_epoch = 1;
+
+static qlog_metric_t qlog_metrics[QLOG_MAX_METRIC_NUM];
+static size_t qlog_metric_num = 1;  /* id 0 is QLOG_METRIC_ID_NONE */
+static pthread_mutex_t qlog_metric_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void qlog_metric_thread_exit(void* data);
+
+static qlog_thread_block_registry_t qlog_metric_blocks = QLOG_THREAD_BLOCK_REGISTRY_INIT(
+        sizeof(qlog_metric_slot_t) * QLOG_MAX_METRIC_NUM, qlog_metric_thread_exit, &qlog_metric_lock);
+
+/* the flusher thread */
+static pthread_t qlog_metric_flusher_thread;
+static pthread_mutex_t qlog_metric_flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t qlog_metric_flusher_cond = PTHREAD_COND_INITIALIZER;
+static int qlog_metric_flusher_running = 0;
+static int qlog_metric_flusher_stop = 0;
+static qlog_buffer_id_t qlog_metric_flusher_buffer = 0;
+static unsigned int qlog_metric_flusher_interval = 0;
+
+/* folds the accumulators of an exiting thread into the metrics */
+static void qlog_metric_thread_exit(void* data){
+    const qlog_metric_slot_t* slots = (const qlog_metric_slot_t*) data;
+    const qlog_metric_slot_t* slot = NULL;
+    qlog_metric_t* metric = NULL;
+    size_t i = 0;
+
+    for (i = 1; i < qlog_metric_num; i++){
+        slot = &slots[i];
+        metric = &qlog_metrics[i];
+        metric->retired += slot->sum;
+        if (slot->stamp > metric->retired_stamp){
+            metric->retired_last = slot->last;
+            metric->retired_stamp = slot->stamp;
+        }
+        if (slot->count && slot->epoch == qlog_metric_epoch){
+            if (metric->retired_count == 0 || metric->retired_epoch != slot->epoch){
+                metric->retired_min = slot->min;
+                metric->retired_max = slot->max;
+                metric->retired_count = 0;
+                metric->retired_epoch = slot->epoch;
+            }
+            metric->retired_min = slot->min < metric->retired_min ? slot->min : metric->retired_min;
+            metric->retired_max = slot->max > metric->retired_max ? slot->max : metric->retired_max;
+            metric->retired_count += slot->count;
+        }
+    }
+    qlog_metric_thread_slots = NULL;
+}
+
+/**
+ * \brief Sets up the accumulators of the calling thread
+ *
+ * \return The accumulator slots of the thread or NULL if out of memory
+ *
+ * Called by the recording functions on the first use in a thread.
+ */
+qlog_metric_slot_t* qlog_metric_thread_init(void){
+    qlog_metric_thread_slots = qlog_thread_block_get(&qlog_metric_blocks);
+    return qlog_metric_thread_slots;
+}
+
+/**
+ * \brief Registers a metric
+ *
+ * \param name The name of the metric (the key of its field in the flushed events)
+ * \param type QLOG_METRIC_COUNTER or QLOG_METRIC_GAUGE
+ * \return The id of the metric, QLOG_METRIC_ID_NONE if the registry is full
+ *
+ * Registering an existing name returns the id of the existing metric.
+ */
+qlog_metric_id_t qlog_metric_register(const char* name, int type){
+    qlog_metric_id_t id = QLOG_METRIC_ID_NONE;
+    size_t i = 0;
+
+    if (name == NULL || name[0] == '\0' ||
+            (type != QLOG_METRIC_COUNTER && type != QLOG_METRIC_GAUGE)){
+        return QLOG_METRIC_ID_NONE;
+    }
+    pthread_mutex_lock(&qlog_metric_lock);
+    for (i = 1; i < qlog_metric_num; i++){
+        if (strncmp(qlog_metrics[i].name, name, QLOG_METRIC_NAME_SIZE - 1) == 0){
+            id = (qlog_metric_id_t) i;
+            break;
+        }
+    }
+    if (id == QLOG_METRIC_ID_NONE && qlog_metric_num < QLOG_MAX_METRIC_NUM){
+        id = (qlog_metric_id_t) qlog_metric_num;
+        memset(&qlog_metrics[id], 0, sizeof(qlog_metric_t));
+        strncpy(qlog_metrics[id].name, name, QLOG_METRIC_NAME_SIZE - 1);
+        qlog_metrics[id].type = type;
+        qlog_metric_num++;
+    }
+    pthread_mutex_unlock(&qlog_metric_lock);
+    return id;
+}
+
+/* the number of the registered metrics (including the invalid id 0) */
+size_t qlog_metric_count(void){
+    return qlog_metric_num;
+}
+
+/* the total of a counter, called under the registry lock */
+static int64_t qlog_metric_total(qlog_metric_id_t id){
+    const qlog_thread_block_t* block = NULL;
+    int64_t total = qlog_metrics[id].retired;
+
+    for (block = qlog_metric_blocks.blocks; block; block = block->next){
+        total += QLOG_METRIC_LOAD(QLOG_THREAD_BLOCK_DATA(block, const qlog_metric_slot_t)[id].sum);
+    }
+    return total;
+}
+
+/* the last value of a gauge: the newest one set by the threads, called
+ * under the registry lock */
+static int64_t qlog_metric_last(qlog_metric_id_t id){
+    const qlog_thread_block_t* block = NULL;
+    const qlog_metric_slot_t* slot = NULL;
+    int64_t value = qlog_metrics[id].retired_last;
+    uint64_t stamp = qlog_metrics[id].retired_stamp, slot_stamp = 0;
+
+    for (block = qlog_metric_blocks.blocks; block; block = block->next){
+        slot = &QLOG_THREAD_BLOCK_DATA(block, const qlog_metric_slot_t)[id];
+        slot_stamp = QLOG_METRIC_LOAD(slot->stamp);
+        if (slot_stamp > stamp){
+            stamp = slot_stamp;
+            value = QLOG_METRIC_LOAD(slot->last);
+        }
+    }
+    return value;
+}
+
+/**
+ * \brief Provides the current state of a metric
+ *
+ * \param id The id of the metric
+ * \param info The state of the metric is copied here
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the metric does not exist
+ */
+int qlog_metric_get(qlog_metric_id_t id, qlog_metric_info_t* info){
+    const qlog_metric_t* metric = NULL;
+    unsigned int i = 0, start = 0;
+
+    if (info == NULL){
+        return QLOG_RET_ERR;
+    }
+    pthread_mutex_lock(&qlog_metric_lock);
+    if (id == QLOG_METRIC_ID_NONE || id >= qlog_metric_num){
+        pthread_mutex_unlock(&qlog_metric_lock);
+        return QLOG_RET_ERR;
+    }
+    metric = &qlog_metrics[id];
+    memset(info, 0, sizeof(qlog_metric_info_t));
+    memcpy(info->name, metric->name, sizeof(info->name));
+    info->type = metric->type;
+    info->value = metric->type == QLOG_METRIC_COUNTER ? qlog_metric_total(id) : qlog_metric_last(id);
+    info->min = metric->min;
+    info->max = metric->max;
+    info->history_num = metric->history_num;
+    start = (metric->history_pos + QLOG_METRIC_HISTORY - metric->history_num) % QLOG_METRIC_HISTORY;
+    for (i = 0; i < metric->history_num; i++){
+        info->history[i] = metric->history[(start + i) % QLOG_METRIC_HISTORY];
+    }
+    pthread_mutex_unlock(&qlog_metric_lock);
+    return QLOG_RET_OK;
+}
+
+/* closes the bucket of a metric, returns 1 if it has been updated in the bucket */
+static int qlog_metric_close_bucket(qlog_metric_id_t id, uint32_t epoch, int64_t* value){
+    qlog_metric_t* metric = &qlog_metrics[id];
+    const qlog_thread_block_t* block = NULL;
+    const qlog_metric_slot_t* slot = NULL;
+    int64_t total = 0, min = 0, max = 0, slot_min = 0, slot_max = 0;
+    uint32_t count = 0, slot_count = 0;
+    int updated = 0;
+
+    if (metric->type == QLOG_METRIC_COUNTER){
+        total = qlog_metric_total(id);
+        *value = total - metric->flushed;
+        metric->flushed = total;
+        updated = *value != 0;
+    } else {
+        if (metric->retired_count && metric->retired_epoch == epoch){
+            min = metric->retired_min;
+            max = metric->retired_max;
+            count = metric->retired_count;
+        }
+        metric->retired_count = 0;
+        for (block = qlog_metric_blocks.blocks; block; block = block->next){
+            slot = &QLOG_THREAD_BLOCK_DATA(block, const qlog_metric_slot_t)[id];
+            slot_count = QLOG_METRIC_LOAD(slot->count);
+            if (slot_count == 0 || QLOG_METRIC_LOAD(slot->epoch) != epoch){
+                continue;
+            }
+            slot_min = QLOG_METRIC_LOAD(slot->min);
+            slot_max = QLOG_METRIC_LOAD(slot->max);
+            min = (count == 0 || slot_min < min) ? slot_min : min;
+            max = (count == 0 || slot_max > max) ? slot_max : max;
+            count += slot_count;
+        }
+        *value = qlog_metric_last(id);
+        metric->min = count ? min : *value;
+        metric->max = count ? max : *value;
+        updated = count > 0;
+    }
+    metric->history[metric->history_pos] = *value;
+    metric->history_pos = (metric->history_pos + 1) % QLOG_METRIC_HISTORY;
+    if (metric->history_num < QLOG_METRIC_HISTORY){
+        metric->history_num++;
+    }
+    return updated;
+}
+
+/**
+ * \brief Closes the current time bucket of the metrics
+ *
+ * \param buffer_id The buffer to log the bucket into
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the bucket could not be logged
+ *
+ * The metrics updated in the bucket are logged as fields of "metrics"
+ * events (as many events as needed): the increase of the counters and the
+ * last value of the gauges. All the metrics get a new history entry.
+ */
+int qlog_metric_flush(qlog_buffer_id_t buffer_id){
+    qlog_field_t fields[QLOG_MAX_METRIC_NUM];
+    static const char message[] = "metrics";
+    size_t field_num = 0, start = 0, size = 0, field_size = 0, i = 0;
+    uint32_t epoch = 0;
+    int64_t value = 0;
+    int res = QLOG_RET_OK;
+
+    pthread_mutex_lock(&qlog_metric_lock);
+    epoch = qlog_metric_epoch;
+    for (i = 1; i < qlog_metric_num; i++){
+        if (qlog_metric_close_bucket((qlog_metric_id_t) i, epoch, &value)){
+            fields[field_num].key = qlog_metrics[i].name;
+            fields[field_num].type = QLOG_FIELD_INT;
+            fields[field_num].value.i = value;
+            field_num++;
+        }
+    }
+    __sync_fetch_and_add(&qlog_metric_epoch, 1);
+    pthread_mutex_unlock(&qlog_metric_lock);
+
+    /* split the fields into events, the names are never changed so they
+     * can be used without the lock */
+    for (i = 0; i < field_num; i++){
+        field_size = QLOG_METRIC_FIELD_MAX_SIZE(strlen(fields[i].key));
+        if (size + field_size > QLOG_MSG_BUF_SIZE - sizeof(message)){
+            if (qlog_log_fields_id(buffer_id, message, fields + start, i - start) != QLOG_RET_OK){
+                res = QLOG_RET_ERR;
+            }
+            start = i;
+            size = 0;
+        }
+        size += field_size;
+    }
+    if (field_num > start && qlog_log_fields_id(buffer_id, message, fields + start, field_num - start) != QLOG_RET_OK){
+        res = QLOG_RET_ERR;
+    }
+    return res;
+}
+
+static void* qlog_metric_flusher(void* data){
+    struct timespec deadline;
+    (void) data;
+
+    qlog_thread_register("qlog_metric");
+    pthread_mutex_lock(&qlog_metric_flusher_lock);
+    while (!qlog_metric_flusher_stop){
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += qlog_metric_flusher_interval / 1000;
+        deadline.tv_nsec += (long) (qlog_metric_flusher_interval % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!qlog_metric_flusher_stop &&
+                pthread_cond_timedwait(&qlog_metric_flusher_cond, &qlog_metric_flusher_lock, &deadline) == 0){
+            /* spurious wakeup */
+        }
+        if (qlog_metric_flusher_stop){
+            break;
+        }
+        pthread_mutex_unlock(&qlog_metric_flusher_lock);
+        qlog_metric_flush(qlog_metric_flusher_buffer);
+        pthread_mutex_lock(&qlog_metric_flusher_lock);
+    }
+    pthread_mutex_unlock(&qlog_metric_flusher_lock);
+    return NULL;
+}
+
+/**
+ * \brief Starts the flusher thread
+ *
+ * \param buffer_id The buffer the buckets are logged into
+ * \param interval_ms The length of a time bucket in milliseconds
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of error (or if the
+ *         flusher is already running)
+ *
+ * The flusher is stopped by qlog_cleanup() too.
+ */
+int qlog_metric_start(qlog_buffer_id_t buffer_id, unsigned int interval_ms){
+    int res = QLOG_RET_ERR;
+
+    if (interval_ms == 0){
+        return QLOG_RET_ERR;
+    }
+    pthread_mutex_lock(&qlog_metric_flusher_lock);
+    if (!qlog_metric_flusher_running){
+        qlog_metric_flusher_buffer = buffer_id;
+        qlog_metric_flusher_interval = interval_ms;
+        qlog_metric_flusher_stop = 0;
+        if (pthread_create(&qlog_metric_flusher_thread, NULL, qlog_metric_flusher, NULL) == 0){
+            qlog_metric_flusher_running = 1;
+            res = QLOG_RET_OK;
+        }
+    }
+    pthread_mutex_unlock(&qlog_metric_flusher_lock);
+    return res;
+}
+
+/**
+ * \brief Stops the flusher thread
+ *
+ * The open bucket is not flushed.
+ */
+void qlog_metric_stop(void){
+    int running = 0;
+
+    pthread_mutex_lock(&qlog_metric_flusher_lock);
+    running = qlog_metric_flusher_running;
+    qlog_metric_flusher_stop = 1;
+    pthread_cond_signal(&qlog_metric_flusher_cond);
+    pthread_mutex_unlock(&qlog_metric_flusher_lock);
+
+    if (running){
+        pthread_join(qlog_metric_flusher_thread, NULL);
+        pthread_mutex_lock(&qlog_metric_flusher_lock);
+        qlog_metric_flusher_running = 0;
+        pthread_mutex_unlock(&qlog_metric_flusher_lock);
+    }
+}
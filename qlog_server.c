@@ -17,6 +17,10 @@
 #include "qlog_display.h"
 #include "qlog_display_debug.h"
 #include "qlog_debug.h"
+#include "qlog_latency.h"
+#include "qlog_trace.h"
+#include "qlog_trigger.h"
+#include "qlog_instr.h"
 
 pthread_t qlog_server_thread;
 static int server_port = 50005;
@@ -36,6 +40,7 @@ void qlog_menu_stop_server(void);
 void qlog_menu_close_conn(void);
 void qlog_menu_error(void);
 void qlog_server_print_cmd_header(FILE* stream, const char* message);
+void qlog_server_trim_line(char* line);
 void qlog_server_print_cmd_footer(FILE* stream);
 
 static qlog_server_menu_item qlog_server_menu[] = {
@@ -46,6 +51,22 @@ static qlog_server_menu_item qlog_server_menu[] = {
     {"[5] Reset (clear) the active buffer",NULL}, 
     {"[6] Reset (clear) all buffers",NULL}, 
     {"[7] Enable/disable logging", NULL}, 
+    {"[8] Show buffer statistics", NULL},
+    {"[9] Resize the active buffer", NULL},
+    {"[a] List call sites", NULL},
+    {"[b] Enable/disable call sites", NULL},
+    {"[c] List threads", NULL},
+    {"[d] Show function latencies", NULL},
+    {"[e] Enable/disable latency measurement", NULL},
+    {"[f] Export the active buffer as Chrome trace JSON", NULL},
+    {"[g] Sample/rate limit call sites", NULL},
+    {"[h] Enable/disable deduplication of the active buffer", NULL},
+    {"[i] Print logs from the active buffer matching a field condition", NULL},
+    {"[j] Show metrics", NULL},
+    {"[k] Freeze/thaw the active buffer", NULL},
+    {"[l] Show snapshots", NULL},
+    {"[m] Add/clear trigger rules", NULL},
+    {"[n] Show the self instrumentation counters", NULL},
     {"[q] Close connection", NULL}
 };
 
@@ -105,6 +126,7 @@ void qlog_server_handle_connection(int socket){
     int fd = -1;
     int max_buf_num = 0;
     char answer[8] = {0};
+    char pattern[128] = {0};
                 
     fd = dup(socket);
     stream = fdopen(fd, "w");
@@ -117,7 +139,7 @@ void qlog_server_handle_connection(int socket){
     max_buf_num = qlog_internal_get_max_buf_num();
 
     while(loop) {
-        for (i = 0; i< 7; i++){
+        for (i = 0; i < (int) (sizeof(qlog_server_menu) / sizeof(qlog_server_menu[0])); i++){
             fprintf(stream, "%s\n", qlog_server_menu[i].menu_str);
             fflush(stream);
         }
@@ -188,6 +210,206 @@ void qlog_server_handle_connection(int socket){
                 fprintf(stream, "Current logging state: %s\n", qlog_get_status() ? "Enabled" : "Disabled");
                 qlog_server_print_cmd_footer(stream);
                 break;
+            case '8':
+                qlog_server_print_cmd_header(stream, "Buffer statistics");
+                qlog_display_print_buffer_stats(stream);
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case '9':
+                qlog_server_print_cmd_header(stream, "Resize the active buffer");
+                fprintf(stream, "Active buffer: %d\n", active_buffer);
+                fprintf(stream, "New size: ");
+                fflush(stream);
+                res = read_line(socket, answer, sizeof(answer));
+                if (res > 0) {
+                    char* tail = NULL;
+                    long int new_size = 0;
+                    errno = 0;
+                    new_size = strtol(answer, &tail, 0);
+                    if (errno || new_size <= 0){
+                        fprintf(stream, "Invalid buffer size.\n");
+                    } else if (qlog_resize_buffer(active_buffer, (size_t) new_size) == QLOG_RET_OK){
+                        fprintf(stream, "The buffer has been resized.\n");
+                    } else {
+                        fprintf(stream, "Error resizing the buffer.\n");
+                    }
+                }
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'a':
+                qlog_server_print_cmd_header(stream, "List call sites");
+                fprintf(stream, "Pattern (file:function:line, empty for all): ");
+                fflush(stream);
+                res = read_line(socket, pattern, sizeof(pattern));
+                if (res >= 0) {
+                    qlog_server_trim_line(pattern);
+                    qlog_display_print_sites(stream, pattern[0] != '\0' ? pattern : NULL);
+                }
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'b':
+                qlog_server_print_cmd_header(stream, "Enable/disable call sites");
+                fprintf(stream, "+pattern to enable, -pattern to disable (file:function:line): ");
+                fflush(stream);
+                res = read_line(socket, pattern, sizeof(pattern));
+                if (res > 0) {
+                    qlog_server_trim_line(pattern);
+                    if (pattern[0] == '+' || pattern[0] == '-'){
+                        res = qlog_site_set_enabled(pattern + 1, pattern[0] == '+');
+                        fprintf(stream, "%d call site(s) %s.\n", res, pattern[0] == '+' ? "enabled" : "disabled");
+                    } else {
+                        fprintf(stream, "Invalid pattern.\n");
+                    }
+                }
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'c':
+                qlog_server_print_cmd_header(stream, "Threads");
+                qlog_display_print_threads(stream);
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'd':
+                qlog_server_print_cmd_header(stream, "Function latencies");
+                qlog_display_print_latencies(stream);
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'e':
+                qlog_server_print_cmd_header(stream, "Enable/disable latency measurement");
+                qlog_latency_set_enabled(!qlog_latency_enabled);
+                fprintf(stream, "Latency measurement is %s.\n", qlog_latency_enabled ? "enabled" : "disabled");
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'f':
+                qlog_server_print_cmd_header(stream, "Export the active buffer as Chrome trace JSON");
+                fprintf(stream, "Active buffer: %d\n", active_buffer);
+                /* streamed to the client only, the server must not write files */
+                qlog_trace_export(stream, active_buffer);
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'g':
+                qlog_server_print_cmd_header(stream, "Sample/rate limit call sites");
+                fprintf(stream, "pattern sample_every rate burst (0 to switch off, e.g. qlog_test.c:test25 10 0 0): ");
+                fflush(stream);
+                res = read_line(socket, pattern, sizeof(pattern));
+                if (res > 0) {
+                    char site_pattern[128];
+                    unsigned int sample_every = 0, rate = 0, burst = 0;
+                    qlog_server_trim_line(pattern);
+                    if (sscanf(pattern, "%127s %u %u %u", site_pattern, &sample_every, &rate, &burst) == 4){
+                        qlog_site_set_sampling(site_pattern, sample_every);
+                        res = qlog_site_set_rate_limit(site_pattern, rate, burst);
+                        fprintf(stream, "%d call site(s) changed.\n", res);
+                    } else {
+                        fprintf(stream, "Invalid input.\n");
+                    }
+                }
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'h':
+                qlog_server_print_cmd_header(stream, "Enable/disable deduplication of the active buffer");
+                fprintf(stream, "Active buffer: %d\n", active_buffer);
+                res = qlog_get_dedup(active_buffer);
+                if (res >= 0 && qlog_set_dedup(active_buffer, !res) == QLOG_RET_OK){
+                    fprintf(stream, "Deduplication is %s.\n", res ? "disabled" : "enabled");
+                } else {
+                    fprintf(stream, "Error setting the deduplication.\n");
+                }
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'i':
+                qlog_server_print_cmd_header(stream, "Print logs matching a field condition");
+                fprintf(stream, "Condition (key op value, e.g. latency_us > 500): ");
+                fflush(stream);
+                res = read_line(socket, pattern, sizeof(pattern));
+                if (res > 0) {
+                    qlog_server_trim_line(pattern);
+                    res = qlog_display_print_buffer_filter(stream, active_buffer, pattern);
+                    if (res >= 0){
+                        fprintf(stream, "%d matching event(s).\n", res);
+                    } else {
+                        fprintf(stream, "Invalid condition.\n");
+                    }
+                }
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'j':
+                qlog_server_print_cmd_header(stream, "Show metrics");
+                qlog_display_print_metrics(stream);
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'k':
+                qlog_server_print_cmd_header(stream, "Freeze/thaw the active buffer");
+                fprintf(stream, "Active buffer: %d\n", active_buffer);
+                res = qlog_is_frozen(active_buffer);
+                if (res == 1){
+                    res = qlog_thaw_buffer(active_buffer);
+                    fprintf(stream, "%s\n", res == QLOG_RET_OK ? "The buffer has been thawed." : "Error thawing the buffer.");
+                } else {
+                    res = qlog_freeze_buffer(active_buffer, 0);
+                    fprintf(stream, "%s\n", res == QLOG_RET_OK ? "The buffer has been frozen." : "Error freezing the buffer.");
+                }
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'l':
+                qlog_server_print_cmd_header(stream, "Show snapshots");
+                qlog_display_print_snapshots(stream);
+                fprintf(stream, "Snapshot to print, 'c' to clear all (empty to skip): ");
+                fflush(stream);
+                res = read_line(socket, pattern, sizeof(pattern));
+                if (res > 0) {
+                    qlog_server_trim_line(pattern);
+                    if (strcmp(pattern, "c") == 0){
+                        qlog_snapshot_clear();
+                        fprintf(stream, "The snapshots have been cleared.\n");
+                    } else if (pattern[0] != '\0' &&
+                            qlog_snapshot_print(stream, strtoul(pattern, NULL, 10)) != QLOG_RET_OK){
+                        fprintf(stream, "Invalid snapshot.\n");
+                    }
+                }
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'm':
+                qlog_server_print_cmd_header(stream, "Add/clear trigger rules");
+                fprintf(stream, "site|prefix|ext <pattern> freeze <N>|snapshot, 'clear' to remove all\n"
+                        "(e.g. prefix ERROR freeze 10): ");
+                fflush(stream);
+                res = read_line(socket, pattern, sizeof(pattern));
+                if (res > 0) {
+                    qlog_trigger_rule_t rule;
+                    qlog_server_trim_line(pattern);
+                    if (strcmp(pattern, "clear") == 0){
+                        qlog_trigger_clear();
+                        fprintf(stream, "The trigger rules have been removed.\n");
+                    } else if (qlog_trigger_parse(pattern, &rule) == QLOG_RET_OK &&
+                            (res = qlog_trigger_add(&rule)) >= 0){
+                        if (rule.match == QLOG_TRIGGER_SITE){
+                            fprintf(stream, "The rule has been added, %d call site(s) matching.\n", res);
+                        } else {
+                            fprintf(stream, "The rule has been added.\n");
+                        }
+                    } else {
+                        fprintf(stream, "Invalid rule.\n");
+                    }
+                }
+                qlog_server_print_cmd_footer(stream);
+                break;
+            case 'n':
+                qlog_server_print_cmd_header(stream, "Show the self instrumentation counters");
+                qlog_display_debug_print_instr(stream);
+#ifdef QLOG_SELF_INSTR
+                fprintf(stream, "'r' to reset the counters (empty to skip): ");
+                fflush(stream);
+                res = read_line(socket, pattern, sizeof(pattern));
+                if (res > 0) {
+                    qlog_server_trim_line(pattern);
+                    if (strcmp(pattern, "r") == 0){
+                        qlog_instr_reset();
+                        fprintf(stream, "The counters have been reset.\n");
+                    }
+                }
+#endif
+                qlog_server_print_cmd_footer(stream);
+                break;
             case 'q':
                 loop = 0;
                 break;
@@ -277,6 +499,14 @@ void qlog_menu_error(void){}
 
 
 
+/* removes the trailing CR sent by telnet */
+void qlog_server_trim_line(char* line){
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' ')){
+        line[--len] = '\0';
+    }
+}
+
 void qlog_server_print_cmd_header(FILE* stream, const char* message){
     if (stream){
         fprintf(stream, "\n================================================================================\n");
@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_site.c
+ * \brief Registry of the log call sites.
+ *
+ * The QLOG macros put a pointer to their call site descriptor into the
+ * qlog_sites section. The linker provides the start and stop symbols of
+ * the section, the table between them contains all the call sites of the
+ * program. The symbols are weak so a program without call sites links too.
+ *
+ * The call sites can be enabled/disabled at runtime by a pattern of
+ * file:function:line, the QLOG macros check the enabled flag of the call
+ * site before doing anything else.
+ *
+ * A call site can be sampled (only every Nth call is logged) and/or rate
+ * limited by a token bucket. The state of the limits is kept per thread
+ * (a small thread local table indexed by the call site address) so the
+ * hot call sites do not share any written cache line between the threads.
+ * The number of the calls suppressed by the limits is stored in the next
+ * event of the call site logged by the same thread.
+ *
+ * The hits of the call sites are counted per thread too: every logging
+ * thread gets a counter block indexed by the position of the call site in
+ * the table (stored in the descriptor once, before the first hit). The
+ * blocks (see qlog_thread_block.h) are summed when displayed; the hits of
+ * an exiting thread are folded into the retired counters.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_site.h"
+#include "qlog_thread_block.h"
+
+extern qlog_site_t* const __start_qlog_sites[] __attribute__ ((weak));
+extern qlog_site_t* const __stop_qlog_sites[] __attribute__ ((weak));
+
+#define QLOG_SITE_LIMIT_SLOTS   64  /* limited call sites tracked per thread (power of 2) */
+#define QLOG_SITE_LIMIT_PROBES  4
+
+/* the cheap clock is precise enough for the rate limits */
+#ifdef CLOCK_MONOTONIC_COARSE
+#define QLOG_SITE_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define QLOG_SITE_CLOCK CLOCK_MONOTONIC
+#endif
+
+typedef struct qlog_site_limit_t {
+    const qlog_site_t* site;
+    uint32_t count;         /* position in the sampling period */
+    uint32_t suppressed;    /* calls suppressed since the last logged one */
+    uint64_t credit;        /* token bucket credit in ns */
+    uint64_t last;          /* time of the last refill in ns, 0 if unused */
+} qlog_site_limit_t;
+
+static __thread qlog_site_limit_t qlog_site_limits[QLOG_SITE_LIMIT_SLOTS];
+static __thread const qlog_site_t* qlog_site_pending_site = NULL;
+static __thread uint32_t qlog_site_pending_suppressed = 0;
+
+__thread unsigned long* qlog_site_thread_hits = NULL;
+
+static void qlog_site_hits_exit(void* data);
+
+static unsigned long* qlog_site_retired_hits = NULL;   /* hits of the exited threads */
+static size_t qlog_site_hit_num = 0;
+static pthread_mutex_t qlog_site_hits_lock = PTHREAD_MUTEX_INITIALIZER;
+static qlog_thread_block_registry_t qlog_site_hit_blocks = QLOG_THREAD_BLOCK_REGISTRY_INIT(
+        0, qlog_site_hits_exit, &qlog_site_hits_lock);
+static pthread_once_t qlog_site_hits_once = PTHREAD_ONCE_INIT;
+
+/**
+ * \brief Provides the number of the registered call sites
+ */
+size_t qlog_site_count(void){
+    if (__start_qlog_sites == NULL || __stop_qlog_sites == NULL){
+        return 0;
+    }
+    return __stop_qlog_sites - __start_qlog_sites;
+}
+
+/**
+ * \brief Provides a call site descriptor by its index in the site table
+ *
+ * \param index The index of the call site (0 .. qlog_site_count() - 1)
+ * \return Pointer to the call site descriptor or NULL if the index is invalid
+ */
+qlog_site_t* qlog_site_get(size_t index){
+    if (index >= qlog_site_count()){
+        return NULL;
+    }
+    return __start_qlog_sites[index];
+}
+
+/**
+ * \brief Checks if a call site matches a pattern
+ *
+ * \param site The call site descriptor
+ * \param pattern The pattern in file:function:line format
+ * \return 1 if the call site matches, 0 otherwise
+ *
+ * The file and function parts are shell wildcard patterns, the file part
+ * is matched against the full path and the base name of the source file.
+ * The missing or empty parts match everything, e.g. "qlog_test.c",
+ * "*:test10_*" or "qlog_test.c::357".
+ */
+int qlog_site_match(const qlog_site_t* site, const char* pattern){
+    char buffer[256];
+    char *file = NULL, *function = NULL, *line = NULL;
+    const char* base_name = NULL;
+
+    if (site == NULL || pattern == NULL){
+        return 0;
+    }
+
+    memset(buffer, 0, sizeof(buffer));
+    snprintf(buffer, sizeof(buffer), "%s", pattern);
+    file = buffer;
+    function = strchr(file, ':');
+    if (function){
+        *function++ = '\0';
+        line = strchr(function, ':');
+        if (line){
+            *line++ = '\0';
+        }
+    }
+
+    if (file[0] != '\0'){
+        base_name = strrchr(site->file, '/');
+        base_name = base_name ? base_name + 1 : site->file;
+        if (fnmatch(file, site->file, 0) != 0 && fnmatch(file, base_name, 0) != 0){
+            return 0;
+        }
+    }
+    if (function && function[0] != '\0' && fnmatch(function, site->function, 0) != 0){
+        return 0;
+    }
+    if (line && line[0] != '\0' && strcmp(line, "*") != 0 &&
+            strtoul(line, NULL, 10) != site->line){
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * \brief Enables or disables the call sites matching a pattern
+ *
+ * \param pattern The pattern in file:function:line format (see qlog_site_match)
+ * \param enabled 1 to enable, 0 to disable the call sites
+ * \return The number of the matching call sites
+ */
+int qlog_site_set_enabled(const char* pattern, int enabled){
+    size_t i = 0;
+    int matched = 0;
+    qlog_site_t* site = NULL;
+
+    for (i = 0; i < qlog_site_count(); i++){
+        site = qlog_site_get(i);
+        if (qlog_site_match(site, pattern)){
+            site->enabled = enabled ? 1 : 0;
+            matched++;
+        }
+    }
+    return matched;
+}
+
+/* folds the hits of an exiting thread into the retired counters */
+static void qlog_site_hits_exit(void* data){
+    const unsigned long* hits = (const unsigned long*) data;
+    size_t i = 0;
+
+    for (i = 0; qlog_site_retired_hits && i < qlog_site_hit_num; i++){
+        qlog_site_retired_hits[i] += hits[i];
+    }
+    qlog_site_thread_hits = NULL;
+}
+
+/* numbers the call sites of the table, runs once before the first hit */
+static void qlog_site_hits_setup(void){
+    qlog_site_t* site = NULL;
+    size_t i = 0;
+
+    qlog_site_hit_num = qlog_site_count();
+    for (i = 0; i < qlog_site_hit_num; i++){
+        site = qlog_site_get(i);
+        if (site){
+            site->index = (uint32_t) (i + 1);
+        }
+    }
+    qlog_site_retired_hits = calloc(qlog_site_hit_num ? qlog_site_hit_num : 1, sizeof(unsigned long));
+    qlog_site_hit_blocks.size = qlog_site_hit_num * sizeof(unsigned long);
+}
+
+/**
+ * \brief Sets up the hit counters of the calling thread
+ *
+ * \return The hit counters of the thread or NULL if out of memory
+ *
+ * Called by qlog_site_hit() on the first hit in a thread.
+ */
+unsigned long* qlog_site_hits_init(void){
+    pthread_once(&qlog_site_hits_once, qlog_site_hits_setup);
+    qlog_site_thread_hits = qlog_thread_block_get(&qlog_site_hit_blocks);
+    return qlog_site_thread_hits;
+}
+
+/**
+ * \brief Provides the number of the events logged by a call site
+ *
+ * \param site The call site descriptor
+ * \return The total of the hit counters of the threads
+ */
+unsigned long qlog_site_get_hits(const qlog_site_t* site){
+    const qlog_thread_block_t* block = NULL;
+    unsigned long total = 0;
+    size_t index = 0;
+
+    if (site == NULL || site->index == 0){
+        return 0;
+    }
+    index = site->index - 1;
+    pthread_mutex_lock(&qlog_site_hits_lock);
+    if (qlog_site_retired_hits){
+        total = qlog_site_retired_hits[index];
+    }
+    for (block = qlog_site_hit_blocks.blocks; block; block = block->next){
+        total += __atomic_load_n(&QLOG_THREAD_BLOCK_DATA(block, const unsigned long)[index], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&qlog_site_hits_lock);
+    return total;
+}
+
+/* the limit state of a call site in the thread local table. If the probed
+ * slots are all taken, the state of another call site is dropped. */
+static qlog_site_limit_t* qlog_site_get_limit(const qlog_site_t* site){
+    qlog_site_limit_t* slot = NULL;
+    qlog_site_limit_t* free_slot = NULL;
+    unsigned int index = (unsigned int) (((uintptr_t) site * 0x9E3779B97F4A7C15ULL) >> 58);
+    unsigned int i = 0;
+
+    for (i = 0; i < QLOG_SITE_LIMIT_PROBES; i++){
+        slot = &qlog_site_limits[(index + i) & (QLOG_SITE_LIMIT_SLOTS - 1)];
+        if (slot->site == site){
+            return slot;
+        }
+        if (slot->site == NULL && free_slot == NULL){
+            free_slot = slot;
+        }
+    }
+    slot = free_slot ? free_slot : &qlog_site_limits[index & (QLOG_SITE_LIMIT_SLOTS - 1)];
+    memset(slot, 0, sizeof(qlog_site_limit_t));
+    slot->site = site;
+    return slot;
+}
+
+/**
+ * \brief Decides if a call of a limited call site is logged
+ *
+ * \param site The call site descriptor
+ * \return 1 if the call is to be logged, 0 if it is suppressed
+ *
+ * Called by the QLOG macros for the call sites flagged QLOG_SITE_LIMITED.
+ * The sampling is applied first, the calls passing it take a token from
+ * the bucket of the call site. The bucket starts full.
+ */
+int qlog_site_admit(qlog_site_t* site){
+    qlog_site_limit_t* limit = qlog_site_get_limit(site);
+    uint32_t sample_every = site->sample_every;
+    uint32_t rate = site->rate;
+    uint64_t now = 0, cost = 0, capacity = 0;
+    struct timespec ts;
+
+    if (sample_every > 1){
+        if (limit->count++ != 0){
+            if (limit->count >= sample_every){
+                limit->count = 0;
+            }
+            limit->suppressed++;
+            return 0;
+        }
+    }
+
+    if (rate > 0){
+        clock_gettime(QLOG_SITE_CLOCK, &ts);
+        now = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        cost = 1000000000ULL / rate;
+        capacity = cost * (site->burst ? site->burst : 1);
+        if (limit->last == 0){
+            limit->credit = capacity;
+        } else {
+            limit->credit += now - limit->last;
+            if (limit->credit > capacity){
+                limit->credit = capacity;
+            }
+        }
+        limit->last = now;
+        if (limit->credit < cost){
+            limit->suppressed++;
+            return 0;
+        }
+        limit->credit -= cost;
+    }
+
+    qlog_site_pending_site = site;
+    qlog_site_pending_suppressed = limit->suppressed;
+    limit->suppressed = 0;
+    return 1;
+}
+
+/**
+ * \brief Provides the number of calls suppressed before the current event
+ *
+ * \param site The call site of the event being logged
+ * \return The number of calls suppressed since the previous logged event of
+ *         the call site in the calling thread
+ */
+uint32_t qlog_site_take_suppressed(const qlog_site_t* site){
+    uint32_t suppressed = 0;
+
+    if (site == qlog_site_pending_site){
+        suppressed = qlog_site_pending_suppressed;
+        qlog_site_pending_site = NULL;
+        qlog_site_pending_suppressed = 0;
+    }
+    return suppressed;
+}
+
+/* keeps the limited flag in sync with the limits of the call site */
+static void qlog_site_update_limited(qlog_site_t* site){
+    if (site->sample_every > 1 || site->rate > 0){
+        __sync_fetch_and_or(&site->flags, QLOG_SITE_LIMITED);
+    } else {
+        __sync_fetch_and_and(&site->flags, (uint8_t) ~QLOG_SITE_LIMITED);
+    }
+}
+
+/**
+ * \brief Sets the sampling of the call sites matching a pattern
+ *
+ * \param pattern The pattern in file:function:line format (see qlog_site_match)
+ * \param sample_every Only every Nth call is logged, 0 or 1 to log all calls
+ * \return The number of the call sites changed
+ *
+ * The ENTRY/LEAVE call sites are not changed, they have to stay paired.
+ */
+int qlog_site_set_sampling(const char* pattern, unsigned int sample_every){
+    size_t i = 0;
+    int matched = 0;
+    qlog_site_t* site = NULL;
+
+    for (i = 0; i < qlog_site_count(); i++){
+        site = qlog_site_get(i);
+        if ((site->flags & (QLOG_SITE_ENTRY | QLOG_SITE_LEAVE)) == 0 && qlog_site_match(site, pattern)){
+            site->sample_every = sample_every;
+            qlog_site_update_limited(site);
+            matched++;
+        }
+    }
+    return matched;
+}
+
+/**
+ * \brief Sets the token bucket rate limit of the call sites matching a pattern
+ *
+ * \param pattern The pattern in file:function:line format (see qlog_site_match)
+ * \param rate The number of events per second per thread, 0 for no limit
+ * \param burst The number of events logged in a burst (size of the bucket)
+ * \return The number of the call sites changed
+ *
+ * The ENTRY/LEAVE call sites are not changed, they have to stay paired.
+ */
+int qlog_site_set_rate_limit(const char* pattern, unsigned int rate, unsigned int burst){
+    size_t i = 0;
+    int matched = 0;
+    qlog_site_t* site = NULL;
+
+    for (i = 0; i < qlog_site_count(); i++){
+        site = qlog_site_get(i);
+        if ((site->flags & (QLOG_SITE_ENTRY | QLOG_SITE_LEAVE)) == 0 && qlog_site_match(site, pattern)){
+            site->burst = burst;
+            site->rate = rate;
+            qlog_site_update_limited(site);
+            matched++;
+        }
+    }
+    return matched;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_stack.c
+ * \brief Interned stack traces.
+ *
+ * The stacks are looked up in the hash table without locking, the new
+ * stacks are inserted under a mutex. The entries are never released, they
+ * are fully initialized before being linked into the table, so the readers
+ * (and the crash dump) can use them at any time.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <execinfo.h>
+#include <pthread.h>
+
+#include "qlog_stack.h"
+
+static qlog_stack_t* qlog_stack_buckets[QLOG_STACK_HASH_SIZE];
+static qlog_stack_t* qlog_stacks[QLOG_MAX_STACK_NUM];
+static size_t qlog_stack_num = 1;
+static pthread_mutex_t qlog_stack_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int qlog_stack_depth = QLOG_STACK_DEFAULT_DEPTH;
+static unsigned int qlog_stack_skip = 0;
+
+/* FNV-1a over the frame addresses */
+static uint32_t qlog_stack_hash(void* const* frames, unsigned int depth){
+    uint32_t hash = 2166136261u;
+    uintptr_t value = 0;
+    unsigned int i = 0, j = 0;
+
+    for (i = 0; i < depth; i++){
+        value = (uintptr_t) frames[i];
+        for (j = 0; j < sizeof(value); j++){
+            hash ^= (uint32_t) (value & 0xff);
+            hash *= 16777619u;
+            value >>= 8;
+        }
+    }
+    return hash;
+}
+
+static qlog_stack_t* qlog_stack_find(void* const* frames, unsigned int depth, uint32_t hash){
+    qlog_stack_t* stack = NULL;
+
+    for (stack = qlog_stack_buckets[hash & (QLOG_STACK_HASH_SIZE - 1)]; stack; stack = stack->next){
+        if (stack->hash == hash && stack->depth == depth &&
+                memcmp(stack->frames, frames, depth * sizeof(void*)) == 0){
+            return stack;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Sets the parameters of the stack capture
+ *
+ * \param max_depth The maximum number of stored frames (1..QLOG_STACK_MAX_DEPTH)
+ * \param skip The number of innermost frames skipped (0..QLOG_STACK_MAX_SKIP),
+ *             e.g. the frames of a logging wrapper function
+ */
+void qlog_stack_set_capture(unsigned int max_depth, unsigned int skip){
+    if (max_depth == 0){
+        max_depth = 1;
+    } else if (max_depth > QLOG_STACK_MAX_DEPTH){
+        max_depth = QLOG_STACK_MAX_DEPTH;
+    }
+    qlog_stack_depth = max_depth;
+    qlog_stack_skip = skip > QLOG_STACK_MAX_SKIP ? QLOG_STACK_MAX_SKIP : skip;
+}
+
+/**
+ * \brief Captures and interns the stack of the caller
+ *
+ * \return The id of the stack, QLOG_STACK_ID_NONE if it could not be stored
+ *
+ * The frame of this function is not stored.
+ */
+qlog_stack_id_t qlog_stack_capture(void){
+    void* frames[QLOG_STACK_MAX_DEPTH + QLOG_STACK_MAX_SKIP + 1];
+    unsigned int skip = qlog_stack_skip + 1;
+    int size = 0;
+
+    size = backtrace(frames, qlog_stack_depth + skip);
+    if (size <= (int) skip){
+        return QLOG_STACK_ID_NONE;
+    }
+    return qlog_stack_intern(frames + skip, size - skip);
+}
+
+/**
+ * \brief Provides the id of a stack, stores the stack if it is new
+ *
+ * \param frames The return addresses, innermost first
+ * \param depth The number of frames
+ * \return The id of the stack, QLOG_STACK_ID_NONE if the table is full
+ */
+qlog_stack_id_t qlog_stack_intern(void* const* frames, unsigned int depth){
+    qlog_stack_t* stack = NULL;
+    qlog_stack_id_t id = QLOG_STACK_ID_NONE;
+    uint32_t hash = 0;
+    size_t bucket = 0;
+
+    if (frames == NULL || depth == 0){
+        return QLOG_STACK_ID_NONE;
+    }
+    if (depth > QLOG_STACK_MAX_DEPTH){
+        depth = QLOG_STACK_MAX_DEPTH;
+    }
+
+    hash = qlog_stack_hash(frames, depth);
+    stack = qlog_stack_find(frames, depth, hash);
+    if (stack){
+        return stack->id;
+    }
+
+    pthread_mutex_lock(&qlog_stack_lock);
+    stack = qlog_stack_find(frames, depth, hash);
+    if (stack){
+        id = stack->id;
+    } else if (qlog_stack_num < QLOG_MAX_STACK_NUM){
+        stack = malloc(sizeof(qlog_stack_t) + depth * sizeof(void*));
+        if (stack){
+            bucket = hash & (QLOG_STACK_HASH_SIZE - 1);
+            stack->id = (qlog_stack_id_t) qlog_stack_num;
+            stack->hash = hash;
+            stack->depth = depth;
+            memcpy(stack->frames, frames, depth * sizeof(void*));
+            stack->next = qlog_stack_buckets[bucket];
+            qlog_stacks[stack->id] = stack;
+            /* publish the filled entry */
+            __sync_synchronize();
+            qlog_stack_buckets[bucket] = stack;
+            qlog_stack_num++;
+            id = stack->id;
+        }
+    }
+    pthread_mutex_unlock(&qlog_stack_lock);
+    return id;
+}
+
+/**
+ * \brief Provides a stored stack
+ *
+ * \param id The stack id
+ * \return The stack or NULL if the id is not valid
+ *
+ * Async-signal-safe, used by the crash dump.
+ */
+const qlog_stack_t* qlog_stack_get(qlog_stack_id_t id){
+    if (id == QLOG_STACK_ID_NONE || id >= qlog_stack_num){
+        return NULL;
+    }
+    return qlog_stacks[id];
+}
+
+/**
+ * \brief Provides the number of the stored stacks
+ */
+size_t qlog_stack_count(void){
+    return qlog_stack_num - 1;
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_symbol.c
+ * \brief Cached symbolization of code addresses.
+ *
+ * The addresses are resolved by dladdr() on first use and the formatted
+ * string is kept in a process wide hash table. The C++ names are demangled
+ * if the program has the C++ runtime loaded (__cxa_demangle is looked up
+ * dynamically, no C++ dependency).
+ * The cache is flushed when a shared object has been loaded or unloaded
+ * (dl_iterate_phdr adds/subs counters), so a reused address range never
+ * gets a stale name. The counters are checked by qlog_symbol_refresh()
+ * once per display or export, not for every resolved frame.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+
+#include "qlog_symbol.h"
+
+typedef char* (*qlog_demangle_fn_t)(const char* name, char* buffer, size_t* length, int* status);
+
+typedef struct qlog_symbol_t {
+    struct qlog_symbol_t* next;     /* next symbol in the hash bucket */
+    void* address;
+    char text[];
+} qlog_symbol_t;
+
+typedef struct qlog_symbol_gen_t {
+    unsigned long long adds;
+    unsigned long long subs;
+} qlog_symbol_gen_t;
+
+static qlog_symbol_t* qlog_symbol_buckets[QLOG_SYMBOL_HASH_SIZE];
+static size_t qlog_symbol_num = 0;
+static qlog_symbol_gen_t qlog_symbol_gen = {0, 0};
+static pthread_mutex_t qlog_symbol_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t qlog_symbol_once = PTHREAD_ONCE_INIT;
+static qlog_demangle_fn_t qlog_symbol_demangle = NULL;
+
+static void qlog_symbol_init(void){
+    /* POSIX way of converting the object pointer returned by dlsym */
+    *(void**) &qlog_symbol_demangle = dlsym(RTLD_DEFAULT, "__cxa_demangle");
+}
+
+/* the counters are the same for every object, the first one is enough */
+static int qlog_symbol_gen_cb(struct dl_phdr_info* info, size_t size, void* data){
+    qlog_symbol_gen_t* gen = (qlog_symbol_gen_t*) data;
+    if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)){
+        gen->adds = info->dlpi_adds;
+        gen->subs = info->dlpi_subs;
+    }
+    return 1;
+}
+
+static void qlog_symbol_flush_locked(void){
+    qlog_symbol_t *symbol = NULL, *next = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < QLOG_SYMBOL_HASH_SIZE; i++){
+        for (symbol = qlog_symbol_buckets[i]; symbol; symbol = next){
+            next = symbol->next;
+            free(symbol);
+        }
+        qlog_symbol_buckets[i] = NULL;
+    }
+    qlog_symbol_num = 0;
+}
+
+static size_t qlog_symbol_hash(void* address){
+    uintptr_t value = (uintptr_t) address;
+    value ^= value >> 17;
+    value *= 0x9e3779b1u;
+    return (value >> 7) & (QLOG_SYMBOL_HASH_SIZE - 1);
+}
+
+/* formats the address like backtrace_symbols: module(symbol+0xoff) [0xaddr] */
+static void qlog_symbol_format(void* address, char* buffer, size_t size){
+    Dl_info info;
+    char* demangled = NULL;
+    const char* name = NULL;
+    const char* module = NULL;
+    int status = -1;
+
+    memset(&info, 0, sizeof(info));
+    if (dladdr(address, &info) == 0){
+        snprintf(buffer, size, "?? [%p]", address);
+        return;
+    }
+    module = info.dli_fname ? info.dli_fname : "??";
+    name = info.dli_sname;
+    if (name && qlog_symbol_demangle && name[0] == '_' && name[1] == 'Z'){
+        demangled = qlog_symbol_demangle(name, NULL, NULL, &status);
+        if (status == 0 && demangled){
+            name = demangled;
+        }
+    }
+    if (name){
+        snprintf(buffer, size, "%s(%s+0x%lx) [%p]", module, name,
+                (unsigned long) ((uintptr_t) address - (uintptr_t) info.dli_saddr), address);
+    } else {
+        snprintf(buffer, size, "%s(+0x%lx) [%p]", module,
+                (unsigned long) ((uintptr_t) address - (uintptr_t) info.dli_fbase), address);
+    }
+    free(demangled);
+}
+
+/**
+ * \brief Resolves a code address to a symbol string
+ *
+ * \param address The code address
+ * \param buffer The symbol string is stored here
+ * \param size The size of the buffer
+ * \return The length of the symbol string
+ *
+ * The string is "module(symbol+0xoffset) [address]", the symbol is
+ * demangled. Only the first lookup of an address calls dladdr. Call
+ * qlog_symbol_refresh() before resolving a batch of addresses.
+ */
+size_t qlog_symbol_resolve(void* address, char* buffer, size_t size){
+    char text[QLOG_SYMBOL_STR_SIZE];
+    qlog_symbol_t* symbol = NULL;
+    size_t bucket = 0, len = 0;
+
+    if (buffer == NULL || size == 0){
+        return 0;
+    }
+    pthread_once(&qlog_symbol_once, qlog_symbol_init);
+    bucket = qlog_symbol_hash(address);
+
+    pthread_mutex_lock(&qlog_symbol_lock);
+    for (symbol = qlog_symbol_buckets[bucket]; symbol; symbol = symbol->next){
+        if (symbol->address == address){
+            break;
+        }
+    }
+    if (symbol == NULL){
+        qlog_symbol_format(address, text, sizeof(text));
+        len = strlen(text);
+        if (qlog_symbol_num >= QLOG_SYMBOL_MAX_NUM){
+            qlog_symbol_flush_locked();
+        }
+        symbol = malloc(sizeof(qlog_symbol_t) + len + 1);
+        if (symbol == NULL){
+            pthread_mutex_unlock(&qlog_symbol_lock);
+            snprintf(buffer, size, "%s", text);
+            return strlen(buffer);
+        }
+        symbol->address = address;
+        memcpy(symbol->text, text, len + 1);
+        symbol->next = qlog_symbol_buckets[bucket];
+        qlog_symbol_buckets[bucket] = symbol;
+        qlog_symbol_num++;
+    }
+    len = strlen(symbol->text);
+    if (len >= size){
+        len = size - 1;
+    }
+    memcpy(buffer, symbol->text, len);
+    buffer[len] = '\0';
+    pthread_mutex_unlock(&qlog_symbol_lock);
+    return len;
+}
+
+/**
+ * \brief Drops the cached symbols if the loaded modules have changed
+ *
+ * Called before a buffer is displayed or exported: a shared object loaded
+ * or unloaded since the last call may have reused the cached addresses.
+ */
+void qlog_symbol_refresh(void){
+    qlog_symbol_gen_t gen = {0, 0};
+
+    dl_iterate_phdr(qlog_symbol_gen_cb, &gen);
+    pthread_mutex_lock(&qlog_symbol_lock);
+    if (gen.adds != qlog_symbol_gen.adds || gen.subs != qlog_symbol_gen.subs){
+        qlog_symbol_flush_locked();
+        qlog_symbol_gen = gen;
+    }
+    pthread_mutex_unlock(&qlog_symbol_lock);
+}
+
+/**
+ * \brief Drops all the cached symbols
+ */
+void qlog_symbol_flush(void){
+    pthread_mutex_lock(&qlog_symbol_lock);
+    qlog_symbol_flush_locked();
+    pthread_mutex_unlock(&qlog_symbol_lock);
+}
@@ -15,6 +15,7 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <string.h>
+#include <signal.h>
 
 #include "qlog.h"
 #include "qlog_ext.h"
@@ -23,6 +24,16 @@
 #include "qlog_display.h"
 #include "qlog_display_debug.h"
 #include "qlog_utils.h"
+#include "qlog_crash.h"
+#include "qlog_trace.h"
+#include "qlog_metric.h"
+#include "qlog_trigger.h"
+#ifdef QLOG_FTRACE
+#include "qlog_ftrace.h"
+#endif
+#ifdef QLOG_SELF_INSTR
+#include "qlog_instr.h"
+#endif
 
 
 int start = 0;
@@ -365,6 +376,415 @@ void test10(void){
 
 }
 
+void test11(void){
+    int i = 0;
+    qlog_stats_t stats;
+    qlog_init(20);
+    qlog_thread_init("main thread");
+    for (i = 0; i < 50; i++){
+        QLOG("statistics test message");
+        QLOG_HEX(&i, sizeof(i));
+    }
+    qlog_get_stats(0, &stats);
+    printf("events: %lu, bytes: %lu, ext bytes: %lu, wraps: %lu\n",
+            stats.events, stats.bytes, stats.ext_bytes, stats.wraps);
+    qlog_display_print_buffer_stats(stdout);
+    qlog_cleanup();
+}
+
+void test12(void){
+    int i = 0;
+    char message[64];
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    for (i = 0; i < 15; i++){
+        snprintf(message, sizeof(message), "resize test message %d", i);
+        QLOG(message);
+    }
+    printf("(*) Shrink the buffer to 5 events\n");
+    qlog_resize_buffer(0, 5);
+    qlog_display_print_buffer(stdout);
+    printf("(*) Grow the buffer to 20 events\n");
+    qlog_resize_buffer(0, 20);
+    QLOG("message after resize");
+    qlog_display_print_buffer(stdout);
+    qlog_cleanup();
+}
+
+void test13(void){
+    unsigned char dump[20];
+    size_t i = 0;
+
+    for (i = 0; i < sizeof(dump); i++){
+        dump[i] = (unsigned char) i;
+    }
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    QLOG("crash dump test message");
+    QLOG_HEX(dump, sizeof(dump));
+    QLOG_BT;
+    qlog_crash_handler_install(STDOUT_FILENO, QLOG_CRASH_FATAL | QLOG_CRASH_ON_DEMAND);
+    printf("(*) On-demand dump (SIGUSR1)\n");
+    fflush(stdout);
+    raise(SIGUSR1);
+    qlog_crash_handler_uninstall();
+    qlog_cleanup();
+}
+
+void test14(void){
+    size_t i = 0;
+    qlog_site_t* site = NULL;
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    test10_c(3);
+    QLOG_VA("formatted message: %d", 14);
+    qlog_display_print_buffer(stdout);
+    for (i = 0; i < qlog_site_count(); i++){
+        site = qlog_site_get(i);
+        printf("site #%lu: %s:%s:%u level %d: %s\n", (unsigned long) i, site->file,
+                site->function, site->line, site->level, site->message ? site->message : "-");
+    }
+    qlog_cleanup();
+}
+
+void test15(void){
+    int i = 0;
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    QLOG_VA("logged: %d", i++);
+    qlog_toggle_status();
+    QLOG_VA("not logged, not formatted: %d", i++);
+    qlog_toggle_status();
+    qlog_set_level(QLOG_LEVEL_WARNING);
+    QLOG_VA("not logged, not formatted: %d", i++);
+    QLOG_VA_LVL(QLOG_LEVEL_ERROR, "logged: %d", i++);
+    printf("arguments evaluated: %d (expected 2)\n", i);
+    qlog_display_print_buffer(stdout);
+    qlog_cleanup();
+}
+
+void test16(void){
+    int i = 0;
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    printf("disabled: %d\n", qlog_site_set_enabled("qlog_test.c:test16", 0));
+    QLOG_VA("not logged, not formatted: %d", i++);
+    qlog_site_set_enabled("*:test16:*", 1);
+    QLOG_VA("logged: %d", i++);
+    qlog_display_print_sites(stdout, "qlog_test.c:test16");
+    qlog_display_print_buffer(stdout);
+    qlog_cleanup();
+}
+
+void test17(void){
+    qlog_reservation_t res;
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    if (qlog_reserve(0, 16, &res) == QLOG_RET_OK){
+        qlog_commit(&res, snprintf(res.data, res.size, "reserved message, cut at 15 chars"));
+    }
+    QLOG_VA("formatted into the ring: %d", 17);
+    qlog_display_print_buffer(stdout);
+    qlog_cleanup();
+}
+
+void* test18_thread(void* data){
+    qlog_thread_init((const char*) data);
+    QLOG("logged from an exited thread");
+    return NULL;
+}
+
+void test18(void){
+    pthread_t thread;
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    pthread_create(&thread, NULL, test18_thread, "short lived");
+    pthread_join(thread, NULL);
+    qlog_log_long("named only", __func__, __LINE__, "thread name passed explicitly");
+    qlog_display_print_buffer(stdout);
+    qlog_display_print_threads(stdout);
+    qlog_cleanup();
+}
+
+void test19(void){
+    int i = 0;
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    qlog_stack_set_capture(8, 0);
+    for (i = 0; i < 100; i++){
+        QLOG_BT;
+    }
+    printf("stacks stored: %lu (expected 1)\n", (unsigned long) qlog_stack_count());
+    qlog_display_print_buffer(stdout);
+    qlog_cleanup();
+}
+
+void test20(void){
+    unsigned char data[100];
+    int i = 0;
+    for (i = 0; i < (int) sizeof(data); i++){
+        data[i] = (unsigned char) i;
+    }
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    QLOG_HEX(data, sizeof(data));
+    qlog_display_print_buffer(stdout);
+    qlog_ext_enable_compact_hex();
+    qlog_display_print_buffer(stdout);
+    qlog_ext_disable_compact_hex();
+    qlog_cleanup();
+}
+
+void test21(void){
+    char header[] = "HEADER";
+    char body[] = "body of the packet";
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header) - 1;
+    iov[1].iov_base = body;
+    iov[1].iov_len = sizeof(body) - 1;
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    qlog_ext_logv(QLOG_EXT_EVENT_TYPE_HEXDUMP, iov, 2, 0, "header + body");
+    qlog_ext_logv(QLOG_EXT_EVENT_TYPE_HEXDUMP, iov, 2, 10, "capped at 10 bytes");
+    qlog_display_print_buffer(stdout);
+    qlog_crash_dump(STDOUT_FILENO);
+    qlog_cleanup();
+}
+
+int test22_func(int i){
+    QLOG_ENTRY;
+    usleep(i * 100);
+    QLOG_RET_EXP(i);
+}
+
+void test22(void){
+    int i = 0;
+    qlog_init(10);
+    qlog_thread_init("main thread");
+    qlog_latency_set_enabled(1);
+    for (i = 0; i < 20; i++){
+        test22_func(i);
+    }
+    qlog_latency_set_enabled(0);
+    qlog_display_print_latencies(stdout);
+    qlog_cleanup();
+}
+
+void test23(void){
+    int i = 0;
+    qlog_init(100);
+    qlog_thread_init("main thread");
+    for (i = 0; i < 3; i++){
+        test22_func(i);
+        QLOG_VA("instant event %d", i);
+    }
+    qlog_trace_export(stdout, 0);
+    qlog_cleanup();
+}
+
+#ifdef QLOG_FTRACE
+/* build the test with -finstrument-functions to trace every function,
+ * the hooks are called directly here */
+void test24(void){
+    int buffer_id = 0;
+    void* func22 = (void*) (uintptr_t) test22_func;
+    void* func23 = (void*) (uintptr_t) test23;
+    void* caller = (void*) (uintptr_t) test24;
+
+    qlog_init(100);
+    qlog_thread_init("main thread");
+    buffer_id = qlog_ftrace_start(100);
+    qlog_ftrace_deny_range(func23, (char*) func23 + 1);
+    __cyg_profile_func_enter(func22, caller);
+    __cyg_profile_func_enter(func23, caller);
+    __cyg_profile_func_exit(func22, caller);
+    qlog_ftrace_stop();
+    qlog_display_print_buffer_id(stdout, buffer_id);
+    qlog_trace_export(stdout, buffer_id);
+    qlog_cleanup();
+}
+#endif
+
+
+void test25(void){
+    int i = 0;
+    qlog_init(100);
+    qlog_thread_init("main thread");
+    for (i = 0; i < 1000; i++){
+        QLOG_SAMPLE_VA(100, "sampled %d", i);
+        QLOG_RATELIMIT(10, 5, "rate limited");
+    }
+    qlog_site_set_sampling("qlog_test.c:test25", 0);
+    qlog_site_set_rate_limit("qlog_test.c:test25", 0, 0);
+    QLOG_RATELIMIT(10, 5, "rate limit switched off");
+    qlog_display_print_buffer(stdout);
+    qlog_display_print_sites(stdout, "qlog_test.c:test25");
+    qlog_cleanup();
+}
+
+
+void test26(void){
+    int i = 0;
+    qlog_init(100);
+    qlog_thread_init("main thread");
+    qlog_set_dedup(0, 1);
+    for (i = 0; i < 1000; i++){
+        QLOG("error loop");
+    }
+    for (i = 0; i < 1000; i++){
+        QLOG_VA("formatted error loop %d", i / 500);
+    }
+    /* not back-to-back, stored one by one */
+    for (i = 0; i < 3; i++){
+        QLOG("alternating error");
+        QLOG_VA("formatted alternating error %d", 0);
+    }
+    qlog_display_print_buffer(stdout);
+    qlog_display_print_buffer_stats(stdout);
+    qlog_cleanup();
+}
+
+
+void* test27_thread(void* data){
+    int i = 0;
+    qlog_buffer_id_t buffer_id = *(qlog_buffer_id_t*) data;
+    for (i = 0; i < 1000; i++){
+        qlog_log_id(buffer_id, "per-CPU event");
+    }
+    return NULL;
+}
+
+void test27(void){
+    int i = 0;
+    pthread_t threads[8];
+    qlog_buffer_attr_t attr;
+    qlog_buffer_id_t buffer_id = 0;
+
+    qlog_init(100);
+    memset(&attr, 0, sizeof(attr));
+    attr.size = 32;
+    attr.flags = QLOG_BUFFER_PER_CPU;
+    buffer_id = qlog_create_buffer_attr(&attr);
+    for (i = 0; i < 8; i++){
+        pthread_create(&threads[i], NULL, test27_thread, &buffer_id);
+    }
+    for (i = 0; i < 8; i++){
+        pthread_join(threads[i], NULL);
+    }
+    qlog_display_print_buffer_list(stdout);
+    qlog_display_print_buffer_id(stdout, buffer_id);
+    qlog_display_print_buffer_stats(stdout);
+    qlog_cleanup();
+}
+
+void test28(void){
+    qlog_buffer_attr_t attr;
+    qlog_buffer_id_t buffer_id = 0;
+    int i = 0;
+
+    qlog_init(0);
+    memset(&attr, 0, sizeof(attr));
+    attr.size = 64;
+    attr.flags = QLOG_BUFFER_HUGEPAGES | QLOG_BUFFER_MLOCK | QLOG_BUFFER_NUMA;
+    attr.numa_node = -1;
+    buffer_id = qlog_create_buffer_attr(&attr);
+    for (i = 0; i < 100; i++){
+        qlog_log_id(buffer_id, "pinned event");
+    }
+    qlog_resize_buffer(buffer_id, 16);
+    qlog_display_debug_print_all_buffers(stdout, 1, 0);
+    qlog_display_print_buffer_id(stdout, buffer_id);
+    qlog_cleanup();
+}
+
+void test29(void){
+    int i = 0;
+
+    qlog_init(100);
+    for (i = 0; i < 10; i++){
+        QLOG_FIELDS("request done",
+                QLOG_F_INT("latency_us", i * 100),
+                QLOG_F_STR("path", i % 2 ? "/index" : "/api v2"),
+                QLOG_F_BOOL("cached", i % 3 == 0),
+                QLOG_F_DOUBLE("ratio", i / 4.0),
+                QLOG_F_DURATION("elapsed", i * 1500000LL));
+    }
+    qlog_display_print_buffer(stdout);
+    printf("latency_us > 500:\n");
+    qlog_display_print_buffer_filter(stdout, 0, "latency_us > 500");
+    printf("path == \"/api v2\" (JSON):\n");
+    qlog_display_set_fields_json(1);
+    qlog_display_print_buffer_filter(stdout, 0, "path == \"/api v2\"");
+    qlog_cleanup();
+}
+
+void test30(void){
+    int i = 0;
+    qlog_metric_id_t requests = qlog_metric_register("requests", QLOG_METRIC_COUNTER);
+    qlog_metric_id_t depth = qlog_metric_register("queue_depth", QLOG_METRIC_GAUGE);
+
+    qlog_init(100);
+    qlog_metric_start(0, 10);
+    for (i = 0; i < 100000; i++){
+        qlog_metric_inc(requests);
+        qlog_metric_set(depth, i % 64);
+        if (i % 10000 == 0){
+            usleep(5000);
+        }
+    }
+    qlog_metric_flush(0);
+    qlog_display_print_metrics(stdout);
+    qlog_display_print_buffer(stdout);
+    qlog_cleanup();
+}
+
+void test31(void){
+    qlog_trigger_rule_t rule;
+    int i = 0;
+
+    qlog_init(100);
+    qlog_trigger_parse("prefix ERROR snapshot", &rule);
+    qlog_trigger_add(&rule);
+    qlog_trigger_parse("site *:test31 freeze 5", &rule);
+    qlog_trigger_add(&rule);
+    for (i = 0; i < 20; i++){
+        qlog_log(i == 10 ? "ERROR connection lost" : "working");
+    }
+    QLOG_LVL(QLOG_LEVEL_ERROR, "giving up");
+    for (i = 0; i < 20; i++){
+        qlog_log("after the error");
+    }
+    qlog_display_print_snapshots(stdout);
+    qlog_snapshot_print(stdout, 0);
+    qlog_display_print_buffer(stdout);
+    qlog_display_print_buffer_stats(stdout);
+    qlog_thaw_buffer(0);
+    qlog_trigger(0, QLOG_TRIGGER_SNAPSHOT, 0, "manual");
+    qlog_display_print_snapshots(stdout);
+    qlog_cleanup();
+}
+
+#ifdef QLOG_SELF_INSTR
+void test32(void){
+    char payload[256];
+    int i = 0;
+
+    memset(payload, 0xab, sizeof(payload));
+    qlog_init(100);
+    qlog_thread_init("main thread");
+    for (i = 0; i < 50; i++){
+        QLOG_VA("instrumented %d", i);
+        qlog_ext_log(QLOG_EXT_EVENT_TYPE_HEXDUMP, payload, sizeof(payload), "payload");
+    }
+    qlog_display_print_buffer_stats(stdout);
+    qlog_display_debug_print_instr(stdout);
+    qlog_instr_reset();
+    qlog_display_debug_print_instr(stdout);
+    qlog_cleanup();
+}
+#endif
+
 
 int main(){
     test8(100, 1);
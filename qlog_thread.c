@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_thread.c
+ * \brief Registry of the logging threads.
+ *
+ * The entries are appended to a static table under a mutex, the number of
+ * entries is increased only after the entry is filled, so the readers
+ * (display, crash dump) can walk the table without locking.
+ * The id 0 is reserved for the events without a thread.
+ *
+ * The ids of the exiting threads are queued by the thread key destructor
+ * and reused by the new threads once the table is full.
+ * The interned names (no OS thread) are never released, they are indexed
+ * by an insert-only hash table probed without locking.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_thread.h"
+
+__thread qlog_thread_id_t qlog_thread_self_id = QLOG_THREAD_ID_NONE;
+
+static qlog_thread_info_t qlog_threads[QLOG_MAX_THREAD_NUM];
+static size_t qlog_thread_num = 1;
+static pthread_mutex_t qlog_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t qlog_thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t qlog_thread_key;
+
+/* ids of the exited threads, oldest first */
+static qlog_thread_id_t qlog_thread_free[QLOG_MAX_THREAD_NUM];
+static size_t qlog_thread_free_head = 0;
+static size_t qlog_thread_free_num = 0;
+
+/* ids of the interned names by the hash of the name, 0 for an empty slot */
+static qlog_thread_id_t qlog_thread_names[QLOG_THREAD_HASH_SIZE];
+
+/* marks the entry of an exiting thread and queues its id for reuse */
+static void qlog_thread_exit_cb(void* data){
+    qlog_thread_id_t id = (qlog_thread_id_t) (uintptr_t) data;
+    if (id != QLOG_THREAD_ID_NONE && id < QLOG_MAX_THREAD_NUM){
+        pthread_mutex_lock(&qlog_thread_lock);
+        qlog_threads[id].exited = 1;
+        qlog_thread_free[(qlog_thread_free_head + qlog_thread_free_num) % QLOG_MAX_THREAD_NUM] = id;
+        qlog_thread_free_num++;
+        pthread_mutex_unlock(&qlog_thread_lock);
+    }
+}
+
+static void qlog_thread_key_init(void){
+    pthread_key_create(&qlog_thread_key, qlog_thread_exit_cb);
+}
+
+/* stores the CPU affinity of the calling thread in the entry */
+static void qlog_thread_get_affinity(qlog_thread_info_t* info){
+    cpu_set_t cpus;
+    size_t i = 0;
+
+    memset(info->affinity, 0, sizeof(info->affinity));
+    CPU_ZERO(&cpus);
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0){
+        for (i = 0; i < QLOG_THREAD_MAX_CPU && i < CPU_SETSIZE; i++){
+            if (CPU_ISSET(i, &cpus)){
+                info->affinity[i / QLOG_THREAD_CPU_BITS] |= 1UL << (i % QLOG_THREAD_CPU_BITS);
+            }
+        }
+    }
+}
+
+/* provides a new id or, if the table is full, the id of the oldest exited
+ * thread. A new id (== qlog_thread_num) is published by the caller after
+ * the entry is filled. Called under the lock. */
+static qlog_thread_id_t qlog_thread_alloc_id(void){
+    qlog_thread_id_t id = QLOG_THREAD_ID_NONE;
+
+    if (qlog_thread_num < QLOG_MAX_THREAD_NUM){
+        id = (qlog_thread_id_t) qlog_thread_num;
+    } else if (qlog_thread_free_num > 0){
+        id = qlog_thread_free[qlog_thread_free_head];
+        qlog_thread_free_head = (qlog_thread_free_head + 1) % QLOG_MAX_THREAD_NUM;
+        qlog_thread_free_num--;
+    }
+    return id;
+}
+
+/* FNV-1a hash of a name truncated to the registry name size */
+static size_t qlog_thread_name_hash(const char* name){
+    uint32_t hash = 2166136261u;
+    size_t i = 0;
+
+    for (i = 0; i < QLOG_THREAD_NAME_SIZE - 1 && name[i]; i++){
+        hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+    }
+    return hash & (QLOG_THREAD_HASH_SIZE - 1);
+}
+
+/* compares a registry name with a name truncated to the registry name size */
+static int qlog_thread_name_equal(const char* entry, const char* name){
+    size_t len = strlen(entry);
+    return strncmp(entry, name, len) == 0 && (name[len] == '\0' || len == QLOG_THREAD_NAME_SIZE - 1);
+}
+
+/* looks up an interned name and provides its hash slot, the caller holds
+ * the lock or accepts a miss */
+static qlog_thread_id_t qlog_thread_find_name(const char* name, size_t* slot){
+    size_t i = qlog_thread_name_hash(name);
+    qlog_thread_id_t id = QLOG_THREAD_ID_NONE;
+
+    while ((id = qlog_thread_names[i]) != QLOG_THREAD_ID_NONE){
+        if (qlog_thread_name_equal(qlog_threads[id].name, name)){
+            return id;
+        }
+        i = (i + 1) & (QLOG_THREAD_HASH_SIZE - 1);
+    }
+    *slot = i;
+    return QLOG_THREAD_ID_NONE;
+}
+
+/**
+ * \brief Registers the calling thread
+ *
+ * \param name The name of the thread
+ * \return The id of the thread, QLOG_THREAD_ID_NONE if the registry is full
+ *
+ * The name, the OS thread id and the CPU affinity of the thread are stored.
+ * If the thread has already been registered, its entry is updated and the
+ * same id is returned.
+ */
+qlog_thread_id_t qlog_thread_register(const char* name){
+    qlog_thread_id_t id = qlog_thread_self_id;
+    qlog_thread_info_t* info = NULL;
+
+    if (name == NULL){
+        return id;
+    }
+    pthread_once(&qlog_thread_key_once, qlog_thread_key_init);
+
+    pthread_mutex_lock(&qlog_thread_lock);
+    if (id == QLOG_THREAD_ID_NONE){
+        id = qlog_thread_alloc_id();
+        if (id == QLOG_THREAD_ID_NONE){
+            pthread_mutex_unlock(&qlog_thread_lock);
+            return QLOG_THREAD_ID_NONE;
+        }
+    }
+    info = &qlog_threads[id];
+    snprintf(info->name, sizeof(info->name), "%s", name);
+    info->tid = syscall(SYS_gettid);
+    info->exited = 0;
+    qlog_thread_get_affinity(info);
+    if (id == qlog_thread_num){
+        /* publish the filled entry */
+        __sync_synchronize();
+        qlog_thread_num++;
+    }
+    pthread_mutex_unlock(&qlog_thread_lock);
+
+    qlog_thread_self_id = id;
+    pthread_setspecific(qlog_thread_key, (void*) (uintptr_t) id);
+    return id;
+}
+
+/**
+ * \brief Provides the id of a thread name
+ *
+ * \param name The thread name
+ * \return The id of the name, QLOG_THREAD_ID_NONE if the name is empty
+ *         or the registry is full
+ *
+ * Used for the thread names passed to the logging functions explicitly.
+ * Every distinct name is stored once. A known name is found by a hash
+ * lookup without locking.
+ */
+qlog_thread_id_t qlog_thread_intern(const char* name){
+    qlog_thread_id_t id = QLOG_THREAD_ID_NONE;
+    size_t slot = 0;
+
+    if (name == NULL || name[0] == '\0'){
+        return QLOG_THREAD_ID_NONE;
+    }
+
+    id = qlog_thread_find_name(name, &slot);
+    if (id != QLOG_THREAD_ID_NONE){
+        return id;
+    }
+
+    pthread_mutex_lock(&qlog_thread_lock);
+    id = qlog_thread_find_name(name, &slot);
+    if (id == QLOG_THREAD_ID_NONE){
+        id = qlog_thread_alloc_id();
+        if (id != QLOG_THREAD_ID_NONE){
+            memset(&qlog_threads[id], 0, sizeof(qlog_thread_info_t));
+            snprintf(qlog_threads[id].name, sizeof(qlog_threads[id].name), "%s", name);
+            __sync_synchronize();
+            if (id == qlog_thread_num){
+                qlog_thread_num++;
+            }
+            /* publish the name in the hash after the entry */
+            qlog_thread_names[slot] = id;
+        }
+    }
+    pthread_mutex_unlock(&qlog_thread_lock);
+    return id;
+}
+
+/**
+ * \brief Provides the number of the registry entries (including the unused id 0)
+ */
+size_t qlog_thread_count(void){
+    return qlog_thread_num;
+}
+
+/**
+ * \brief Provides the registry entry of a thread
+ *
+ * \param id The thread id
+ * \return The registry entry or NULL if the id is not valid
+ */
+const qlog_thread_info_t* qlog_thread_get(qlog_thread_id_t id){
+    if (id == QLOG_THREAD_ID_NONE || id >= qlog_thread_num){
+        return NULL;
+    }
+    return &qlog_threads[id];
+}
+
+/**
+ * \brief Provides the name of a thread
+ *
+ * \param id The thread id
+ * \return The thread name or NULL if the id is not valid
+ *
+ * Async-signal-safe, used by the crash dump.
+ */
+const char* qlog_thread_get_name(qlog_thread_id_t id){
+    const qlog_thread_info_t* info = qlog_thread_get(id);
+    return info ? info->name : NULL;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_thread_block.c
+ * \brief Per-thread data blocks of the hot path counters.
+ *
+ * The blocks are never freed, a block released by an exiting thread is
+ * reused by the next thread of the registry, so the number of the blocks
+ * is the highest number of the threads running at the same time.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "qlog.h"
+#include "qlog_thread.h"
+#include "qlog_thread_block.h"
+
+/* folds the block of an exiting thread and releases it for reuse */
+static void qlog_thread_block_exit(void* data){
+    qlog_thread_block_t* block = (qlog_thread_block_t*) data;
+    qlog_thread_block_registry_t* registry = block->registry;
+
+    pthread_mutex_lock(registry->lock);
+    registry->fold(block->data);
+    memset(block->data, 0, registry->size);
+    block->owner = NULL;
+    pthread_mutex_unlock(registry->lock);
+}
+
+/**
+ * \brief Sets up the block of the calling thread in a registry
+ *
+ * \param registry The registry of the module
+ * \return The data of the block or NULL if out of memory
+ *
+ * Called by the modules on the first update in a thread, the returned
+ * pointer is cached in their TLS pointer. The data of a new block is zero.
+ */
+void* qlog_thread_block_get(qlog_thread_block_registry_t* registry){
+    qlog_thread_block_t* block = NULL;
+
+    pthread_mutex_lock(registry->lock);
+    if (!registry->key_created){
+        registry->key_created = pthread_key_create(&registry->key, qlog_thread_block_exit) == 0;
+    }
+    if (registry->key_created){
+        for (block = registry->blocks; block; block = block->next){
+            if (block->owner == NULL){
+                break;
+            }
+        }
+        if (block == NULL){
+            block = calloc(1, sizeof(qlog_thread_block_t) + registry->size);
+            if (block){
+                block->registry = registry;
+                block->next = registry->blocks;
+                registry->blocks = block;
+            }
+        }
+        if (block){
+            block->owner = &qlog_thread_self_id;
+        }
+    }
+    pthread_mutex_unlock(registry->lock);
+
+    if (block){
+        pthread_setspecific(registry->key, block);
+        return block->data;
+    }
+    return NULL;
+}
+
+/**
+ * \brief Clears the data of all the blocks of a registry
+ *
+ * \param registry The registry of the module
+ *
+ * Called under the registry lock. The updates of the threads meanwhile may
+ * survive the clearing partially.
+ */
+void qlog_thread_block_clear_all(qlog_thread_block_registry_t* registry){
+    qlog_thread_block_t* block = NULL;
+
+    for (block = registry->blocks; block; block = block->next){
+        memset(block->data, 0, registry->size);
+    }
+}
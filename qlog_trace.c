@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_trace.c
+ * \brief Export of the log buffers in Chrome Trace Event JSON format.
+ *
+ * The events are written to the stream while the buffer is walked, the
+ * JSON document is never built in memory.
+ * The ENTRY/LEAVE events (call site flags) become B/E duration events, all
+ * the other events are thread scoped instant events. The durations are
+ * paired per thread by the indent level of the events: a LEAVE closes the
+ * open ENTRY of the same level (and the deeper ones left open by a missing
+ * LEAVE), a LEAVE without an open ENTRY (its ENTRY has been overwritten in
+ * the ring) is skipped. The durations still open at the end are closed at
+ * the last timestamp of the thread.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_trace.h"
+#include "qlog_symbol.h"
+#include "qlog_ftrace.h"
+#include "qlog_fields.h"
+
+#define QLOG_TRACE_MAX_DEPTH    256
+
+typedef struct qlog_trace_thread_t {
+    uint8_t levels[QLOG_TRACE_MAX_DEPTH];   /* indent levels of the open durations */
+    unsigned int depth;
+    long long last_ts;
+} qlog_trace_thread_t;
+
+typedef struct qlog_trace_ctx_t {
+    FILE* stream;
+    int pid;
+    int first;
+    qlog_trace_thread_t* threads[QLOG_MAX_THREAD_NUM];
+} qlog_trace_ctx_t;
+
+/* writes a JSON string literal */
+static void qlog_trace_put_str(FILE* stream, const char* str){
+    const unsigned char* c = (const unsigned char*) str;
+
+    fputc('"', stream);
+    for (; c && *c; c++){
+        if (*c == '"' || *c == '\\'){
+            fputc('\\', stream);
+            fputc(*c, stream);
+        } else if (*c < 0x20){
+            fprintf(stream, "\\u%04x", *c);
+        } else {
+            fputc(*c, stream);
+        }
+    }
+    fputc('"', stream);
+}
+
+static void qlog_trace_begin_event(qlog_trace_ctx_t* ctx, const char* phase, qlog_thread_id_t tid, long long ts){
+    fprintf(ctx->stream, "%s\n{\"ph\":\"%s\",\"pid\":%d,\"tid\":%u,\"ts\":%lld",
+            ctx->first ? "" : ",", phase, ctx->pid, (unsigned int) tid, ts);
+    ctx->first = 0;
+}
+
+static void qlog_trace_put_end(qlog_trace_ctx_t* ctx, qlog_thread_id_t tid, long long ts){
+    qlog_trace_begin_event(ctx, "E", tid, ts);
+    fputc('}', ctx->stream);
+}
+
+/* the name of a traced function ("module(name+0x0) [addr]" -> "name") */
+static const char* qlog_trace_ftrace_name(const qlog_event_t* event, char* buffer, size_t size){
+    qlog_ftrace_record_t record;
+    char* start = NULL;
+    char* end = NULL;
+
+    memcpy(&record, event->ext_data, sizeof(record));
+    qlog_symbol_resolve(record.function, buffer, size);
+    start = strchr(buffer, '(');
+    if (start && start[1] != '+'){
+        end = strpbrk(++start, "+)");
+        if (end){
+            *end = '\0';
+            return start;
+        }
+    }
+    return buffer;
+}
+
+static void qlog_trace_event_cb(const qlog_event_t* event, void* data){
+    qlog_trace_ctx_t* ctx = (qlog_trace_ctx_t*) data;
+    qlog_trace_thread_t* thread = NULL;
+    qlog_thread_id_t tid = event->thread_id;
+    long long ts = (long long) event->timestamp.tv_sec * 1000000LL + event->timestamp.tv_usec;
+    uint8_t flags = event->site ? event->site->flags : 0;
+    const char* function = qlog_internal_get_event_function(event);
+    char symbol[QLOG_SYMBOL_STR_SIZE];
+    char fields_json[2 * QLOG_MSG_BUF_SIZE];
+    const void* fields = NULL;
+    size_t fields_size = 0;
+
+    if (tid >= QLOG_MAX_THREAD_NUM){
+        tid = QLOG_THREAD_ID_NONE;
+    }
+    thread = ctx->threads[tid];
+    if (thread == NULL){
+        thread = calloc(1, sizeof(qlog_trace_thread_t));
+        if (thread == NULL){
+            return;
+        }
+        ctx->threads[tid] = thread;
+    }
+    thread->last_ts = ts;
+
+    if (flags & QLOG_SITE_LEAVE){
+        /* close the durations left open by a missing LEAVE */
+        while (thread->depth > 0 && thread->levels[thread->depth - 1] > event->indent_level){
+            thread->depth--;
+            qlog_trace_put_end(ctx, tid, ts);
+        }
+        if (thread->depth > 0 && thread->levels[thread->depth - 1] == event->indent_level){
+            thread->depth--;
+            qlog_trace_put_end(ctx, tid, ts);
+        }
+        return;
+    }
+
+    if (event->ext_event_type == QLOG_EXT_EVENT_TYPE_FTRACE &&
+            event->ext_data_size == sizeof(qlog_ftrace_record_t)){
+        function = qlog_trace_ftrace_name(event, symbol, sizeof(symbol));
+    }
+
+    if (flags & QLOG_SITE_ENTRY){
+        if (thread->depth >= QLOG_TRACE_MAX_DEPTH){
+            return;
+        }
+        thread->levels[thread->depth++] = event->indent_level;
+        qlog_trace_begin_event(ctx, "B", tid, ts);
+        fprintf(ctx->stream, ",\"name\":");
+        qlog_trace_put_str(ctx->stream, function[0] != '\0' ? function : "-");
+    } else {
+        qlog_trace_begin_event(ctx, "i", tid, ts);
+        fprintf(ctx->stream, ",\"s\":\"t\",\"name\":");
+        qlog_trace_put_str(ctx->stream, qlog_internal_get_event_message(event));
+    }
+
+    fprintf(ctx->stream, ",\"args\":{\"function\":");
+    qlog_trace_put_str(ctx->stream, function);
+    fprintf(ctx->stream, ",\"line\":%u", qlog_internal_get_event_line(event));
+    if (event->site){
+        fprintf(ctx->stream, ",\"file\":");
+        qlog_trace_put_str(ctx->stream, event->site->file);
+    }
+    if (event->suppressed){
+        fprintf(ctx->stream, ",\"suppressed\":%u", (unsigned int) event->suppressed);
+    }
+    if (event->repeats){
+        fprintf(ctx->stream, ",\"repeats\":%u,\"last_seen\":%lld", (unsigned int) event->repeats,
+                (long long) event->last_seen.tv_sec * 1000000LL + event->last_seen.tv_usec);
+    }
+    if (event->ext_event_type != QLOG_EXT_EVENT_TYPE_NONE){
+        fprintf(ctx->stream, ",\"ext_type\":%u,\"ext_size\":%lu",
+                event->ext_event_type, (unsigned long) event->ext_data_size);
+    }
+    fields = qlog_internal_get_event_fields(event, &fields_size);
+    if (fields){
+        qlog_fields_format(fields, fields_size, fields_json, sizeof(fields_json), 1);
+        fprintf(ctx->stream, ",\"fields\":%s", fields_json);
+    }
+    fprintf(ctx->stream, "}}");
+}
+
+/**
+ * \brief Exports a log buffer in Chrome Trace Event JSON format
+ *
+ * \param stream The stream to write the JSON document into
+ * \param buffer_id The id of the buffer to be exported
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of any error
+ *
+ * The thread ids of the trace are the qlog thread registry ids, the thread
+ * names are exported as metadata events. The buffer is locked while it is
+ * written to the stream.
+ */
+int qlog_trace_export(FILE* stream, qlog_buffer_id_t buffer_id){
+    qlog_trace_ctx_t* ctx = NULL;
+    qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
+    const char* name = NULL;
+    size_t i = 0;
+
+    if (stream == NULL || buffer == NULL){
+        return QLOG_RET_ERR;
+    }
+    ctx = calloc(1, sizeof(qlog_trace_ctx_t));
+    if (ctx == NULL){
+        return QLOG_RET_ERR;
+    }
+    ctx->stream = stream;
+    ctx->pid = (int) getpid();
+    ctx->first = 1;
+
+    fprintf(stream, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (i = 1; i < qlog_thread_count(); i++){
+        name = qlog_thread_get_name((qlog_thread_id_t) i);
+        if (name){
+            qlog_trace_begin_event(ctx, "M", (qlog_thread_id_t) i, 0);
+            fprintf(stream, ",\"name\":\"thread_name\",\"args\":{\"name\":");
+            qlog_trace_put_str(stream, name);
+            fprintf(stream, "}}");
+        }
+    }
+
+    qlog_symbol_refresh();
+    if (qlog_lock_buffer_internal(buffer) == 0){
+        qlog_walk_buffer_internal(buffer, qlog_trace_event_cb, ctx);
+        qlog_unlock_buffer_internal(buffer);
+    }
+
+    for (i = 0; i < QLOG_MAX_THREAD_NUM; i++){
+        if (ctx->threads[i]){
+            while (ctx->threads[i]->depth > 0){
+                ctx->threads[i]->depth--;
+                qlog_trace_put_end(ctx, (qlog_thread_id_t) i, ctx->threads[i]->last_ts);
+            }
+            free(ctx->threads[i]);
+        }
+    }
+    fprintf(stream, "\n]}\n");
+    free(ctx);
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Exports a log buffer into a file in Chrome Trace Event JSON format
+ *
+ * \param path The path of the file, it is overwritten
+ * \param buffer_id The id of the buffer to be exported
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR in case of any error
+ */
+int qlog_trace_export_file(const char* path, qlog_buffer_id_t buffer_id){
+    FILE* stream = NULL;
+    int res = QLOG_RET_ERR;
+
+    if (path == NULL){
+        return QLOG_RET_ERR;
+    }
+    stream = fopen(path, "w");
+    if (stream == NULL){
+        return QLOG_RET_ERR;
+    }
+    res = qlog_trace_export(stream, buffer_id);
+    if (fclose(stream) != 0){
+        res = QLOG_RET_ERR;
+    }
+    return res;
+}
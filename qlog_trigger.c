@@ -0,0 +1,534 @@
+/*
+ * Copyright (c) 2014 Jozsef Galajda <jgalajda@pannongsm.hu>
+ * All rights reserved.
+ */
+
+/**
+ * \file qlog_trigger.c
+ * \brief Triggered freeze and snapshots of the log buffers.
+ *
+ * The rules are checked by qlog_release_event_internal() while the event
+ * is locked, the writers only pay for it while there is a rule. The call
+ * site rules are resolved into the QLOG_SITE_TRIGGER flag of the matching
+ * sites when they are added, so no pattern is matched for the other events.
+ *
+ * A snapshot slot is a buffer of its own (not listed among the log
+ * buffers). The slot is claimed by the thread firing the trigger, the
+ * newest events of the source buffer are copied into it under the buffer
+ * lock, then it is published. The slots are not overwritten: the first
+ * snapshots are kept (the further triggers are counted as missed) until
+ * they are cleared.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "qlog.h"
+#include "qlog_internal.h"
+#include "qlog_display.h"
+#include "qlog_trigger.h"
+#include "qlog_symbol.h"
+
+#define QLOG_SNAPSHOT_FREE      0
+#define QLOG_SNAPSHOT_FILLING   1
+#define QLOG_SNAPSHOT_READY     2
+
+typedef struct qlog_snapshot_t {
+    int state;                  /* QLOG_SNAPSHOT_* */
+    qlog_buffer_t* buffer;      /* the copied events, allocated on first use */
+    qlog_snapshot_info_t info;
+} qlog_snapshot_t;
+
+int qlog_trigger_rule_num = 0;
+static qlog_trigger_rule_t qlog_trigger_rules[QLOG_MAX_TRIGGER_NUM];
+static pthread_mutex_t qlog_trigger_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static qlog_snapshot_t qlog_snapshots[QLOG_MAX_SNAPSHOT_NUM];
+static unsigned long qlog_snapshot_missed = 0;
+
+/* sets or clears the trigger flag of the call sites matching a pattern */
+static void qlog_trigger_flag_sites_internal(const char* pattern, int set){
+    qlog_site_t* site = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < qlog_site_count(); i++){
+        site = qlog_site_get(i);
+        if (!set){
+            __sync_fetch_and_and(&site->flags, (uint8_t) ~QLOG_SITE_TRIGGER);
+        } else if (qlog_site_match(site, pattern)){
+            __sync_fetch_and_or(&site->flags, QLOG_SITE_TRIGGER);
+        }
+    }
+}
+
+/* the id of a log buffer, -1 if it is not listed */
+static int qlog_trigger_buffer_id_internal(const qlog_buffer_t* buffer){
+    int i = 0;
+
+    for (i = 0; i < qlog_internal_get_max_buf_num(); i++){
+        if (qlog_internal_get_buffer_by_id(i) == buffer){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * \brief Adds a trigger rule
+ *
+ * \param rule The rule, copied
+ * \return The number of the call sites matching a QLOG_TRIGGER_SITE rule,
+ *         0 for the other rules, QLOG_RET_ERR if the rule is invalid or
+ *         the rule table is full
+ *
+ * The rule fires on every matching event logged into any buffer. A FREEZE
+ * rule freezes the buffer after rule->after more events (the matching event
+ * is the last one if it is 0), further matching events do not restart the
+ * countdown. The snapshot slots are allocated when the first SNAPSHOT rule
+ * is added so the first trigger does not have to map memory.
+ */
+int qlog_trigger_add(const qlog_trigger_rule_t* rule){
+    int res = 0;
+    size_t i = 0;
+
+    if (rule == NULL ||
+            (rule->match != QLOG_TRIGGER_SITE && rule->match != QLOG_TRIGGER_EXT_TYPE &&
+             rule->match != QLOG_TRIGGER_PREFIX) ||
+            (rule->action != QLOG_TRIGGER_FREEZE && rule->action != QLOG_TRIGGER_SNAPSHOT) ||
+            (rule->match == QLOG_TRIGGER_PREFIX && rule->pattern[0] == '\0') ||
+            (rule->match == QLOG_TRIGGER_EXT_TYPE && rule->ext_type == QLOG_EXT_EVENT_TYPE_NONE)){
+        return QLOG_RET_ERR;
+    }
+
+    pthread_mutex_lock(&qlog_trigger_mutex);
+    if (qlog_trigger_rule_num >= QLOG_MAX_TRIGGER_NUM){
+        pthread_mutex_unlock(&qlog_trigger_mutex);
+        return QLOG_RET_ERR;
+    }
+    if (rule->action == QLOG_TRIGGER_SNAPSHOT){
+        for (i = 0; i < QLOG_MAX_SNAPSHOT_NUM; i++){
+            /* the free slots only, claimed as by a trigger */
+            if (__sync_bool_compare_and_swap(&qlog_snapshots[i].state, QLOG_SNAPSHOT_FREE, QLOG_SNAPSHOT_FILLING)){
+                if (qlog_snapshots[i].buffer == NULL){
+                    qlog_snapshots[i].buffer = qlog_init_buffer_internal(QLOG_SNAPSHOT_SIZE, 0, -1);
+                }
+                __sync_lock_test_and_set(&qlog_snapshots[i].state, QLOG_SNAPSHOT_FREE);
+            }
+        }
+    }
+    memcpy(&qlog_trigger_rules[qlog_trigger_rule_num], rule, sizeof(qlog_trigger_rule_t));
+    qlog_trigger_rules[qlog_trigger_rule_num].pattern[QLOG_TRIGGER_PATTERN_SIZE - 1] = '\0';
+    if (rule->match == QLOG_TRIGGER_SITE){
+        for (i = 0; i < qlog_site_count(); i++){
+            res += qlog_site_match(qlog_site_get(i), rule->pattern);
+        }
+        qlog_trigger_flag_sites_internal(rule->pattern, 1);
+    }
+    /* the rule is complete before the writers can see it */
+    __sync_synchronize();
+    qlog_trigger_rule_num++;
+    pthread_mutex_unlock(&qlog_trigger_mutex);
+    return res;
+}
+
+/**
+ * \brief Removes all the trigger rules
+ *
+ * The pending freeze countdowns and the snapshots are not affected.
+ */
+void qlog_trigger_clear(void){
+    pthread_mutex_lock(&qlog_trigger_mutex);
+    qlog_trigger_rule_num = 0;
+    qlog_trigger_flag_sites_internal(NULL, 0);
+    pthread_mutex_unlock(&qlog_trigger_mutex);
+}
+
+/**
+ * \brief Parses a trigger rule
+ *
+ * \param spec The rule as text: "site <pattern>", "prefix <text>" or
+ *             "ext <type>" followed by "freeze <N>" or "snapshot",
+ *             e.g. "prefix ERROR freeze 10" or "site qlog_test.c:test31 snapshot"
+ * \param rule The parsed rule
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the text is invalid
+ *
+ * The pattern and the prefix cannot contain white space.
+ */
+int qlog_trigger_parse(const char* spec, qlog_trigger_rule_t* rule){
+    char match[16], action[16];
+    int fields = 0;
+
+    if (spec == NULL || rule == NULL){
+        return QLOG_RET_ERR;
+    }
+    memset(rule, 0, sizeof(qlog_trigger_rule_t));
+    fields = sscanf(spec, "%15s %127s %15s %u", match, rule->pattern, action, &rule->after);
+    if (fields < 3){
+        return QLOG_RET_ERR;
+    }
+    if (strcmp(match, "site") == 0){
+        rule->match = QLOG_TRIGGER_SITE;
+    } else if (strcmp(match, "prefix") == 0){
+        rule->match = QLOG_TRIGGER_PREFIX;
+    } else if (strcmp(match, "ext") == 0){
+        rule->match = QLOG_TRIGGER_EXT_TYPE;
+        rule->ext_type = (qlog_ext_event_type_t) strtoul(rule->pattern, NULL, 10);
+    } else {
+        return QLOG_RET_ERR;
+    }
+    if (strcmp(action, "freeze") == 0){
+        rule->action = QLOG_TRIGGER_FREEZE;
+    } else if (strcmp(action, "snapshot") == 0 && fields == 3){
+        rule->action = QLOG_TRIGGER_SNAPSHOT;
+    } else {
+        return QLOG_RET_ERR;
+    }
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Checks the trigger rules against an event
+ *
+ * \param event The event being released (locked)
+ * \return The index of the first matching rule, -1 if none matches
+ */
+int qlog_trigger_match_internal(const qlog_event_t* event){
+    const qlog_trigger_rule_t* rule = NULL;
+    const char* message = NULL;
+    int i = 0, rule_num = qlog_trigger_rule_num;
+
+    __sync_synchronize();
+    for (i = 0; i < rule_num; i++){
+        rule = &qlog_trigger_rules[i];
+        switch (rule->match){
+            case QLOG_TRIGGER_SITE:
+                if (event->site && (event->site->flags & QLOG_SITE_TRIGGER) &&
+                        qlog_site_match(event->site, rule->pattern)){
+                    return i;
+                }
+                break;
+            case QLOG_TRIGGER_EXT_TYPE:
+                if (event->ext_event_type != QLOG_EXT_EVENT_TYPE_NONE &&
+                        event->ext_event_type == rule->ext_type){
+                    return i;
+                }
+                break;
+            case QLOG_TRIGGER_PREFIX:
+                message = qlog_internal_get_event_message(event);
+                if (strncmp(message, rule->pattern, strlen(rule->pattern)) == 0){
+                    return i;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return -1;
+}
+
+/* starts the freeze countdown of a buffer unless it is frozen or counting already */
+static int qlog_freeze_internal(qlog_buffer_t* buffer, unsigned int after){
+    if (buffer->frozen){
+        return QLOG_RET_OK;
+    }
+    if (after == 0){
+        buffer->frozen = 1;
+        return QLOG_RET_OK;
+    }
+    __sync_bool_compare_and_swap(&buffer->freeze_left, 0, (int) after);
+    return QLOG_RET_OK;
+}
+
+/* copies an event into the next slot of a snapshot buffer (walk callback) */
+static void qlog_snapshot_copy_cb(const qlog_event_t* event, void* data){
+    qlog_buffer_t* snapshot = (qlog_buffer_t*) data;
+    qlog_event_t* copy = NULL;
+    qlog_event_t* next = NULL;
+
+    copy = snapshot->next_write;
+    snapshot->next_write = copy->next;
+    if (snapshot->next_write == snapshot->head){
+        snapshot->wrapped++;
+    }
+    qlog_free_ext_data_internal(copy);
+
+    next = copy->next;
+    memcpy(copy, event, sizeof(qlog_event_t));
+    copy->next = next;
+    copy->lock = 0;
+    if (event->ext_data == (void*) event->ext_inline){
+        copy->ext_data = copy->ext_inline;
+    } else if (event->ext_data){
+        copy->ext_data = malloc(event->ext_data_size);
+        if (copy->ext_data){
+            memcpy(copy->ext_data, event->ext_data, event->ext_data_size);
+        } else {
+            copy->ext_data_size = 0;
+            copy->ext_event_type = QLOG_EXT_EVENT_TYPE_NONE;
+        }
+    }
+}
+
+/* counts the events of a snapshot buffer (walk callback) */
+static void qlog_snapshot_count_cb(const qlog_event_t* event UNUSED, void* data){
+    (*(size_t*) data)++;
+}
+
+/**
+ * \brief Takes a snapshot of a buffer into a free slot
+ *
+ * \param buffer The log buffer
+ * \param reason The description of the trigger
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if no slot is free
+ */
+static int qlog_snapshot_take_internal(qlog_buffer_t* buffer, const char* reason){
+    qlog_snapshot_t* slot = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < QLOG_MAX_SNAPSHOT_NUM; i++){
+        if (__sync_bool_compare_and_swap(&qlog_snapshots[i].state, QLOG_SNAPSHOT_FREE, QLOG_SNAPSHOT_FILLING)){
+            slot = &qlog_snapshots[i];
+            break;
+        }
+    }
+    if (slot == NULL){
+        __sync_fetch_and_add(&qlog_snapshot_missed, 1);
+        return QLOG_RET_ERR;
+    }
+    if (slot->buffer == NULL){
+        slot->buffer = qlog_init_buffer_internal(QLOG_SNAPSHOT_SIZE, 0, -1);
+    }
+    if (slot->buffer == NULL || qlog_reset_buffer_internal(slot->buffer) != QLOG_RET_OK){
+        __sync_lock_test_and_set(&slot->state, QLOG_SNAPSHOT_FREE);
+        __sync_fetch_and_add(&qlog_snapshot_missed, 1);
+        return QLOG_RET_ERR;
+    }
+
+    memset(&slot->info, 0, sizeof(slot->info));
+    slot->info.buffer_id = (qlog_buffer_id_t) qlog_trigger_buffer_id_internal(buffer);
+    gettimeofday(&slot->info.timestamp, NULL);
+    snprintf(slot->info.reason, sizeof(slot->info.reason), "%s", reason ? reason : "");
+
+    if (qlog_lock_buffer_internal(buffer) == QLOG_RET_OK){
+        qlog_walk_buffer_internal(buffer, qlog_snapshot_copy_cb, slot->buffer);
+        qlog_unlock_buffer_internal(buffer);
+    }
+    qlog_walk_buffer_internal(slot->buffer, qlog_snapshot_count_cb, &slot->info.event_num);
+
+    __sync_synchronize();
+    slot->state = QLOG_SNAPSHOT_READY;
+    return QLOG_RET_OK;
+}
+
+/* executes the action of a rule or an explicit trigger on a buffer */
+static int qlog_trigger_action_internal(qlog_buffer_t* buffer, int action,
+        unsigned int after, const char* reason){
+    if (action == QLOG_TRIGGER_FREEZE){
+        return qlog_freeze_internal(buffer, after);
+    } else if (action == QLOG_TRIGGER_SNAPSHOT){
+        return qlog_snapshot_take_internal(buffer, reason);
+    }
+    return QLOG_RET_ERR;
+}
+
+/**
+ * \brief Fires a matching rule (called by the writer after the event has been released)
+ *
+ * \param log_buffer The buffer of the event
+ * \param rule The index of the rule
+ */
+void qlog_trigger_fire_internal(qlog_buffer_t* log_buffer, int rule){
+    const qlog_trigger_rule_t* trigger = &qlog_trigger_rules[rule];
+    char reason[QLOG_TRIGGER_REASON_SIZE];
+
+    switch (trigger->match){
+        case QLOG_TRIGGER_SITE:
+            snprintf(reason, sizeof(reason), "site %.56s", trigger->pattern);
+            break;
+        case QLOG_TRIGGER_EXT_TYPE:
+            snprintf(reason, sizeof(reason), "ext %u", (unsigned int) trigger->ext_type);
+            break;
+        default:
+            snprintf(reason, sizeof(reason), "prefix %.56s", trigger->pattern);
+            break;
+    }
+    qlog_trigger_action_internal(log_buffer, trigger->action, trigger->after, reason);
+}
+
+/**
+ * \brief Fires a trigger explicitly
+ *
+ * \param buffer_id The id of the log buffer
+ * \param action QLOG_TRIGGER_FREEZE or QLOG_TRIGGER_SNAPSHOT
+ * \param after FREEZE: the number of the events stored before the buffer is frozen
+ * \param reason The description stored in the snapshot (optional)
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the buffer does not exist
+ *         or no snapshot slot is free
+ */
+int qlog_trigger(qlog_buffer_id_t buffer_id, int action, unsigned int after, const char* reason){
+    qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
+
+    if (buffer == NULL){
+        return QLOG_RET_ERR;
+    }
+    return qlog_trigger_action_internal(buffer, action, after, reason ? reason : "qlog_trigger");
+}
+
+/**
+ * \brief Freezes a log buffer
+ *
+ * \param buffer_id The id of the log buffer
+ * \param after The number of the events stored before the buffer is frozen,
+ *              0 to freeze it immediately
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the buffer does not exist
+ *
+ * The new events of a frozen buffer are dropped (QLOG_RET_FROZEN, counted in
+ * the statistics) until the buffer is thawed.
+ */
+int qlog_freeze_buffer(qlog_buffer_id_t buffer_id, unsigned int after){
+    return qlog_trigger(buffer_id, QLOG_TRIGGER_FREEZE, after, NULL);
+}
+
+/**
+ * \brief Thaws a frozen log buffer (or cancels the freeze countdown)
+ *
+ * \param buffer_id The id of the log buffer
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if the buffer does not exist
+ */
+int qlog_thaw_buffer(qlog_buffer_id_t buffer_id){
+    qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
+
+    if (buffer == NULL){
+        return QLOG_RET_ERR;
+    }
+    buffer->freeze_left = 0;
+    buffer->frozen = 0;
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Provides the freeze state of a log buffer
+ *
+ * \param buffer_id The id of the log buffer
+ * \return 1 if the buffer is frozen, 0 if not, QLOG_RET_ERR if the buffer
+ *         does not exist
+ */
+int qlog_is_frozen(qlog_buffer_id_t buffer_id){
+    qlog_buffer_t* buffer = qlog_internal_get_buffer_by_id(buffer_id);
+
+    if (buffer == NULL){
+        return QLOG_RET_ERR;
+    }
+    return buffer->frozen ? 1 : 0;
+}
+
+/* the slot of the index-th ready snapshot */
+static qlog_snapshot_t* qlog_snapshot_get_internal(size_t index){
+    size_t i = 0;
+
+    for (i = 0; i < QLOG_MAX_SNAPSHOT_NUM; i++){
+        if (qlog_snapshots[i].state == QLOG_SNAPSHOT_READY && index-- == 0){
+            return &qlog_snapshots[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Provides the number of the snapshots taken
+ */
+size_t qlog_snapshot_count(void){
+    size_t i = 0, count = 0;
+
+    for (i = 0; i < QLOG_MAX_SNAPSHOT_NUM; i++){
+        if (qlog_snapshots[i].state == QLOG_SNAPSHOT_READY){
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * \brief Provides the number of the triggers missed because no snapshot slot was free
+ */
+unsigned long qlog_snapshot_get_missed(void){
+    return qlog_snapshot_missed;
+}
+
+/**
+ * \brief Provides the description of a snapshot
+ *
+ * \param index The index of the snapshot, from 0 to qlog_snapshot_count() - 1 (oldest first)
+ * \param info The description is copied here
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if there is no such snapshot
+ */
+int qlog_snapshot_get_info(size_t index, qlog_snapshot_info_t* info){
+    qlog_snapshot_t* slot = qlog_snapshot_get_internal(index);
+
+    if (slot == NULL || info == NULL){
+        return QLOG_RET_ERR;
+    }
+    memcpy(info, &slot->info, sizeof(qlog_snapshot_info_t));
+    return QLOG_RET_OK;
+}
+
+static void qlog_snapshot_print_cb(const qlog_event_t* event, void* data){
+    qlog_display_event((FILE*) data, event);
+}
+
+/**
+ * \brief Prints the events of a snapshot
+ *
+ * \param stream The stream to print the events into
+ * \param index The index of the snapshot (see qlog_snapshot_get_info)
+ * \return QLOG_RET_OK on success, QLOG_RET_ERR if there is no such snapshot
+ */
+int qlog_snapshot_print(FILE* stream, size_t index){
+    qlog_snapshot_t* slot = qlog_snapshot_get_internal(index);
+
+    if (slot == NULL || stream == NULL){
+        return QLOG_RET_ERR;
+    }
+    qlog_symbol_refresh();
+    if (qlog_lock_buffer_internal(slot->buffer)){
+        return QLOG_RET_ERR;
+    }
+    qlog_walk_buffer_internal(slot->buffer, qlog_snapshot_print_cb, stream);
+    qlog_unlock_buffer_internal(slot->buffer);
+    return QLOG_RET_OK;
+}
+
+/**
+ * \brief Releases the snapshots so new triggers can take them
+ *
+ * The memory of the slots is kept for the next snapshots.
+ */
+void qlog_snapshot_clear(void){
+    size_t i = 0;
+
+    for (i = 0; i < QLOG_MAX_SNAPSHOT_NUM; i++){
+        if (__sync_bool_compare_and_swap(&qlog_snapshots[i].state, QLOG_SNAPSHOT_READY, QLOG_SNAPSHOT_FILLING)){
+            qlog_reset_buffer_internal(qlog_snapshots[i].buffer);
+            __sync_lock_test_and_set(&qlog_snapshots[i].state, QLOG_SNAPSHOT_FREE);
+        }
+    }
+    qlog_snapshot_missed = 0;
+}
+
+/**
+ * \brief Drops the trigger rules and frees the snapshots (library cleanup)
+ */
+void qlog_trigger_cleanup_internal(void){
+    size_t i = 0;
+
+    qlog_trigger_clear();
+    for (i = 0; i < QLOG_MAX_SNAPSHOT_NUM; i++){
+        if (qlog_snapshots[i].buffer){
+            qlog_cleanup_buffer_internal(qlog_snapshots[i].buffer);
+        }
+    }
+    memset(qlog_snapshots, 0, sizeof(qlog_snapshots));
+    qlog_snapshot_missed = 0;
+}